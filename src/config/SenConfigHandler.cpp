@@ -4,6 +4,11 @@
  * Distributed under the terms of the MIT License.
  */
 #include "SenConfigHandler.h"
+#include "../relations/RelationCache.h"
+#include "../server/MessageCapture.h"
+#include "../server/Metrics.h"
+#include "../server/RequestDispatcher.h"
+#include "../server/Tracer.h"
 #include <sen/Sen.h>
 
 #include <AppFileInfo.h>
@@ -80,8 +85,8 @@ status_t SenConfigHandler::LoadSettings(BMessage* settingsMessage)
             return status;
         }
     }
-    LOG("successfully retrieved settings:\n");
-    settingsMessage->PrintToStream();
+    LOG("successfully retrieved settings.\n");
+    TRACE_MSG(SEN_TRACE_LEVEL_INFO, "settings", settingsMessage);
 
     return status;
 }
@@ -107,6 +112,11 @@ status_t SenConfigHandler::InitDefaultSettings(BPath* settingsPath, BMessage* se
     BPath path(*settingsPath);    // working path for setting up directories
 
     settingsMessage->AddString(SEN_CONFIG_PATH, path.Path());
+    settingsMessage->AddString(SEN_CONFIG_ID_FORMAT, SEN_CONFIG_ID_FORMAT_STRING);
+    settingsMessage->AddBool(SEN_CONFIG_ID_MONOTONIC, false);
+    settingsMessage->AddString(SEN_CONFIG_RELATION_FORMAT, SEN_CONFIG_RELATION_FORMAT_MESSAGE);
+    settingsMessage->AddInt32(SEN_CONFIG_RELATION_CACHE_SIZE, SEN_RELATION_CACHE_DEFAULT_SIZE);
+    settingsMessage->AddInt32(SEN_CONFIG_WORKERS, SEN_DISPATCH_DEFAULT_WORKERS);
     settingsDir.SetTo(path.Path());
 
     // set up context directories
@@ -189,9 +199,9 @@ void SenConfigHandler::MessageReceived(BMessage* message)
 {
     BMessage* reply = new BMessage();
 	status_t status = B_OK;
+    bigtime_t start = system_time();
 
-    LOG("in SEN ConfigHandler::MessageReceived\n");
-    message->PrintToStream();
+    TRACE_MSG(SEN_TRACE_LEVEL_INFO, "config request", message);
 
     // for now, we always need these same parameters for context
     // if optional context is empty, use global default context
@@ -216,8 +226,9 @@ void SenConfigHandler::MessageReceived(BMessage* message)
 
     reply->AddInt32("result", status);
 
-    LOG("SEN ConfigHandler sending reply:\n");
-    reply->PrintToStream();
+    TRACE_MSG(SEN_TRACE_LEVEL_INFO, "config reply", reply);
+    Metrics::RecordRequest(message->what, system_time() - start, status);
+    MessageCapture::Record(message, reply);
 
 	message->SendReply(reply);
 }
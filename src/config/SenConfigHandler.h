@@ -6,6 +6,21 @@
 
 #include <Application.h>
 
+// SEN:ID storage format, see SenId
+#define SEN_CONFIG_ID_FORMAT            "idFormat"
+#define SEN_CONFIG_ID_FORMAT_STRING     "string"
+#define SEN_CONFIG_ID_FORMAT_BINARY     "binary"
+// generate strictly increasing IDs per bucket, borrowing ahead under burst load
+#define SEN_CONFIG_ID_MONOTONIC         "idMonotonic"
+// on-attribute format of relations written, both formats are always read, see RelationRecord
+#define SEN_CONFIG_RELATION_FORMAT          "relationFormat"
+#define SEN_CONFIG_RELATION_FORMAT_MESSAGE  "message"
+#define SEN_CONFIG_RELATION_FORMAT_RECORD   "record"
+// max. number of parsed relations kept in memory, 0 disables the cache
+#define SEN_CONFIG_RELATION_CACHE_SIZE  "relationCacheSize"
+// number of threads handling relation and query requests, 0 handles all on the application thread
+#define SEN_CONFIG_WORKERS              "workerThreads"
+
 class SenConfigHandler : public BHandler {
 
 public:
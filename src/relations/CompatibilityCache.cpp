@@ -0,0 +1,290 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#include <Autolock.h>
+#include <FindDirectory.h>
+#include <MimeType.h>
+#include <NodeMonitor.h>
+#include <Path.h>
+
+#include "CompatibilityCache.h"
+#include <sen/Sen.h>
+
+CompatibilityCache::CompatibilityCache(RelationConfigRegistry* registry)
+    : fLock("CompatibilityCache"),
+      fRegistry(registry),
+      fHits(0),
+      fMisses(0)
+{
+}
+
+status_t CompatibilityCache::Init()
+{
+    BPath path;
+    status_t result = find_directory(B_USER_SETTINGS_DIRECTORY, &path);
+    if (result != B_OK) {
+        ERROR("could not find user settings directory: %s\n", strerror(result));
+        return result;
+    }
+
+    path.Append("mime_db");
+    path.Append(SEN_CLASS_SUPERTYPE);
+
+    // may not exist yet, classification types are then only picked up after a restart
+    BNode classDir(path.Path());
+    if ((result = classDir.InitCheck()) == B_OK) {
+        BAutolock _(fLock);
+        classDir.GetNodeRef(&fClassDir);
+    }
+
+    return result;
+}
+
+status_t CompatibilityCache::GetCompatibleRelations(const char* sourceType, BStringList* relationTypes,
+    BMessage* relationConfigs)
+{
+    BString key(sourceType);
+    key.ToLower();
+
+    {
+        BAutolock _(fLock);
+        _CheckTableLocked();
+
+        auto it = fRelationsBySource.find(key.String());
+        if (it != fRelationsBySource.end()) {
+            fHits++;
+            relationTypes->Add(it->second.types);
+            *relationConfigs = it->second.configs;
+            return B_OK;
+        }
+        fMisses++;
+    }
+
+    std::shared_ptr<const RelationTypeTable> snapshot = fRegistry->Types();
+
+    BStringList installedTypes;
+    status_t result = _GetInstalledTypes(SEN_RELATION_SUPERTYPE, &installedTypes);
+    if (result != B_OK)
+        return result;
+
+    compatible_types compatible;
+
+    for (int32 i = 0; i < installedTypes.CountStrings(); i++) {
+        BString relationType = installedTypes.StringAt(i);
+
+        std::shared_ptr<const RelationTypeTable> table;
+        const relation_type_info* info = fRegistry->Find(relationType.String(), &table);
+
+        if (info == NULL) {
+            // no config to filter on, the relation applies to any type
+            compatible.types.Add(relationType);
+            continue;
+        }
+
+        BStringList sourceTypes;
+        info->config.FindStrings(SEN_RELATION_CONFIG_SOURCE_TYPES, &sourceTypes);
+
+        if (MatchesType(sourceTypes, key.String())) {
+            compatible.types.Add(relationType);
+            compatible.configs.AddMessage(relationType.String(), &info->config);
+        }
+    }
+
+    relationTypes->Add(compatible.types);
+    *relationConfigs = compatible.configs;
+
+    // only cache if no relation type changed (or was loaded on demand) meanwhile
+    BAutolock _(fLock);
+    _CheckTableLocked();
+
+    if (fTable == snapshot)
+        fRelationsBySource[key.String()] = compatible;
+
+    return B_OK;
+}
+
+status_t CompatibilityCache::GetCompatibleTargetTypes(const char* relationType, BStringList* targetTypes,
+    BMessage* targetConfigs)
+{
+    BString key(relationType);
+    key.ToLower();
+
+    {
+        BAutolock _(fLock);
+        _CheckTableLocked();
+
+        auto it = fTargetsByRelation.find(key.String());
+        if (it != fTargetsByRelation.end()) {
+            fHits++;
+            targetTypes->Add(it->second.types);
+            *targetConfigs = it->second.configs;
+            return B_OK;
+        }
+        fMisses++;
+    }
+
+    std::shared_ptr<const RelationTypeTable> snapshot = fRegistry->Types();
+
+    BStringList allowedTypes;
+    std::shared_ptr<const RelationTypeTable> table;
+    const relation_type_info* info = fRegistry->Find(key.String(), &table);
+
+    if (info != NULL)
+        info->config.FindStrings(SEN_RELATION_CONFIG_TARGET_TYPES, &allowedTypes);
+
+    compatible_types compatible;
+
+    // associations are meta relations and handled slightly differently, here we always take the meta/ types only
+    if (key == SEN_ASSOC_RELATION_TYPE || key.StartsWith(SEN_CLASS_SUPERTYPE "/")) {
+        BStringList classTypes;
+        status_t result = _GetInstalledTypes(SEN_CLASS_SUPERTYPE, &classTypes);
+        if (result != B_OK) {
+            ERROR("error getting installed types from MIME db: %s\n", strerror(result));
+            return result;
+        }
+
+        for (int32 i = 0; i < classTypes.CountStrings(); i++) {
+            BString classType = classTypes.StringAt(i);
+            if (MatchesType(allowedTypes, classType.String()))
+                compatible.types.Add(classType);
+        }
+    } else {
+        // using available template types allowed by relation
+        compatible.types.Add(allowedTypes);
+    }
+
+    _AddConfigs(compatible.types, &compatible.configs);
+
+    targetTypes->Add(compatible.types);
+    *targetConfigs = compatible.configs;
+
+    BAutolock _(fLock);
+    _CheckTableLocked();
+
+    if (fTable == snapshot)
+        fTargetsByRelation[key.String()] = compatible;
+
+    return B_OK;
+}
+
+void CompatibilityCache::HandleNodeMonitor(const BMessage* message)
+{
+    int32 opcode;
+    int32 device;
+
+    if (message->FindInt32("opcode", &opcode) != B_OK
+        || message->FindInt32("device", &device) != B_OK) {
+        return;
+    }
+
+    // relation type changes are noticed by the rebuilt type table, only watch for classification types here
+    ino_t directory = -1, toDirectory = -1;
+
+    switch (opcode) {
+        case B_ENTRY_CREATED:
+        case B_ENTRY_REMOVED:
+            message->FindInt64("directory", &directory);
+            break;
+        case B_ENTRY_MOVED:
+            message->FindInt64("from directory", &directory);
+            message->FindInt64("to directory", &toDirectory);
+            break;
+        default:
+            return;
+    }
+
+    BAutolock _(fLock);
+
+    if (node_ref(device, directory) == fClassDir || node_ref(device, toDirectory) == fClassDir) {
+        LOG("classification types changed, dropping cached compatible types.\n");
+        fRelationsBySource.clear();
+        fTargetsByRelation.clear();
+    }
+}
+
+void CompatibilityCache::GetStats(BMessage* stats)
+{
+    BAutolock _(fLock);
+
+    int64 lookups = fHits + fMisses;
+
+    stats->AddInt32("sourceTypes", fRelationsBySource.size());
+    stats->AddInt32("relationTypes", fTargetsByRelation.size());
+    stats->AddInt64("hits", fHits);
+    stats->AddInt64("misses", fMisses);
+    stats->AddDouble("hitRate", lookups > 0 ? (double)fHits / lookups : 0.0);
+}
+
+bool CompatibilityCache::MatchesType(const BStringList& allowedTypes, const char* mimeType)
+{
+    if (allowedTypes.IsEmpty())
+        return true;
+
+    BString type(mimeType);
+    type.ToLower();
+
+    BString supertype(type);
+    int32 slash = supertype.FindFirst('/');
+    if (slash >= 0)
+        supertype.Truncate(slash);
+
+    for (int32 i = 0; i < allowedTypes.CountStrings(); i++) {
+        BString allowed = allowedTypes.StringAt(i);
+        allowed.ToLower();
+
+        if (allowed == "*" || allowed == type)
+            return true;
+
+        // supertype, either plain or with a wildcard subtype
+        if (allowed.EndsWith("/*"))
+            allowed.Truncate(allowed.Length() - 2);
+        if (allowed.FindFirst('/') < 0 && allowed == supertype)
+            return true;
+    }
+
+    return false;
+}
+
+/*
+ * private methods
+ */
+
+void CompatibilityCache::_CheckTableLocked()
+{
+    std::shared_ptr<const RelationTypeTable> table = fRegistry->Types();
+
+    if (table != fTable) {
+        fRelationsBySource.clear();
+        fTargetsByRelation.clear();
+        fTable = table;
+    }
+}
+
+status_t CompatibilityCache::_GetInstalledTypes(const char* supertype, BStringList* types)
+{
+    BMessage installedTypes;
+    status_t result = BMimeType::GetInstalledTypes(supertype, &installedTypes);
+
+    if (result != B_OK) {
+        ERROR("could not get installed MIME types for %s: %s\n", supertype, strerror(result));
+        return result;
+    }
+
+    installedTypes.FindStrings("types", types);  // as per MimeType API spec, missing if none installed
+    return B_OK;
+}
+
+void CompatibilityCache::_AddConfigs(const BStringList& types, BMessage* configs)
+{
+    for (int32 i = 0; i < types.CountStrings(); i++) {
+        BString type = types.StringAt(i);
+        BMessage config;
+
+        if (fRegistry->Get(type.String(), &config) == B_OK) {
+            configs->AddMessage(type.String(), &config);
+        }
+    }
+}
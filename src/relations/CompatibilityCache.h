@@ -0,0 +1,92 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#pragma once
+
+#include <Locker.h>
+#include <Message.h>
+#include <Node.h>
+#include <StringList.h>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "RelationConfigRegistry.h"
+
+// optional relation config fields restricting the types a relation applies to, each
+// holding MIME types or supertypes ("image" or "image/*"). Any type is allowed if missing.
+#ifndef SEN_RELATION_CONFIG_SOURCE_TYPES
+#define SEN_RELATION_CONFIG_SOURCE_TYPES    "sourceTypes"
+#endif
+#ifndef SEN_RELATION_CONFIG_TARGET_TYPES
+#define SEN_RELATION_CONFIG_TARGET_TYPES    "targetTypes"
+#endif
+
+/**
+ * answers "which relations apply to this source type" and "which target types fit this
+ * relation" from memory, so the compatible relations menu does not enumerate the MIME DB
+ * and read every relation config on each right-click.
+ *
+ * Results are computed once per source MIME type (resp. relation type) with the type
+ * filters of the relation configs applied, and dropped whenever the relation type table
+ * is rebuilt or classification types are installed, renamed or removed.
+ */
+class CompatibilityCache {
+
+public:
+                CompatibilityCache(RelationConfigRegistry* registry);
+
+    /**
+     * set up monitoring of the classification types in the MIME DB.
+     */
+    status_t    Init();
+
+    /**
+     * get the relation types compatible with the given source MIME type and their configs,
+     * keyed by relation type.
+     */
+    status_t    GetCompatibleRelations(const char* sourceType, BStringList* relationTypes,
+                                       BMessage* relationConfigs);
+    /**
+     * get the target types compatible with the given relation type and their configs.
+     * Associations target classification types, other relations the types listed in
+     * their config, if any.
+     */
+    status_t    GetCompatibleTargetTypes(const char* relationType, BStringList* targetTypes,
+                                         BMessage* targetConfigs);
+
+    void        HandleNodeMonitor(const BMessage* message);
+    void        GetStats(BMessage* stats);
+
+    /**
+     * check if `mimeType` matches any of the given MIME types or supertypes.
+     * An empty list matches any type.
+     */
+    static bool MatchesType(const BStringList& allowedTypes, const char* mimeType);
+
+private:
+    struct compatible_types {
+        BStringList types;
+        BMessage    configs;
+    };
+
+    void        _CheckTableLocked();
+    status_t    _GetInstalledTypes(const char* supertype, BStringList* types);
+    void        _AddConfigs(const BStringList& types, BMessage* configs);
+
+    BLocker                                             fLock;
+    RelationConfigRegistry*                             fRegistry;
+    node_ref                                            fClassDir;
+
+    // table the cached results were computed from
+    std::shared_ptr<const RelationTypeTable>            fTable;
+    std::unordered_map<std::string, compatible_types>   fRelationsBySource;
+    std::unordered_map<std::string, compatible_types>   fTargetsByRelation;
+
+    int64                                               fHits;
+    int64                                               fMisses;
+};
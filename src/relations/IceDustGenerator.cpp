@@ -1,68 +1,220 @@
-/* TSID generator used for generating compact, efficient and reasonably unique ID's used as SEN:ID attributes
- * reference: https://www.foxhound.systems/blog/time-sorted-unique-identifiers/
- * taken from https://github.com/lynzrand/icedust/blob/master/src/lib.rs
- * converted using https://www.codeconvert.ai/app
- */
-#include "IceDustGenerator.h"
-#include <String.h>
-
-IceDustGenerator::IceDustGenerator()
-: IceDustGenerator(BString::HashValue("hokusai-machine") << 2 | BString::HashValue("sen-labs-server"))
-{
-}
-
-IceDustGenerator::IceDustGenerator(uint64 machine_id)
-: machine_id(machine_id), last_timestamp(0), last_random(0)
-{
-    static_assert((TIMESTAMP_BITS + MACHINE_ID_BITS) < 64, "TIMESTAMP_BITS + MACHINE_ID_BITS must be less than 64");
-    machine_id = machine_id & (UINT64_MAX >> (64 - MACHINE_ID_BITS));
-
-    // using newer C++11 random number generator
-    // see https://en.cppreference.com/w/cpp/numeric/random
-    // Seed with a real random value, if available
-    std::random_device rd;
-    generator = new std::mt19937_64(rd());
-    distrib   = std::uniform_int_distribution<uint64>(0, UINT64_MAX);
-}
-
-uint64 IceDustGenerator::generate() {
-    auto [timestamp, inc] = get_timestamp();
-    bool simple_inc = inc && MONOTONIC;
-    uint64 random = get_random(simple_inc);
-    uint64 res = (timestamp << (MACHINE_ID_BITS + RANDOM_BITS)) | (machine_id << RANDOM_BITS) | random;
-    return res;
-}
-
-uint64 IceDustGenerator::generate_with_random(uint64 random) {
-    auto [timestamp, _] = get_timestamp();
-    uint64 res = (timestamp << (MACHINE_ID_BITS + RANDOM_BITS)) | (machine_id << RANDOM_BITS) | random;
-    return res;
-}
-
-uint64 IceDustGenerator::get_random(bool simple_inc) {
-    uint64 random;
-    if (simple_inc) {
-        last_random = last_random + 1;
-        random = last_random;
-    } else {
-        random = distrib(*generator);
-        last_random = random;
-    }
-    random = random & (UINT64_MAX >> (64 - RANDOM_BITS));
-    return random;
-}
-
-std::pair<uint64_t, bool> IceDustGenerator::get_timestamp() {
-    auto timestamp = std::chrono::system_clock::now().time_since_epoch().count();
-    if (timestamp >= ((1L << TIMESTAMP_BITS) * TIMESTAMP_RESOLUTION)) {
-        return {0, false};
-    }
-    timestamp = timestamp / TIMESTAMP_RESOLUTION;
-    uint64 last = last_timestamp;
-    if (last > timestamp) {
-        return {0, false};
-    }
-    last_timestamp = timestamp;
-    return {timestamp, timestamp == last};
-}
-
+/* TSID generator used for generating compact, efficient and reasonably unique ID's used as SEN:ID attributes
+ * reference: https://www.foxhound.systems/blog/time-sorted-unique-identifiers/
+ * taken from https://github.com/lynzrand/icedust/blob/master/src/lib.rs
+ * converted using https://www.codeconvert.ai/app
+ */
+#include "IceDustGenerator.h"
+
+#include <OS.h>
+#include <random>
+#include <String.h>
+
+// wide enough to hold BUCKET_CAPACITY itself, the remaining bits hold the timestamp bucket
+static constexpr long   SEQUENCE_FIELD_BITS = 24;
+static constexpr uint64 SEQUENCE_FIELD_MASK = (1ULL << SEQUENCE_FIELD_BITS) - 1;
+
+static_assert(TIMESTAMP_BITS + SEQUENCE_FIELD_BITS <= 64, "state word too small");
+static_assert(BUCKET_CAPACITY <= SEQUENCE_FIELD_MASK, "sequence field too small");
+
+// per thread block of reserved sequence numbers
+struct sequence_block {
+    uint64 instance;
+    uint64 epoch;
+    bool   monotonic;
+    uint64 bucket;
+    uint64 next;
+    uint64 end;
+};
+
+static thread_local sequence_block sBlock = { 0, 0, false, 0, 0, 0 };
+static std::atomic<uint64> sInstanceCount(0);
+
+// splitmix64 finalizer, spreads bucket numbers over the random space
+static inline uint64 mix(uint64 value)
+{
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+    return value ^ (value >> 31);
+}
+
+IceDustGenerator::IceDustGenerator()
+: IceDustGenerator(BString::HashValue("hokusai-machine") << 2 | BString::HashValue("sen-labs-server"))
+{
+}
+
+IceDustGenerator::IceDustGenerator(uint64 machine_id)
+: machine_id(machine_id), instance(++sInstanceCount), state(0), epoch(0), monotonic(MONOTONIC),
+  generated(0), contention(0), skewed(0), borrowed(0), waits(0), first_generated(0)
+{
+    static_assert((TIMESTAMP_BITS + MACHINE_ID_BITS) < 64, "TIMESTAMP_BITS + MACHINE_ID_BITS must be less than 64");
+    this->machine_id = machine_id & (UINT64_MAX >> (64 - MACHINE_ID_BITS));
+
+    // Seed with a real random value, if available, only used for the per-bucket offsets,
+    // making IDs of different processes in the same bucket unlikely to collide.
+    std::random_device rd;
+    seed = (static_cast<uint64>(rd()) << 32) | rd();
+}
+
+uint64 IceDustGenerator::generate() {
+    sequence_block& block = sBlock;
+
+    while (block.instance != instance || block.epoch != epoch.load(std::memory_order_acquire)
+           || block.next >= block.end || block.bucket < get_timestamp()) {
+        uint64 currentEpoch = epoch.load(std::memory_order_acquire);
+        bool   isMonotonic  = monotonic.load(std::memory_order_acquire);
+        uint64 bucket, first;
+        uint64 count = reserve(BLOCK_SIZE, &bucket, &first);
+
+        // drop blocks reserved while the mode changed, see set_monotonic()
+        if (epoch.load(std::memory_order_acquire) != currentEpoch)
+            continue;
+
+        block.instance  = instance;
+        block.epoch     = currentEpoch;
+        block.monotonic = isMonotonic;
+        block.bucket    = bucket;
+        block.next      = first;
+        block.end       = first + count;
+        break;
+    }
+
+    return compose(block.bucket, block.next++, block.monotonic);
+}
+
+void IceDustGenerator::generate_batch(uint64* out, size_t n) {
+    size_t done = 0;
+
+    while (done < n) {
+        uint64 currentEpoch = epoch.load(std::memory_order_acquire);
+        bool   isMonotonic  = monotonic.load(std::memory_order_acquire);
+        uint64 bucket, first;
+        uint64 count = reserve(n - done, &bucket, &first);
+
+        if (epoch.load(std::memory_order_acquire) != currentEpoch)
+            continue;
+
+        for (uint64 i = 0; i < count; i++) {
+            out[done++] = compose(bucket, first + i, isMonotonic);
+        }
+    }
+}
+
+uint64 IceDustGenerator::generate_with_random(uint64 random) {
+    uint64 timestamp = get_timestamp();
+    uint64 res = (timestamp << (MACHINE_ID_BITS + RANDOM_BITS)) | (machine_id << RANDOM_BITS) | (random & RANDOM_MASK);
+    return res;
+}
+
+void IceDustGenerator::set_monotonic(bool monotonic) {
+    if (this->monotonic.exchange(monotonic) == monotonic)
+        return;
+
+    // both modes map sequence numbers differently, so never mix them within a bucket:
+    // make threads drop blocks reserved under the old mode, then move on to a fresh bucket.
+    // The epoch is bumped first so any reservation in the fresh bucket sees the new epoch.
+    epoch.fetch_add(1, std::memory_order_acq_rel);
+
+    uint64 current = state.load(std::memory_order_acquire);
+    uint64 desired;
+    do {
+        uint64 nextBucket = (current >> SEQUENCE_FIELD_BITS) + 1;
+        uint64 now        = get_timestamp();
+        desired = (now > nextBucket ? now : nextBucket) << SEQUENCE_FIELD_BITS;
+    } while (! state.compare_exchange_weak(current, desired, std::memory_order_acq_rel));
+}
+
+bool IceDustGenerator::is_monotonic() {
+    return monotonic.load(std::memory_order_acquire);
+}
+
+void IceDustGenerator::get_stats(tsid_stats* stats) {
+    stats->generated  = generated.load(std::memory_order_relaxed);
+    stats->contention = contention.load(std::memory_order_relaxed);
+    stats->skewed     = skewed.load(std::memory_order_relaxed);
+    stats->borrowed   = borrowed.load(std::memory_order_relaxed);
+    stats->waits      = waits.load(std::memory_order_relaxed);
+
+    bigtime_t start   = first_generated.load(std::memory_order_relaxed);
+    bigtime_t elapsed = system_time() - start;
+    stats->throughput = (start > 0 && elapsed > 0) ? stats->generated * 1000000.0 / elapsed : 0.0;
+}
+
+/**
+ * atomically reserve up to `count` sequence numbers in the current timestamp bucket.
+ * If the clock went backwards, the last bucket is kept so reservations never overlap,
+ * and the following buckets are used once it is exhausted.
+ *
+ * @return the number of sequence numbers reserved, starting at `first` in `bucket`.
+ */
+uint64 IceDustGenerator::reserve(uint64 count, uint64* bucket, uint64* first) {
+    uint64 current = state.load(std::memory_order_acquire);
+
+    for (;;) {
+        uint64 now        = get_timestamp();
+        uint64 lastBucket = current >> SEQUENCE_FIELD_BITS;
+        uint64 used       = current & SEQUENCE_FIELD_MASK;
+
+        uint64 newBucket = lastBucket;
+        uint64 start     = used;
+        bool   borrow    = false;
+
+        if (now > lastBucket) {
+            newBucket = now;
+            start     = 0;
+        } else if (used == BUCKET_CAPACITY) {
+            if (monotonic.load(std::memory_order_relaxed) || now < lastBucket) {
+                // burst, or the clock went back: carry over into the next bucket ahead of the clock,
+                // which catches up later. Waiting for a clock stepped back by NTP could take hours.
+                newBucket = lastBucket + 1;
+                start     = 0;
+                borrow    = true;
+            } else {
+                // bucket exhausted, wait for the next one, at most TIMESTAMP_RESOLUTION
+                waits.fetch_add(1, std::memory_order_relaxed);
+                snooze(TIMESTAMP_RESOLUTION * 100);
+                current = state.load(std::memory_order_acquire);
+                continue;
+            }
+        }
+
+        uint64 available = BUCKET_CAPACITY - start;
+        uint64 granted   = count < available ? count : available;
+        uint64 desired   = (newBucket << SEQUENCE_FIELD_BITS) | (start + granted);
+
+        if (state.compare_exchange_weak(current, desired, std::memory_order_acq_rel)) {
+            if (now < lastBucket)
+                skewed.fetch_add(1, std::memory_order_relaxed);
+            if (borrow)
+                borrowed.fetch_add(1, std::memory_order_relaxed);
+            if (generated.fetch_add(granted, std::memory_order_relaxed) == 0) {
+                int64 unset = 0;
+                first_generated.compare_exchange_strong(unset, system_time());
+            }
+
+            *bucket = newBucket;
+            *first  = start;
+            return granted;
+        }
+        // lost the race, current was updated by compare_exchange, try again
+        contention.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+uint64 IceDustGenerator::compose(uint64 bucket, uint64 sequence, bool monotonic) {
+    uint64 random;
+
+    if (monotonic) {
+        random = sequence & RANDOM_MASK;
+    } else {
+        // offset + sequence is a bijection on the random space, so distinct sequences stay distinct
+        random = (mix(bucket ^ seed) + sequence) & RANDOM_MASK;
+    }
+    return (bucket << (MACHINE_ID_BITS + RANDOM_BITS)) | (machine_id << RANDOM_BITS) | random;
+}
+
+uint64 IceDustGenerator::get_timestamp() {
+    auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+
+    return (static_cast<uint64>(millis) / TIMESTAMP_RESOLUTION) & (UINT64_MAX >> (64 - TIMESTAMP_BITS));
+}
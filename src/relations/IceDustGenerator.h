@@ -1,17 +1,43 @@
 #pragma once
 
+#include <atomic>
 #include <chrono>
 #include <utility>
-#include <random>
 #include <SupportDefs.h>
 
 static constexpr long TIMESTAMP_BITS  = 39;
 static constexpr long MACHINE_ID_BITS = 10;
-static constexpr long TIMESTAMP_RESOLUTION = 10;
-static constexpr bool MONOTONIC = false;
+static constexpr long TIMESTAMP_RESOLUTION = 10;    // in ms per timestamp bucket
+static constexpr bool MONOTONIC = false;            // default, see set_monotonic()
 
 static constexpr long RANDOM_BITS = 64 - TIMESTAMP_BITS - MACHINE_ID_BITS;
+static constexpr uint64 RANDOM_MASK = UINT64_MAX >> (64 - RANDOM_BITS);
 
+// IDs per timestamp bucket and the sequence numbers handed to a thread per atomic reservation
+static constexpr uint64 BUCKET_CAPACITY = 1ULL << RANDOM_BITS;
+static constexpr uint64 BLOCK_SIZE = 64;
+
+struct tsid_stats {
+    uint64  generated;          // IDs reserved so far
+    uint64  contention;         // reservations retried because another thread won the race
+    uint64  skewed;             // reservations made while the clock was behind the last bucket
+    uint64  borrowed;           // buckets taken ahead of the clock, in monotonic mode or while it is behind
+    uint64  waits;              // waits for the next bucket in random mode
+    double  throughput;         // IDs per second since the first ID was generated
+};
+
+/**
+ * thread safe TSID generator.
+ *
+ * The random part of each ID is a per-bucket random offset plus a sequence number. Sequence
+ * numbers are reserved in blocks from a single atomic (bucket, used) word, so IDs stay unique
+ * even when several threads generate within the same timestamp bucket, without any locking.
+ *
+ * In monotonic mode the random part is the plain sequence number, and when a bucket is used up
+ * the sequence carries over into the next bucket ahead of the clock instead of waiting for it.
+ * In both modes, a clock going backwards keeps the last bucket in use and carries over into the
+ * following buckets once it is used up, so ID generation never stalls until the clock catches up.
+ */
 class IceDustGenerator {
 
 public:
@@ -19,17 +45,35 @@ public:
     IceDustGenerator(uint64 machine_id);
 
     uint64_t generate();
+    /**
+     * fill `out` with `n` unique IDs, using as few atomic reservations as possible.
+     */
+    void     generate_batch(uint64* out, size_t n);
     uint64_t generate_with_random(uint64 random);
 
-private:
-    std::pair<uint64, bool> get_timestamp();
+    void     set_monotonic(bool monotonic);
+    bool     is_monotonic();
+    void     get_stats(tsid_stats* stats);
 
-    std::mt19937_64                          *generator;
-    std::uniform_int_distribution<uint64>    distrib;
+private:
+    uint64 get_timestamp();
+    uint64 reserve(uint64 count, uint64* bucket, uint64* first);
+    uint64 compose(uint64 bucket, uint64 sequence, bool monotonic);
 
     uint64 machine_id;
-    uint64 last_timestamp;
-    uint64 last_random;
+    uint64 seed;
+    uint64 instance;
+
+    // timestamp bucket << SEQUENCE_FIELD_BITS | sequence numbers used in that bucket
+    std::atomic<uint64> state;
+    // bumped on mode changes to invalidate blocks reserved by threads under the old mode
+    std::atomic<uint64> epoch;
+    std::atomic<bool>   monotonic;
 
-    uint64 get_random(bool simple_inc);
+    std::atomic<uint64> generated;
+    std::atomic<uint64> contention;
+    std::atomic<uint64> skewed;
+    std::atomic<uint64> borrowed;
+    std::atomic<uint64> waits;
+    std::atomic<int64>  first_generated;
 };
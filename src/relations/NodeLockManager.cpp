@@ -0,0 +1,156 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#include <algorithm>
+
+#include "NodeLockManager.h"
+
+NodeLockManager::NodeLockManager()
+    : fContended(0)
+{
+}
+
+void NodeLockManager::Lock(const node_ref* node, const node_ref* other)
+{
+    int32 stripe = _StripeFor(node);
+
+    if (other == NULL) {
+        _LockStripe(stripe);
+        return;
+    }
+
+    // always lock in stripe order, so A->B and B->A writes cannot deadlock
+    int32 otherStripe = _StripeFor(other);
+
+    if (stripe == otherStripe) {
+        _LockStripe(stripe);
+    } else if (stripe < otherStripe) {
+        _LockStripe(stripe);
+        _LockStripe(otherStripe);
+    } else {
+        _LockStripe(otherStripe);
+        _LockStripe(stripe);
+    }
+}
+
+void NodeLockManager::Unlock(const node_ref* node, const node_ref* other)
+{
+    int32 stripe = _StripeFor(node);
+    fStripes[stripe].Unlock();
+
+    if (other != NULL) {
+        int32 otherStripe = _StripeFor(other);
+        if (otherStripe != stripe)
+            fStripes[otherStripe].Unlock();
+    }
+}
+
+void NodeLockManager::Lock(const std::vector<node_ref>& nodes)
+{
+    std::vector<int32> stripes;
+    _StripesFor(nodes, &stripes);
+
+    for (int32 stripe : stripes) {
+        _LockStripe(stripe);
+    }
+}
+
+void NodeLockManager::Unlock(const std::vector<node_ref>& nodes)
+{
+    std::vector<int32> stripes;
+    _StripesFor(nodes, &stripes);
+
+    for (int32 stripe : stripes) {
+        fStripes[stripe].Unlock();
+    }
+}
+
+int64 NodeLockManager::CountContended()
+{
+    return atomic_get64(&fContended);
+}
+
+int32 NodeLockManager::StripeFor(const node_ref* node)
+{
+    return _StripeFor(node);
+}
+
+/*
+ * private methods
+ */
+
+int32 NodeLockManager::_StripeFor(const node_ref* node)
+{
+    uint64 hash = (uint64)node->node * 0x9e3779b97f4a7c15ULL ^ (uint64)node->device;
+    return (hash >> 32) % SEN_NODE_LOCK_STRIPES;
+}
+
+void NodeLockManager::_StripesFor(const std::vector<node_ref>& nodes, std::vector<int32>* stripes)
+{
+    // each stripe once, even if several nodes share it
+    for (const node_ref& node : nodes) {
+        stripes->push_back(_StripeFor(&node));
+    }
+
+    std::sort(stripes->begin(), stripes->end());
+    stripes->erase(std::unique(stripes->begin(), stripes->end()), stripes->end());
+}
+
+void NodeLockManager::_LockStripe(int32 stripe)
+{
+    // count contention to tell if more stripes are needed
+    if (fStripes[stripe].LockWithTimeout(0) == B_OK)
+        return;
+
+    atomic_add64(&fContended, 1);
+    fStripes[stripe].Lock();
+}
+
+NodeLocker::NodeLocker(NodeLockManager* manager, const node_ref* node, const node_ref* other)
+    : fManager(manager),
+      fHasNode(node != NULL),
+      fHasOther(other != NULL)
+{
+    if (fHasNode)
+        fNode = *node;
+    if (fHasOther)
+        fOther = *other;
+
+    _Lock();
+}
+
+NodeLocker::NodeLocker(NodeLockManager* manager, const entry_ref* ref, const entry_ref* other)
+    : fManager(manager),
+      fHasNode(false),
+      fHasOther(false)
+{
+    if (ref != NULL) {
+        BNode node(ref);
+        fHasNode = node.InitCheck() == B_OK && node.GetNodeRef(&fNode) == B_OK;
+    }
+    if (other != NULL) {
+        BNode node(other);
+        fHasOther = node.InitCheck() == B_OK && node.GetNodeRef(&fOther) == B_OK;
+    }
+
+    _Lock();
+}
+
+NodeLocker::~NodeLocker()
+{
+    if (fHasNode)
+        fManager->Unlock(&fNode, fHasOther ? &fOther : NULL);
+    else if (fHasOther)
+        fManager->Unlock(&fOther);
+}
+
+void NodeLocker::_Lock()
+{
+    if (fHasNode)
+        fManager->Lock(&fNode, fHasOther ? &fOther : NULL);
+    else if (fHasOther)
+        fManager->Lock(&fOther);
+}
@@ -0,0 +1,72 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#pragma once
+
+#include <Entry.h>
+#include <Locker.h>
+#include <Node.h>
+
+#include <vector>
+
+#define SEN_NODE_LOCK_STRIPES   64
+
+/**
+ * striped lock table serializing read-modify-write cycles on node attributes.
+ *
+ * Each node maps to one of SEN_NODE_LOCK_STRIPES locks, so writes to unrelated nodes
+ * mostly run in parallel. Writes spanning two nodes (source and inverse relation on the
+ * target) must lock both in one call, which always acquires the stripes in ascending
+ * order to avoid deadlocks. Locks are recursive for the owning thread.
+ */
+class NodeLockManager {
+
+public:
+                NodeLockManager();
+
+    void        Lock(const node_ref* node, const node_ref* other = NULL);
+    void        Unlock(const node_ref* node, const node_ref* other = NULL);
+    /**
+     * lock any number of nodes at once for batch writes, again in ascending stripe order.
+     */
+    void        Lock(const std::vector<node_ref>& nodes);
+    void        Unlock(const std::vector<node_ref>& nodes);
+
+    int64       CountContended();
+    /**
+     * the stripe `node` maps to, e.g. for bounding the number of stripes a batch locks.
+     */
+    int32       StripeFor(const node_ref* node);
+
+private:
+    int32       _StripeFor(const node_ref* node);
+    void        _StripesFor(const std::vector<node_ref>& nodes, std::vector<int32>* stripes);
+    void        _LockStripe(int32 stripe);
+
+    BLocker     fStripes[SEN_NODE_LOCK_STRIPES];
+    int64       fContended;
+};
+
+/**
+ * scoped lock for one or two nodes, given by node_ref or entry_ref.
+ * Entries that cannot be resolved to a node are simply not locked.
+ */
+class NodeLocker {
+
+public:
+                NodeLocker(NodeLockManager* manager, const node_ref* node, const node_ref* other = NULL);
+                NodeLocker(NodeLockManager* manager, const entry_ref* ref, const entry_ref* other = NULL);
+                ~NodeLocker();
+
+private:
+    void        _Lock();
+
+    NodeLockManager*    fManager;
+    node_ref            fNode;
+    node_ref            fOther;
+    bool                fHasNode;
+    bool                fHasOther;
+};
@@ -0,0 +1,25 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#pragma once
+
+#include "NodeLockManager.h"
+
+/**
+ * protocol of batch relation adds, shared by the server and the tools.
+ * TODO: move to <sen/Sen.h> next to the other SEN_RELATION* codes with the next SDK update.
+ */
+
+// add many relations at once, with one SEN_RELATION_SOURCE_REF, SEN_RELATION_TYPE and
+// SEN_RELATION_TARGET_REF per item and either no or one SEN_RELATION_PROPERTIES per item
+#define SEN_RELATIONS_ADD_BATCH         'SRab'
+#define SEN_RELATIONS_BATCH_MAX_ITEMS   4096
+// items are processed in chunks locking at most this many node lock stripes at once
+#define SEN_RELATIONS_BATCH_MAX_STRIPES (SEN_NODE_LOCK_STRIPES / 4)
+
+// reply fields, one per item
+#define SEN_RELATION_ITEM_STATUS        "itemStatus"
+#define SEN_RELATION_ITEM_RESULT        "itemResult"
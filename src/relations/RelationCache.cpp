@@ -0,0 +1,432 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#include <Autolock.h>
+#include <NodeMonitor.h>
+#include <String.h>
+
+#include <algorithm>
+#include <string.h>
+#include <vector>
+
+#include "RelationCache.h"
+#include <sen/Sen.h>
+
+RelationCache::RelationCache()
+    : fLock("RelationCache"),
+      fCapacity(0),
+      fHits(0),
+      fMisses(0),
+      fInvalidations(0),
+      fEvictions(0),
+      fHashLookups(0),
+      fHashCollisions(0)
+{
+    memset(fGenerations, 0, sizeof(fGenerations));
+}
+
+RelationCache::~RelationCache()
+{
+    Clear();
+}
+
+void RelationCache::Init(const BMessenger& target, int32 capacity)
+{
+    BAutolock _(fLock);
+
+    fTarget   = target;
+    fCapacity = capacity < 0 ? 0 : (capacity > SEN_RELATION_CACHE_MAX_SIZE ? SEN_RELATION_CACHE_MAX_SIZE : capacity);
+
+    while ((int32)fEntries.size() > fCapacity) {
+        _Evict(--fEntries.end());
+    }
+
+    LOG("relation cache holds up to %d entries.\n", fCapacity);
+}
+
+status_t RelationCache::Get(const node_ref* node, const char* attrName, BMessage* relations,
+    uint32* ticket)
+{
+    BAutolock _(fLock);
+
+    if (fCapacity == 0)
+        return B_NO_INIT;
+
+    auto it = fIndex.find(cache_key(*node, attrName));
+    if (it == fIndex.end()) {
+        fMisses++;
+        if (ticket != NULL)
+            *ticket = *_Generation(node, attrName);
+
+        // watch from now on, changes before the following Put() then invalidate the pending read
+        if (fWatched.find(*node) == fWatched.end() && _Watch(node) == B_OK)
+            fWatched[*node] = 0;
+
+        return B_ENTRY_NOT_FOUND;
+    }
+
+    fHits++;
+    fEntries.splice(fEntries.begin(), fEntries, it->second);
+    *relations = it->second->relations;
+
+    return B_OK;
+}
+
+void RelationCache::Put(const node_ref* node, const char* attrName, const BMessage* relations,
+    uint32 ticket)
+{
+    BAutolock _(fLock);
+
+    if (fCapacity == 0)
+        return;
+
+    // written or appended to since the caller's Get(), what it read may be stale
+    if (*_Generation(node, attrName) != ticket)
+        return;
+
+    // not watched means it could not be watched or changed since Get(), don't cache what we can't trust
+    auto watched = fWatched.find(*node);
+    if (watched == fWatched.end())
+        return;
+
+    cache_key key(*node, attrName);
+    auto it = fIndex.find(key);
+
+    if (it != fIndex.end()) {
+        it->second->relations = *relations;
+        it->second->hashes.clear();
+        it->second->hashed = false;
+        fEntries.splice(fEntries.begin(), fEntries, it->second);
+        return;
+    }
+
+    fEntries.push_front(cache_entry());
+    fEntries.front().key        = key;
+    fEntries.front().relations  = *relations;
+    fEntries.front().hashed     = false;
+    fEntries.front().ownChanges = 0;
+    fIndex[key] = fEntries.begin();
+    watched->second++;
+
+    while ((int32)fEntries.size() > fCapacity) {
+        fEvictions++;
+        _Evict(--fEntries.end());
+    }
+}
+
+void RelationCache::Append(const node_ref* node, const char* attrName, const char* targetId,
+    const BMessage* properties)
+{
+    {
+        BAutolock _(fLock);
+
+        // pending reads did not see this relation yet
+        (*_Generation(node, attrName))++;
+
+        auto it = fIndex.find(cache_key(*node, attrName));
+        if (it != fIndex.end()) {
+            cache_entry* entry = &*it->second;
+
+            type_code type;
+            int32 count = 0;
+            entry->relations.GetInfo(targetId, &type, &count);
+
+            if (entry->relations.AddMessage(targetId, properties) == B_OK) {
+                if (entry->hashed)
+                    entry->hashes[targetId].emplace(HashProperties(properties), count);
+                entry->ownChanges++;
+                return;
+            }
+        }
+    }
+
+    Invalidate(node, attrName);
+}
+
+status_t RelationCache::FindProperties(const node_ref* node, const char* attrName, const char* targetId,
+    const BMessage* properties)
+{
+    uint64 hash = HashProperties(properties);
+
+    BAutolock _(fLock);
+
+    if (fCapacity == 0)
+        return B_NO_INIT;
+
+    auto it = fIndex.find(cache_key(*node, attrName));
+    if (it == fIndex.end())
+        return B_ENTRY_NOT_FOUND;
+
+    cache_entry* entry = &*it->second;
+    if (! entry->hashed)
+        _HashEntry(entry);
+
+    fHashLookups++;
+
+    auto target = entry->hashes.find(targetId);
+    if (target == entry->hashes.end())
+        return B_NAME_NOT_FOUND;
+
+    // equal hashes are only candidates, confirm like a linear scan would
+    auto candidates = target->second.equal_range(hash);
+    for (auto candidate = candidates.first; candidate != candidates.second; ++candidate) {
+        BMessage existing;
+        if (entry->relations.FindMessage(targetId, candidate->second, &existing) == B_OK
+            && existing.HasSameData(*properties)) {
+            return B_OK;
+        }
+        fHashCollisions++;
+    }
+
+    return B_NAME_NOT_FOUND;
+}
+
+uint64 RelationCache::HashProperties(const BMessage* properties)
+{
+    // FNV-1a over fields sorted by name, with type, count and the data of each item
+    const uint64 prime = 1099511628211ULL;
+    uint64 hash = 14695981039346656037ULL;
+
+    auto add = [&hash, prime](const void* data, size_t size) {
+        const uint8* bytes = (const uint8*)data;
+        for (size_t i = 0; i < size; i++) {
+            hash = (hash ^ bytes[i]) * prime;
+        }
+    };
+
+    std::vector<const char*> names;
+    char* name;
+    type_code type;
+    int32 count;
+
+    for (int32 i = 0; properties->GetInfo(B_ANY_TYPE, i, &name, &type, &count) == B_OK; i++) {
+        names.push_back(name);
+    }
+
+    std::sort(names.begin(), names.end(),
+        [](const char* a, const char* b) { return strcmp(a, b) < 0; });
+
+    for (const char* field : names) {
+        properties->GetInfo(field, &type, &count);
+
+        add(field, strlen(field) + 1);
+        add(&type, sizeof(type));
+        add(&count, sizeof(count));
+
+        for (int32 i = 0; i < count; i++) {
+            const void* data;
+            ssize_t size;
+            if (properties->FindData(field, type, i, &data, &size) != B_OK)
+                continue;
+
+            int64 itemSize = size;
+            add(&itemSize, sizeof(itemSize));
+            add(data, size);
+        }
+    }
+
+    return hash;
+}
+
+void RelationCache::Invalidate(const node_ref* node, const char* attrName)
+{
+    BAutolock _(fLock);
+
+    (*_Generation(node, attrName))++;
+
+    auto it = fIndex.find(cache_key(*node, attrName));
+    if (it != fIndex.end()) {
+        fInvalidations++;
+        _Evict(it->second);
+        return;
+    }
+
+    // a pending read may have seen the old value, see Put()
+    auto watched = fWatched.find(*node);
+    if (watched != fWatched.end() && watched->second == 0) {
+        _Unwatch(node);
+        fWatched.erase(watched);
+    }
+}
+
+void RelationCache::Invalidate(const node_ref* node)
+{
+    BAutolock _(fLock);
+    _InvalidateNodeLocked(node);
+}
+
+void RelationCache::Clear()
+{
+    BAutolock _(fLock);
+
+    for (auto& watched : fWatched) {
+        _Unwatch(&watched.first);
+    }
+
+    fWatched.clear();
+    fIndex.clear();
+    fEntries.clear();
+}
+
+void RelationCache::HandleNodeMonitor(const BMessage* message)
+{
+    int32 opcode;
+    int32 device;
+    ino_t nodeId;
+
+    if (message->FindInt32("opcode", &opcode) != B_OK
+        || message->FindInt32("device", &device) != B_OK
+        || message->FindInt64("node", &nodeId) != B_OK) {
+        return;
+    }
+
+    node_ref node(device, nodeId);
+
+    switch (opcode) {
+        case B_ATTR_CHANGED:
+        {
+            const char* attrName;
+            if (message->FindString("attr", &attrName) == B_OK) {
+                BString attr(attrName);
+                if (attr.StartsWith(SEN_RELATION_ATTR_PREFIX)) {
+                    _AttrChanged(&node, attrName);
+                }
+            } else {
+                Invalidate(&node);
+            }
+            break;
+        }
+        case B_ENTRY_REMOVED:
+        {
+            Invalidate(&node);
+            break;
+        }
+    }
+}
+
+void RelationCache::GetStats(BMessage* stats)
+{
+    BAutolock _(fLock);
+
+    int64 lookups = fHits + fMisses;
+
+    stats->AddInt32("capacity", fCapacity);
+    stats->AddInt32("entries", fEntries.size());
+    stats->AddInt32("watchedNodes", fWatched.size());
+    stats->AddInt64("hits", fHits);
+    stats->AddInt64("misses", fMisses);
+    stats->AddDouble("hitRate", lookups > 0 ? (double)fHits / lookups : 0.0);
+    stats->AddInt64("invalidations", fInvalidations);
+    stats->AddInt64("evictions", fEvictions);
+    stats->AddInt64("hashLookups", fHashLookups);
+    stats->AddInt64("hashCollisions", fHashCollisions);
+}
+
+/*
+ * private methods
+ */
+
+uint32* RelationCache::_Generation(const node_ref* node, const char* attrName)
+{
+    // FNV-1a over node and attribute name
+    const uint64 prime = 1099511628211ULL;
+    uint64 hash = 14695981039346656037ULL;
+
+    hash = (hash ^ (uint64)node->device) * prime;
+    hash = (hash ^ (uint64)node->node) * prime;
+    for (const char* c = attrName; *c != '\0'; c++) {
+        hash = (hash ^ (uint8)*c) * prime;
+    }
+
+    return &fGenerations[hash % SEN_RELATION_CACHE_GENERATIONS];
+}
+
+void RelationCache::_AttrChanged(const node_ref* node, const char* attrName)
+{
+    {
+        BAutolock _(fLock);
+
+        // our own appends are already in the entry
+        auto it = fIndex.find(cache_key(*node, attrName));
+        if (it != fIndex.end() && it->second->ownChanges > 0) {
+            it->second->ownChanges--;
+            return;
+        }
+    }
+
+    Invalidate(node, attrName);
+}
+
+void RelationCache::_HashEntry(cache_entry* entry)
+{
+    char* targetId;
+    type_code type;
+    int32 count;
+
+    for (int32 i = 0; entry->relations.GetInfo(B_MESSAGE_TYPE, i, &targetId, &type, &count) == B_OK; i++) {
+        auto& hashes = entry->hashes[targetId];
+
+        for (int32 index = 0; index < count; index++) {
+            BMessage properties;
+            if (entry->relations.FindMessage(targetId, index, &properties) == B_OK)
+                hashes.emplace(HashProperties(&properties), index);
+        }
+    }
+
+    entry->hashed = true;
+}
+
+void RelationCache::_Evict(std::list<cache_entry>::iterator entry)
+{
+    node_ref node = entry->key.first;
+
+    fIndex.erase(entry->key);
+    fEntries.erase(entry);
+
+    auto watched = fWatched.find(node);
+    if (watched != fWatched.end() && --watched->second <= 0) {
+        _Unwatch(&node);
+        fWatched.erase(watched);
+    }
+}
+
+void RelationCache::_InvalidateNodeLocked(const node_ref* node)
+{
+    // attribute names of pending reads are unknown here, rare enough to bump all generations
+    for (int32 i = 0; i < SEN_RELATION_CACHE_GENERATIONS; i++) {
+        fGenerations[i]++;
+    }
+
+    // keys are ordered by node first, so all entries of a node are adjacent
+    auto it = fIndex.lower_bound(cache_key(*node, std::string()));
+
+    while (it != fIndex.end() && it->first.first == *node) {
+        auto entry = it->second;
+        ++it;
+        fInvalidations++;
+        _Evict(entry);
+    }
+
+    auto watched = fWatched.find(*node);
+    if (watched != fWatched.end()) {
+        _Unwatch(node);
+        fWatched.erase(watched);
+    }
+}
+
+status_t RelationCache::_Watch(const node_ref* node)
+{
+    status_t result = watch_node(node, B_WATCH_ATTR, fTarget);
+    if (result != B_OK) {
+        ERROR("failed to watch node %" B_PRIdINO " for relation changes: %s\n", node->node, strerror(result));
+    }
+    return result;
+}
+
+void RelationCache::_Unwatch(const node_ref* node)
+{
+    watch_node(node, B_STOP_WATCHING, fTarget);
+}
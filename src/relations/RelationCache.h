@@ -0,0 +1,138 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#pragma once
+
+#include <Locker.h>
+#include <Message.h>
+#include <Messenger.h>
+#include <Node.h>
+
+#include <list>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#define SEN_RELATION_CACHE_DEFAULT_SIZE     256
+// every cached node costs a node monitor slot, stay well below the per team limit
+#define SEN_RELATION_CACHE_MAX_SIZE         2048
+// keys share generation counters by hash, a collision only costs a dropped Put()
+#define SEN_RELATION_CACHE_GENERATIONS      256
+
+/**
+ * LRU cache of parsed relation properties, keyed by node and relation attribute name
+ * (the canonical form of the relation type, see RelationHandler::GetAttributeNameForRelation).
+ *
+ * Nodes are watched for attribute changes from the first lookup on, so writes by other
+ * applications invalidate entries via HandleNodeMonitor(); the server's own writes need to
+ * call Invalidate() directly since the monitor message may arrive after the next read.
+ * A read racing with such a write must not cache what it read before, so Get() hands out a
+ * ticket with the key's generation, which Invalidate() and Append() bump, and Put() only
+ * caches if the generation is unchanged.
+ * Relations that do not exist are cached as empty messages.
+ *
+ * For duplicate detection, each cached entry also holds the content hash of every property
+ * message per target, built on first use by FindProperties() and kept up to date by Append().
+ */
+class RelationCache {
+
+public:
+                RelationCache();
+                ~RelationCache();
+
+    /**
+     * set the target for attribute change notifications and the maximum number of entries,
+     * capped at SEN_RELATION_CACHE_MAX_SIZE.
+     * Caching is disabled until this is called or if `capacity` is 0.
+     */
+    void        Init(const BMessenger& target, int32 capacity);
+
+    /**
+     * look up cached relation properties.
+     * On a miss, the node is watched and `ticket` set, so any change made before the caller's
+     * Put() is noticed. Take the ticket before reading the attribute.
+     *
+     * @return B_OK on a hit, B_ENTRY_NOT_FOUND on a miss or B_NO_INIT if caching is disabled.
+     */
+    status_t    Get(const node_ref* node, const char* attrName, BMessage* relations,
+                    uint32* ticket = NULL);
+    /**
+     * cache relations read after a miss, unless the key changed since `ticket` was taken.
+     */
+    void        Put(const node_ref* node, const char* attrName, const BMessage* relations,
+                    uint32 ticket);
+    /**
+     * add a relation the server itself just appended to a cached entry, instead of dropping it.
+     * The attribute change notification caused by that single write is then ignored.
+     * Uncached relations are invalidated like with Invalidate().
+     */
+    void        Append(const node_ref* node, const char* attrName, const char* targetId,
+                    const BMessage* properties);
+
+    /**
+     * look up a relation to `targetId` with the same properties as `properties` via its
+     * content hash, independent of the number of existing relations.
+     *
+     * @return B_OK if such a relation exists, B_NAME_NOT_FOUND if not,
+     *         B_ENTRY_NOT_FOUND on a miss or B_NO_INIT if caching is disabled.
+     */
+    status_t    FindProperties(const node_ref* node, const char* attrName, const char* targetId,
+                    const BMessage* properties);
+    /**
+     * stable content hash of a property message, independent of field order like
+     * BMessage::HasSameData(), so equal properties always have equal hashes.
+     */
+    static uint64 HashProperties(const BMessage* properties);
+
+    void        Invalidate(const node_ref* node, const char* attrName);
+    /**
+     * drop all entries of a node and stop watching it.
+     */
+    void        Invalidate(const node_ref* node);
+    void        Clear();
+
+    void        HandleNodeMonitor(const BMessage* message);
+    void        GetStats(BMessage* stats);
+
+private:
+    typedef std::pair<node_ref, std::string> cache_key;
+
+    // target ID -> content hash -> index of the property message for that target
+    typedef std::unordered_map<std::string, std::unordered_multimap<uint64, int32>> property_hashes;
+
+    struct cache_entry {
+        cache_key       key;
+        BMessage        relations;
+        property_hashes hashes;
+        bool            hashed;
+        int32           ownChanges;     // notifications still expected for our own appends
+    };
+
+    uint32*     _Generation(const node_ref* node, const char* attrName);
+    void        _AttrChanged(const node_ref* node, const char* attrName);
+    void        _HashEntry(cache_entry* entry);
+    void        _Evict(std::list<cache_entry>::iterator entry);
+    void        _InvalidateNodeLocked(const node_ref* node);
+    status_t    _Watch(const node_ref* node);
+    void        _Unwatch(const node_ref* node);
+
+    BLocker                                                     fLock;
+    BMessenger                                                  fTarget;
+    int32                                                       fCapacity;
+
+    std::list<cache_entry>                                      fEntries;   // most recently used first
+    std::map<cache_key, std::list<cache_entry>::iterator>       fIndex;
+    std::map<node_ref, int32>                                   fWatched;   // node -> cached entries
+    uint32                                                      fGenerations[SEN_RELATION_CACHE_GENERATIONS];
+
+    int64                                                       fHits;
+    int64                                                       fMisses;
+    int64                                                       fInvalidations;
+    int64                                                       fEvictions;
+    int64                                                       fHashLookups;
+    int64                                                       fHashCollisions;
+};
@@ -0,0 +1,148 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#include <Autolock.h>
+
+#include <string.h>
+
+#include "RelationCompactor.h"
+#include "RelationRecord.h"
+#include <sen/Sen.h>
+
+RelationCompactor::RelationCompactor(NodeLockManager* nodeLocks)
+    : fNodeLocks(nodeLocks),
+      fThread(-1),
+      fPending(-1),
+      fLock("RelationCompactor"),
+      fQuit(false),
+      fCompacted(0),
+      fFailed(0)
+{
+}
+
+RelationCompactor::~RelationCompactor()
+{
+    Stop();
+}
+
+status_t RelationCompactor::Start()
+{
+    fPending = create_sem(0, "sen compactor requests");
+    if (fPending < 0)
+        return fPending;
+
+    fThread = spawn_thread(_CompactorThread, "sen relation compactor", B_LOW_PRIORITY, this);
+    if (fThread < 0) {
+        ERROR("failed to spawn compactor thread: %s\n", strerror(fThread));
+        return fThread;
+    }
+
+    return resume_thread(fThread);
+}
+
+void RelationCompactor::Stop()
+{
+    if (fThread < 0)
+        return;
+
+    {
+        BAutolock _(fLock);
+        fQuit = true;
+    }
+    release_sem(fPending);
+
+    status_t exitValue;
+    wait_for_thread(fThread, &exitValue);
+    fThread = -1;
+
+    delete_sem(fPending);
+    fPending = -1;
+}
+
+void RelationCompactor::Schedule(const node_ref* node, const char* attrName)
+{
+    {
+        BAutolock _(fLock);
+
+        if (fThread < 0 || fQuit || ! fQueued.insert(_KeyFor(node, attrName)).second)
+            return;
+
+        fQueue.push_back(compaction_request{ *node, attrName });
+    }
+    release_sem(fPending);
+}
+
+void RelationCompactor::GetStats(BMessage* stats)
+{
+    BAutolock _(fLock);
+
+    stats->AddInt32("queued", fQueue.size());
+    stats->AddInt64("compacted", fCompacted);
+    stats->AddInt64("failed", fFailed);
+}
+
+/*
+ * private methods
+ */
+
+status_t RelationCompactor::_CompactorThread(void* data)
+{
+    static_cast<RelationCompactor*>(data)->_Run();
+    return B_OK;
+}
+
+void RelationCompactor::_Run()
+{
+    while (true) {
+        status_t result;
+        do {
+            result = acquire_sem(fPending);
+        } while (result == B_INTERRUPTED);
+
+        if (result != B_OK)
+            return;
+
+        compaction_request request;
+        {
+            BAutolock _(fLock);
+
+            if (fQuit)
+                return;
+
+            request = fQueue.front();
+            fQueue.pop_front();
+            // appends from now on may schedule the attribute again
+            fQueued.erase(_KeyFor(&request.node, request.attrName.String()));
+        }
+
+        {
+            NodeLocker nodeLocker(fNodeLocks, &request.node);
+
+            BNode node(&request.node);
+            result = node.InitCheck();
+            if (result == B_OK)
+                result = RelationRecord::Compact(&node, request.attrName.String());
+        }
+
+        BAutolock _(fLock);
+
+        if (result == B_OK) {
+            fCompacted++;
+        } else if (result != B_ENTRY_NOT_FOUND) {
+            // the node or relation may be gone by now, anything else is worth a note
+            ERROR("failed to compact relation %s: %s\n", request.attrName.String(), strerror(result));
+            fFailed++;
+        }
+    }
+}
+
+std::string RelationCompactor::_KeyFor(const node_ref* node, const char* attrName)
+{
+    BString key;
+    key << node->device << ":" << node->node << ":" << attrName;
+
+    return key.String();
+}
@@ -0,0 +1,64 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#pragma once
+
+#include <Locker.h>
+#include <Message.h>
+#include <Node.h>
+#include <OS.h>
+#include <String.h>
+
+#include <deque>
+#include <set>
+#include <string>
+
+#include "NodeLockManager.h"
+
+struct compaction_request {
+    node_ref    node;
+    BString     attrName;
+};
+
+/**
+ * merges the tail of appended relations back into the sorted part of relation records,
+ * in a low priority thread so adding relations never waits for it.
+ *
+ * Attributes are scheduled by RelationHandler::WriteRelation() once their tail passes
+ * RelationRecord::NeedsCompaction(), each attribute is queued at most once.
+ * Compaction holds the node lock, so it never races with a write to the same node.
+ */
+class RelationCompactor {
+
+public:
+                RelationCompactor(NodeLockManager* nodeLocks);
+                ~RelationCompactor();
+
+    status_t    Start();
+    /**
+     * stop the thread, attributes still queued are compacted on their next scheduling.
+     */
+    void        Stop();
+
+    void        Schedule(const node_ref* node, const char* attrName);
+    void        GetStats(BMessage* stats);
+
+private:
+    static status_t _CompactorThread(void* data);
+    void            _Run();
+    std::string     _KeyFor(const node_ref* node, const char* attrName);
+
+    NodeLockManager*                fNodeLocks;
+    thread_id                       fThread;
+    sem_id                          fPending;   // one count per queued request
+    BLocker                         fLock;
+    std::deque<compaction_request>  fQueue;
+    std::set<std::string>           fQueued;
+    bool                            fQuit;
+
+    int64                           fCompacted;
+    int64                           fFailed;
+};
@@ -0,0 +1,415 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#include <Autolock.h>
+#include <Directory.h>
+#include <Entry.h>
+#include <fs_attr.h>
+#include <FindDirectory.h>
+#include <MimeType.h>
+#include <NodeMonitor.h>
+
+#include "RelationConfigRegistry.h"
+#include <sen/Sen.h>
+
+RelationConfigRegistry::RelationConfigRegistry()
+    : fLock("RelationConfigRegistry"),
+      fNextTypeId(0),
+      fTable(new RelationTypeTable())
+{
+}
+
+RelationConfigRegistry::~RelationConfigRegistry()
+{
+    BAutolock _(fLock);
+
+    if (fTarget.IsValid()) {
+        for (auto& type : fNodeToType) {
+            watch_node(&type.first, B_STOP_WATCHING, fTarget);
+        }
+        watch_node(&fRelationDir, B_STOP_WATCHING, fTarget);
+    }
+}
+
+status_t RelationConfigRegistry::Init(const BMessenger& target)
+{
+    BPath mimeDbPath;
+    status_t result = find_directory(B_USER_SETTINGS_DIRECTORY, &mimeDbPath);
+    if (result != B_OK) {
+        ERROR("could not find user settings directory: %s\n", strerror(result));
+        return result;
+    }
+    mimeDbPath.Append("mime_db");
+
+    {
+        BAutolock _(fLock);
+        fTarget     = target;
+        fMimeDbPath = mimeDbPath;
+    }
+
+    bigtime_t start = system_time();
+    result = _LoadAll();
+
+    LOG("loaded %d relation config(s) in %" B_PRId64 "us.\n", CountTypes(), system_time() - start);
+    return result;
+}
+
+status_t RelationConfigRegistry::Get(const char* relationType, BMessage* config)
+{
+    std::shared_ptr<const RelationTypeTable> table;
+    const relation_type_info* info = Find(relationType, &table);
+
+    if (info == NULL)
+        return B_ENTRY_NOT_FOUND;
+
+    *config = info->config;
+    return B_OK;
+}
+
+std::shared_ptr<const RelationTypeTable> RelationConfigRegistry::Types()
+{
+    BAutolock _(fLock);
+    return fTable;
+}
+
+const relation_type_info* RelationConfigRegistry::Find(const char* relationType,
+    std::shared_ptr<const RelationTypeTable>* table)
+{
+    *table = Types();
+    const relation_type_info* info = (*table)->Find(relationType);
+
+    if (info == NULL) {
+        // not known yet, load and remember for next time
+        _Update(relationType);
+
+        *table = Types();
+        info = (*table)->Find(relationType);
+    }
+
+    return info;
+}
+
+int32 RelationConfigRegistry::CountTypes()
+{
+    return Types()->CountTypes();
+}
+
+void RelationConfigRegistry::HandleNodeMonitor(const BMessage* message)
+{
+    int32 opcode;
+    int32 device;
+    ino_t node;
+
+    if (message->FindInt32("opcode", &opcode) != B_OK
+        || message->FindInt32("device", &device) != B_OK
+        || message->FindInt64("node", &node) != B_OK) {
+        return;
+    }
+
+    node_ref nodeRef(device, node);
+    const char* name = NULL;
+    message->FindString("name", &name);
+
+    switch (opcode) {
+        case B_ATTR_CHANGED:
+        {
+            if (nodeRef == fRelationDir) {
+                // supertype config changed, all merged configs need to be rebuilt
+                _LoadSupertype();
+                BAutolock _(fLock);
+                _RebuildLocked();
+                return;
+            }
+
+            std::string relationType;
+            {
+                BAutolock _(fLock);
+                auto it = fNodeToType.find(nodeRef);
+                if (it == fNodeToType.end())
+                    return;     // not a relation type, e.g. a cached relation source
+                relationType = it->second;
+            }
+            _Update(relationType.c_str());
+            break;
+        }
+        case B_ENTRY_CREATED:
+        {
+            ino_t directory;
+            if (name != NULL && message->FindInt64("directory", &directory) == B_OK
+                && node_ref(device, directory) == fRelationDir) {
+                _Update(BString(SEN_RELATION_SUPERTYPE "/").Append(name).String());
+            }
+            break;
+        }
+        case B_ENTRY_MOVED:
+        {
+            ino_t fromDirectory, toDirectory;
+            if (message->FindInt64("from directory", &fromDirectory) != B_OK
+                || message->FindInt64("to directory", &toDirectory) != B_OK) {
+                break;
+            }
+            if (node_ref(device, fromDirectory) == fRelationDir) {
+                _Remove(&nodeRef);
+            }
+            if (name != NULL && node_ref(device, toDirectory) == fRelationDir) {
+                _Update(BString(SEN_RELATION_SUPERTYPE "/").Append(name).String());
+            }
+            break;
+        }
+        case B_ENTRY_REMOVED:
+        {
+            _Remove(&nodeRef);
+            break;
+        }
+    }
+}
+
+/*
+ * private methods
+ */
+
+status_t RelationConfigRegistry::_LoadAll()
+{
+    BPath relationPath(fMimeDbPath);
+    relationPath.Append(SEN_RELATION_SUPERTYPE);
+
+    BDirectory relationDir(relationPath.Path());
+    status_t result = relationDir.InitCheck();
+    if (result != B_OK) {
+        ERROR("could not access relation types in MIME database at %s: %s\n", relationPath.Path(), strerror(result));
+        return result;
+    }
+
+    {
+        BAutolock _(fLock);
+        relationDir.GetNodeRef(&fRelationDir);
+
+        // the supertype config is stored on the relation directory itself
+        if (fTarget.IsValid())
+            watch_node(&fRelationDir, B_WATCH_ATTR, fTarget);
+    }
+
+    _LoadSupertype();
+
+    BEntry entry;
+    while (relationDir.GetNextEntry(&entry) == B_OK) {
+        char name[B_FILE_NAME_LENGTH];
+        if (entry.GetName(name) == B_OK) {
+            _Update(BString(SEN_RELATION_SUPERTYPE "/").Append(name).String(), false);
+        }
+    }
+
+    BAutolock _(fLock);
+    _RebuildLocked();
+
+    return B_OK;
+}
+
+status_t RelationConfigRegistry::_Load(const char* relationType, BMessage* config, node_ref* nodeRef)
+{
+    BMimeType mimeType(relationType);
+    if (! mimeType.IsValid()) {
+        ERROR("invalid relation type %s\n", relationType);
+        return B_BAD_VALUE;
+    }
+
+    // we need to get this from the MIME DB directly as it is not part of
+    // the MimeType but stored as a custom attribute in the file system.
+    BPath path(fMimeDbPath);
+    path.Append(relationType);
+
+    BNode mimeNode(path.Path());
+    status_t result = mimeNode.InitCheck();
+    if (result != B_OK) {
+        ERROR("error accessing MIME type file at '%s': %s\n", path.Path(), strerror(result));
+        return result;
+    }
+
+    if (nodeRef != NULL)
+        mimeNode.GetNodeRef(nodeRef);
+
+    // defaults and the supertype config are merged in when building the type table
+    attr_info attrInfo;
+    result = mimeNode.GetAttrInfo(SEN_RELATION_CONFIG_ATTR, &attrInfo);
+
+    if (result != B_OK) {
+        // this attribute is optional for relation subtypes
+        if (result != B_ENTRY_NOT_FOUND) {
+            ERROR("could not get attrInfo for sen relation config for type %s: %s", relationType, strerror(result));
+            return result;
+        }
+        LOG("no relation config found for type %s, using defaults.\n", relationType);
+    } else {
+        // read config msg from fs attr
+        char buffer[attrInfo.size];
+
+        ssize_t sizeResult = mimeNode.ReadAttr(
+            SEN_RELATION_CONFIG_ATTR, B_MESSAGE_TYPE, 0, buffer, attrInfo.size);
+
+        if (sizeResult < attrInfo.size) {
+            result = sizeResult < 0 ? sizeResult : B_ERROR;
+            ERROR("error reading SEN:CONFIG attribute from MIME type file '%s': %s\n", path.Path(), strerror(result));
+            return result;
+        }
+
+        // materialize the flattened message
+        result = config->Unflatten(buffer);
+        if (result != B_OK) {
+            ERROR("could not get relation config for type %s: %s\n", relationType, strerror(result));
+            return result;
+        }
+    }
+
+    // get base attributes last (not to be overwritten by Unflatten above:)
+    char shortName[B_MIME_TYPE_LENGTH];
+    result = mimeType.GetShortDescription(shortName);
+
+    if (result != B_OK) {
+        ERROR("could not get short name for MIME type %s: %s\n", relationType, strerror(result));
+        return result;
+    }
+
+    config->AddString(SEN_RELATION_NAME, shortName);
+
+    return B_OK;
+}
+
+status_t RelationConfigRegistry::_LoadSupertype()
+{
+    BPath path(fMimeDbPath);
+    path.Append(SEN_RELATION_SUPERTYPE);
+
+    BNode superNode(path.Path());
+    BMessage config;
+
+    status_t result = superNode.InitCheck();
+    if (result == B_OK) {
+        attr_info attrInfo;
+        result = superNode.GetAttrInfo(SEN_RELATION_CONFIG_ATTR, &attrInfo);
+
+        if (result == B_OK) {
+            char buffer[attrInfo.size];
+            ssize_t sizeResult = superNode.ReadAttr(
+                SEN_RELATION_CONFIG_ATTR, B_MESSAGE_TYPE, 0, buffer, attrInfo.size);
+
+            if (sizeResult < attrInfo.size)
+                result = sizeResult < 0 ? sizeResult : B_ERROR;
+            else
+                result = config.Unflatten(buffer);
+        }
+    }
+
+    // optional, subtypes then only inherit the built-in defaults
+    if (result != B_OK && result != B_ENTRY_NOT_FOUND) {
+        ERROR("could not read relation supertype config: %s\n", strerror(result));
+    }
+
+    BAutolock _(fLock);
+    fSupertypeConfig = config;
+
+    return result;
+}
+
+void RelationConfigRegistry::_Update(const char* relationType, bool rebuild)
+{
+    std::string key;
+    _GetTypeName(relationType, &key);
+
+    BMessage config;
+    node_ref nodeRef;
+
+    // load outside of the lock, lookups of other types can go on meanwhile
+    status_t result = _Load(key.c_str(), &config, &nodeRef);
+
+    BAutolock _(fLock);
+
+    if (result != B_OK) {
+        // keep serving the last good config rather than failing all requests for this type
+        return;
+    }
+
+    // replaced by a new file, e.g. when the MIME DB entry is rewritten
+    for (auto it = fNodeToType.begin(); it != fNodeToType.end(); ++it) {
+        if (it->second == key && it->first != nodeRef) {
+            if (fTarget.IsValid())
+                watch_node(&it->first, B_STOP_WATCHING, fTarget);
+            fNodeToType.erase(it);
+            break;
+        }
+    }
+
+    if (fNodeToType.find(nodeRef) == fNodeToType.end() && fTarget.IsValid()) {
+        status_t watchResult = watch_node(&nodeRef, B_WATCH_ATTR, fTarget);
+        if (watchResult != B_OK) {
+            ERROR("failed to watch relation type %s for changes: %s\n", key.c_str(), strerror(watchResult));
+        }
+    }
+
+    bool reload = fConfigs.find(key) != fConfigs.end();
+
+    fNodeToType[nodeRef] = key;
+    fConfigs[key] = config;
+
+    if (fTypeIds.find(key) == fTypeIds.end())
+        fTypeIds[key] = fNextTypeId++;
+
+    if (reload) {
+        LOG("reloaded relation config for %s.\n", key.c_str());
+    }
+
+    if (rebuild)
+        _RebuildLocked();
+}
+
+void RelationConfigRegistry::_Remove(const node_ref* nodeRef)
+{
+    BAutolock _(fLock);
+
+    auto it = fNodeToType.find(*nodeRef);
+    if (it == fNodeToType.end())
+        return;
+
+    LOG("relation type %s was removed.\n", it->second.c_str());
+
+    if (fTarget.IsValid())
+        watch_node(nodeRef, B_STOP_WATCHING, fTarget);
+
+    fConfigs.erase(it->second);
+    fNodeToType.erase(it);
+
+    _RebuildLocked();
+}
+
+void RelationConfigRegistry::_RebuildLocked()
+{
+    BMessage defaults;
+    defaults.AddBool(SEN_RELATION_IS_BIDIR, true);
+    defaults.AddBool(SEN_RELATION_IS_DYNAMIC, false);
+    defaults.AddBool(SEN_RELATION_IS_SELF, false);
+
+    RelationTypeTable::MergeConfig(&defaults, &fSupertypeConfig);
+
+    RelationTypeTable* table = new RelationTypeTable();
+
+    for (auto& type : fConfigs) {
+        BMessage merged(defaults);
+        RelationTypeTable::MergeConfig(&merged, &type.second);
+
+        table->Add(fTypeIds[type.first], type.first.c_str(), &merged);
+    }
+
+    // readers still holding the old table keep it alive until done
+    fTable.reset(table);
+}
+
+void RelationConfigRegistry::_GetTypeName(const char* relationType, std::string* key)
+{
+    // MIME types are case insensitive and stored in lower case in the MIME DB
+    BString typeName(relationType);
+    typeName.ToLower();
+
+    key->assign(typeName.String());
+}
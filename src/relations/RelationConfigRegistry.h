@@ -0,0 +1,94 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#pragma once
+
+#include <Locker.h>
+#include <Message.h>
+#include <Messenger.h>
+#include <Node.h>
+#include <Path.h>
+#include <String.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "RelationTypeTable.h"
+
+/**
+ * in-memory registry of relation configs from the user MIME database, so looking up
+ * the config of a relation type is a hash probe instead of a path lookup, node open
+ * and Unflatten() of SEN:CONFIG per call.
+ *
+ * All relation types are loaded once at startup. Each type file is watched for attribute
+ * changes, new, renamed and removed types are picked up from the volume node monitor
+ * messages forwarded by the server, and only the affected entry is reloaded.
+ *
+ * Configs are served from a RelationTypeTable with supertype defaults already merged in,
+ * which is rebuilt and swapped on every change.
+ */
+class RelationConfigRegistry {
+
+public:
+                RelationConfigRegistry();
+                ~RelationConfigRegistry();
+
+    /**
+     * load all relation types from `mime_db/relation` and start watching them.
+     *
+     * @param target    messenger receiving attribute change notifications, usually the server
+     * @return B_OK or the error from accessing the MIME database directory.
+     */
+    status_t    Init(const BMessenger& target);
+
+    /**
+     * set `config` to the merged config of the given relation type.
+     * Types not (yet) known are loaded on demand, e.g. before Init() or for types
+     * installed before their node monitor message arrives.
+     *
+     * @return B_OK or the error from loading the type.
+     */
+    status_t    Get(const char* relationType, BMessage* config);
+    /**
+     * find the resolved relation type, loading it on demand.
+     *
+     * @param table receives the table the result belongs to, keep it while using the result
+     * @return the relation type or NULL if not found.
+     */
+    const relation_type_info* Find(const char* relationType,
+                                   std::shared_ptr<const RelationTypeTable>* table);
+    /**
+     * get the current type table, which stays valid as long as the reference is held.
+     */
+    std::shared_ptr<const RelationTypeTable> Types();
+    int32       CountTypes();
+
+    void        HandleNodeMonitor(const BMessage* message);
+
+private:
+    status_t    _LoadAll();
+    status_t    _Load(const char* relationType, BMessage* config, node_ref* nodeRef = NULL);
+    status_t    _LoadSupertype();
+    void        _Update(const char* relationType, bool rebuild = true);
+    void        _Remove(const node_ref* nodeRef);
+    void        _RebuildLocked();
+    void        _GetTypeName(const char* relationType, std::string* key);
+
+    BLocker                                     fLock;
+    BMessenger                                  fTarget;
+    BPath                                       fMimeDbPath;
+    node_ref                                    fRelationDir;
+
+    BMessage                                    fSupertypeConfig;
+    std::unordered_map<std::string, BMessage>   fConfigs;       // as stored in the MIME DB
+    std::unordered_map<std::string, int32>      fTypeIds;
+    int32                                       fNextTypeId;
+    std::map<node_ref, std::string>             fNodeToType;
+
+    std::shared_ptr<const RelationTypeTable>    fTable;
+};
@@ -10,33 +10,151 @@
 #include <Node.h>
 #include <NodeInfo.h>
 #include <Path.h>
+#include <map>
+#include <set>
 #include <stdio.h>
 #include <string>
+#include <unordered_map>
+#include <vector>
 #include <String.h>
 #include <StringList.h>
 #include <VolumeRoster.h>
 #include <Volume.h>
 
 #include "RelationHandler.h"
+#include "SenId.h"
+#include "../server/MessageCapture.h"
+#include "../server/Metrics.h"
+#include "../server/RequestTrace.h"
+#include "../server/Tracer.h"
+#include "../config/SenConfigHandler.h"
 #include <sen/Sen.h>
 
 RelationHandler::RelationHandler()
     : BHandler("SenRelationHandler")
 {
     tsidGenerator = new IceDustGenerator();
+    idIndex       = new SenIdIndex();
+    targetIndex   = new RelationTargetIndex();
+    relationCache = new RelationCache();
+    configRegistry = new RelationConfigRegistry();
+    compatibilityCache = new CompatibilityCache(configRegistry);
+    nodeLocks     = new NodeLockManager();
+    requestCoalescer = new RequestCoalescer();
+    relationCompactor = new RelationCompactor(nodeLocks);
 }
 
 RelationHandler::~RelationHandler()
 {
+    // compaction needs the node locks
+    delete relationCompactor;
+    delete requestCoalescer;
+    delete nodeLocks;
+    delete compatibilityCache;
+    delete configRegistry;
+    delete relationCache;
+    delete targetIndex;
+    delete idIndex;
+}
+
+status_t RelationHandler::Init(const BMessenger& target, const BMessage* settings)
+{
+    BString idFormat = settings->GetString(SEN_CONFIG_ID_FORMAT, SEN_CONFIG_ID_FORMAT_STRING);
+
+    if (idFormat == SEN_CONFIG_ID_FORMAT_BINARY) {
+        LOG("using binary SEN:ID format.\n");
+        SenId::SetFormat(SEN_ID_FORMAT_BINARY);
+        // creates the SEN:TSID index synchronously before the ID indices below query it,
+        // not critical, falls back to string IDs on failure
+        SenId::StartMigration();
+    }
+
+    BString relationFormat = settings->GetString(SEN_CONFIG_RELATION_FORMAT, SEN_CONFIG_RELATION_FORMAT_MESSAGE);
+
+    if (relationFormat == SEN_CONFIG_RELATION_FORMAT_RECORD) {
+        // relations in the message format are converted when they are next written
+        LOG("writing relations in compact record format.\n");
+        RelationRecord::SetFormat(SEN_RELATION_FORMAT_RECORD);
+
+        // not critical, tails are then merged on the next full write
+        if (relationCompactor->Start() != B_OK)
+            ERROR("failed to start relation compactor, relations are only compacted on rewrite.\n");
+    }
+
+    if (settings->GetBool(SEN_CONFIG_ID_MONOTONIC, MONOTONIC) != MONOTONIC)
+        SetMonotonicIds(! MONOTONIC);
+
+    relationCache->Init(target, settings->GetInt32(SEN_CONFIG_RELATION_CACHE_SIZE,
+        SEN_RELATION_CACHE_DEFAULT_SIZE));
+
+    // not critical, configs are then loaded on demand
+    configRegistry->Init(target);
+    compatibilityCache->Init();
+
+    status_t status = idIndex->Init(target);
+    if (status == B_OK)
+        status = targetIndex->Init(target);
+
+    return status;
+}
+
+void RelationHandler::UpdateIndices(const BMessage* message)
+{
+    if (message->what == B_QUERY_UPDATE) {
+        idIndex->HandleQueryUpdate(message);
+        targetIndex->HandleQueryUpdate(message);
+    } else {
+        idIndex->HandleNodeMonitor(message);
+        targetIndex->HandleNodeMonitor(message);
+        relationCache->HandleNodeMonitor(message);
+        configRegistry->HandleNodeMonitor(message);
+        compatibilityCache->HandleNodeMonitor(message);
+    }
+}
+
+void RelationHandler::GetCacheStats(BMessage* stats)
+{
+    BMessage relationStats;
+    relationCache->GetStats(&relationStats);
+    stats->AddMessage("relations", &relationStats);
+
+    BMessage compatibilityStats;
+    compatibilityCache->GetStats(&compatibilityStats);
+    stats->AddMessage("compatibility", &compatibilityStats);
+
+    stats->AddBool("idIndexReady", idIndex->IsReady());
+    stats->AddBool("targetIndexReady", targetIndex->IsReady());
+    stats->AddInt64("nodeLockContention", nodeLocks->CountContended());
+    stats->AddInt64("coalescedRequests", requestCoalescer->CountCoalesced());
+
+    BMessage compactorStats;
+    relationCompactor->GetStats(&compactorStats);
+    stats->AddMessage("compactor", &compactorStats);
 }
 
 void RelationHandler::MessageReceived(BMessage* message)
 {
     BMessage* reply = new BMessage(SEN_RESULT_RELATIONS);
     status_t result = B_OK;
+    bigtime_t start = system_time();
 
-    LOG("RelationHandler got message:\n");
-    message->PrintToStream();
+    TRACE_MSG(SEN_TRACE_LEVEL_INFO, "relation request", message);
+
+    // identical reads in flight share one reply
+    BString coalescingKey;
+    bool coalescing = RequestCoalescer::MakeKey(message, &coalescingKey);
+
+    if (coalescing && requestCoalescer->Join(coalescingKey, reply)) {
+        LOG("RelationHandler sending reply of identical request in progress.\n");
+        Metrics::RecordRequest(message->what, system_time() - start, reply->GetInt32("status", B_OK));
+        MessageCapture::Record(message, reply);
+        message->SendReply(reply);
+        delete reply;
+        return;
+    }
+
+    // opt-in stage timings for this request
+    RequestTrace* trace = message->GetBool(SEN_MSG_TRACE) ? new RequestTrace() : NULL;
 
     // optionally get relation configs
     bool withConfigs = message->GetBool(SEN_MSG_CONFIGS);
@@ -100,6 +218,11 @@ void RelationHandler::MessageReceived(BMessage* message)
             result = AddRelation(message, reply);
             break;
         }
+        case SEN_RELATIONS_ADD_BATCH:
+        {
+            result = AddRelations(message, reply);
+            break;
+        }
         case SEN_RELATION_REMOVE:
         {
             result = RemoveRelation(message, reply);
@@ -118,14 +241,31 @@ void RelationHandler::MessageReceived(BMessage* message)
     }
 
     if (result == B_OK) {
-        LOG("RelationHandler sending successful reply with message:\n");
+        LOG("RelationHandler sending successful reply.\n");
     } else {
         ERROR("RelationHandler encountered an error while processing the request: %s\n", strerror(result));
     }
 
+    bigtime_t replyStart = system_time();
     reply->AddInt32 ("status", result);
     reply->AddString("result", strerror(result));
-    reply->PrintToStream();
+    TRACE_MSG(SEN_TRACE_LEVEL_INFO, "relation reply", reply);
+
+    if (trace != NULL) {
+        RequestTrace::AddStage(SEN_STAGE_REPLY, replyStart);
+
+        BMessage timings;
+        trace->GetTimings(&timings);
+        reply->AddMessage(SEN_MSG_TRACE, &timings);
+        delete trace;
+    }
+
+    if (coalescing)
+        requestCoalescer->Finish(coalescingKey, reply);
+
+    Metrics::RecordRequest(message->what, system_time() - start, result);
+
+    MessageCapture::Record(message, reply);
 
     message->SendReply(reply);
 }
@@ -150,10 +290,18 @@ status_t RelationHandler::AddRelation(const BMessage* message, BMessage* reply)
         return status;
     }
 
-    // get relation config
-    BMessage relationConf;
-    status = GetRelationConfig(relationType, &relationConf);
-    if (status != B_OK) {
+    // the relation is read, modified and written back on the source and possibly the target
+    // (inverse relation), hold both nodes until done so no concurrent update gets lost.
+    NodeLocker nodeLocker(nodeLocks, &srcRef, &targetRef);
+
+    // get resolved relation config
+    bigtime_t configStart = system_time();
+    std::shared_ptr<const RelationTypeTable> relationTypes;
+    const relation_type_info* relationInfo = configRegistry->Find(relationType, &relationTypes);
+    RequestTrace::AddStage(SEN_STAGE_CONFIG, configStart);
+
+    if (relationInfo == NULL) {
+        status = B_ENTRY_NOT_FOUND;
         LOG("failed to get relation config for type %s: %s\n", relationType, strerror(status));
 
         BString error("failed to get relation config for type '");
@@ -164,16 +312,13 @@ status_t RelationHandler::AddRelation(const BMessage* message, BMessage* reply)
         return status;  // bail out
     }
 
-    LOG("got relation config:\n");
-    relationConf.PrintToStream();
-
     // special case for relations to classification entities (used for associations): here we don't link back
     // as to not overload the SEN:TO targetId attribute. The targets are then resolved via back-Query.
     // exception: relations between 2 association entities, e.g. Concept hierarchies: here we allow bidirectional linking.
     bool linkToTarget = true;
 
     // relations are bidirectional by default (makes sense in 95% of cases)
-    if (! relationConf.GetBool(SEN_RELATION_IS_BIDIR, true)) {
+    if ((relationInfo->flags & SEN_RELATION_FLAG_BIDIR) == 0) {
         LOG("relation is unidirectional, checking for meta types...\n");
         BString srcType;
         status = GetTypeForRef(&srcRef, &srcType);
@@ -209,12 +354,18 @@ status_t RelationHandler::AddRelation(const BMessage* message, BMessage* reply)
     if (linkToTarget) {
         LOG("* adding relation %s with link to target...\n", relationType);
 
-        // get existing relations of the given type from the source file
-        status = ReadRelationsOfType(&srcRef, relationType, &existingRelations);
+        BString attrName;
+        GetAttributeNameForRelation(relationType, &attrName);
+
+        // get existing relations of the given type from the source file, records stay compact
+        BNode srcNode(&srcRef);
+        RelationSnapshot existing;
+
+        status = ReadRelationSnapshot(&srcNode, &srcRef, attrName.String(), &existing);
         if (status != B_OK) {
             ERROR("failed to read relations of type %s from file %s\n", relationType, srcRef.name);
             return B_ERROR;
-        } else if (existingRelations.IsEmpty()) {
+        } else if (existing.IsEmpty()) {
             LOG("creating new relation %s for file %s\n", relationType, srcRef.name);
         } else {
             LOG("adding new properties to existing relation %s and file %s.\n", relationType, srcRef.name);
@@ -234,45 +385,63 @@ status_t RelationHandler::AddRelation(const BMessage* message, BMessage* reply)
 
         // We need to check if a src->target relation with the same properties already exists and only
         // add a new mapping when no existing targetId->property message has been found.
-        BMessage existingProperties;
-        int index = 0;
-
-        while ((status = existingRelations.FindMessage(targetId, index, &existingProperties)) == B_OK) {
-            // bail out if new properties for particular relation and target are the same as existing ones
-            if (existingProperties.HasSameData(newProperties)) {
-                LOG("skipping add relation %s for target %s with same properties:\n", relationType, targetId);
-                existingProperties.PrintToStream();
+        // The relation cache answers this by content hash, else we compare the properties of that
+        // target only, unflattening nothing else of a record.
+        node_ref srcNodeRef;
+        status_t duplicateStatus = B_ENTRY_NOT_FOUND;
+
+        if (srcNode.GetNodeRef(&srcNodeRef) == B_OK) {
+            duplicateStatus = relationCache->FindProperties(&srcNodeRef, attrName.String(),
+                targetId, &newProperties);
+        }
 
-                reply->what = SEN_RESULT_RELATIONS;
-                reply->AddString("status", BString("relation with same properties already exists"));
+        if (duplicateStatus != B_OK && duplicateStatus != B_NAME_NOT_FOUND) {
+            duplicateStatus = existing.FindProperties(targetId, &newProperties);
 
-                return B_OK;    // done
+            if (duplicateStatus != B_OK && duplicateStatus != B_NAME_NOT_FOUND) {
+                ERROR("error reading properties of existing relation %s from file %s: %s",
+                    relationType, srcRef.name, strerror(duplicateStatus));
+                return duplicateStatus;
             }
-            index++;
         }
 
-        if (status != B_OK) {
-            if (status != B_NAME_NOT_FOUND) {
-                ERROR("error reading properties of existing relation %s from file %s: %s",
-                    relationType, srcRef.name, strerror(status));
-                return status;
-            } else {
-                index = -1; // no existing properties for target found, OK
-            }
+        // bail out if new properties for particular relation and target are the same as existing ones
+        if (duplicateStatus == B_OK) {
+            LOG("skipping add relation %s for target %s with same properties.\n", relationType, targetId);
+            TRACE_MSG(SEN_TRACE_LEVEL_DEBUG, "unchanged properties", &newProperties);
+
+            reply->what = SEN_RESULT_RELATIONS;
+            reply->AddString("status", BString("relation with same properties already exists"));
+
+            return B_OK;    // done
         }
 
-        if (index >= 0) {
+        int32 index = existing.CountProperties(targetId);
+
+        if (index > 0) {
             LOG("  > adding new properties to existing relation %s and target %s at index %d\n",
                 relationType, targetId, index);
         } else {
             LOG("  > creating new properties for target %s [%s] for relation %s\n", targetRef.name, targetId, relationType);
         }
 
-        // add new relation properties for target to any existing relations
-        existingRelations.AddMessage(targetId, &newProperties);
-        existingRelations.PrintToStream();
+        // a record read from disk only gets the new relation appended, anything else is rewritten
+        // with the new relation properties for target added to any existing relations
+        const BMessage* allRelations = NULL;
+
+        if (RelationRecord::Format() != SEN_RELATION_FORMAT_RECORD || ! existing.IsRecord()) {
+            if ((status = existing.ToMessage(&existingRelations)) != B_OK) {
+                ERROR("failed to read relations of type %s from file %s: %s\n", relationType, srcRef.name,
+                    strerror(status));
+                return status;
+            }
+            existingRelations.AddMessage(targetId, &newProperties);
+            TRACE_MSG(SEN_TRACE_LEVEL_DEBUG, "updated relations", &existingRelations);
+
+            allRelations = &existingRelations;
+        }
 
-        status = WriteRelation(&srcRef, targetId, relationType, &existingRelations);
+        status = WriteRelation(&srcRef, targetId, relationType, allRelations, &newProperties);
 
         if (status == B_OK) {
             LOG("* created relation %s from source %s to target %s [%s].\n",
@@ -288,14 +457,15 @@ status_t RelationHandler::AddRelation(const BMessage* message, BMessage* reply)
         // write inverse relation if it doesn't already exist
         LOG("  > checking for inverse relations of type %s...\n", relationType);
 
-        BMessage inverseRelationsReply;
-        status = ResolveInverseRelations(&targetRef, &inverseRelationsReply, relationType);
+        // only existence matters here, no need to resolve the targets or convert a record
+        BNode targetNode(&targetRef);
+        RelationSnapshot inverse;
+        status = ReadRelationSnapshot(&targetNode, &targetRef, attrName.String(), &inverse);
 
         if (status == B_OK) {
             // bail out if back link already exists
             BMessage inverseRelations;
-            status = inverseRelationsReply.FindMessage(SEN_RELATIONS, &inverseRelations);
-            if (! inverseRelations.IsEmpty()) {
+            if (! inverse.IsEmpty()) {
                 // done
                 LOG("  > backlink already exists, skipping.\n");
                 return status;
@@ -311,14 +481,14 @@ status_t RelationHandler::AddRelation(const BMessage* message, BMessage* reply)
 
                 // get inverse relation properties (e.g. suitable label)
                 BMessage inverseConfig;
-                status = relationConf.FindMessage(SEN_RELATION_CONFIG_INVERSE, &inverseConfig);
+                status = relationInfo->config.FindMessage(SEN_RELATION_CONFIG_INVERSE, &inverseConfig);
 
                 // todo: separate config from properties
                 inverseRelations.AddMessage(srcId, &inverseConfig);
 
                 if (status == B_OK || status == B_NAME_NOT_FOUND) {  // optional
                     // write inverse relations with swapped src/target
-                    status = WriteRelation(&targetRef, srcId, relationType, &inverseRelations);
+                    status = WriteRelation(&targetRef, srcId, relationType, &inverseRelations, &inverseConfig);
                 }
              }
 
@@ -344,8 +514,354 @@ status_t RelationHandler::AddRelation(const BMessage* message, BMessage* reply)
     return status;
 }
 
+/*
+ * batch add
+ */
+
+struct batch_node {
+    entry_ref   ref;
+    char        id[SEN_ID_LEN];
+    BString     mimeType;
+    bool        hasMimeType;
+    status_t    status;
+};
+
+struct batch_attribute {
+    node_ref    node;
+    BString     relationType;
+    BMessage    relations;
+    BStringList newTargetIds;
+    bool        changed;
+    status_t    status;
+    // target ID -> content hash -> property index, built per target on first use
+    std::unordered_map<std::string, std::unordered_multimap<uint64, int32>> hashes;
+};
+
+struct batch_item {
+    entry_ref   source;
+    entry_ref   target;
+    node_ref    sourceNode;
+    node_ref    targetNode;
+    BString     relationType;
+    const relation_type_info*   info;
+    BMessage    properties;
+    status_t    status;
+    const char* result;
+    batch_attribute*            forward;    // attributes written for this item, if any
+    batch_attribute*            inverse;
+};
+
+static std::unordered_multimap<uint64, int32>* batch_hashes_for(batch_attribute* attribute, const char* targetId)
+{
+    auto found = attribute->hashes.find(targetId);
+    if (found != attribute->hashes.end())
+        return &found->second;
+
+    std::unordered_multimap<uint64, int32>* hashes = &attribute->hashes[targetId];
+    BMessage properties;
+
+    for (int32 index = 0; attribute->relations.FindMessage(targetId, index, &properties) == B_OK; index++) {
+        hashes->emplace(RelationCache::HashProperties(&properties), index);
+    }
+
+    return hashes;
+}
+
+/**
+ * add a relation to the in-memory relations of `attribute` unless one with the same properties exists.
+ *
+ * @return true if added.
+ */
+static bool batch_add_relation(batch_attribute* attribute, const char* targetId, const BMessage* properties)
+{
+    std::unordered_multimap<uint64, int32>* hashes = batch_hashes_for(attribute, targetId);
+    uint64 hash = RelationCache::HashProperties(properties);
+
+    auto candidates = hashes->equal_range(hash);
+    for (auto candidate = candidates.first; candidate != candidates.second; ++candidate) {
+        BMessage existing;
+        if (attribute->relations.FindMessage(targetId, candidate->second, &existing) == B_OK
+            && existing.HasSameData(*properties)) {
+            return false;
+        }
+    }
+
+    type_code type;
+    int32 count = 0;
+    attribute->relations.GetInfo(targetId, &type, &count);
+
+    attribute->relations.AddMessage(targetId, properties);
+    hashes->emplace(hash, count);
+
+    if (! attribute->newTargetIds.HasString(targetId))
+        attribute->newTargetIds.Add(targetId);
+    attribute->changed = true;
+
+    return true;
+}
+
+status_t RelationHandler::AddRelations(const BMessage* message, BMessage* reply)
+{
+    type_code type;
+    int32 count = 0;
+
+    int32 typeCount = 0, targetCount = 0, propertiesCount = 0;
+    message->GetInfo(SEN_RELATION_TYPE, &type, &typeCount);
+    message->GetInfo(SEN_RELATION_TARGET_REF, &type, &targetCount);
+    message->GetInfo(SEN_RELATION_PROPERTIES, &type, &propertiesCount);
+
+    status_t status = message->GetInfo(SEN_RELATION_SOURCE_REF, &type, &count);
+    if (status == B_OK && type != B_REF_TYPE)
+        status = B_BAD_TYPE;
+
+    if (status != B_OK || count != typeCount || count != targetCount
+        || (propertiesCount != 0 && propertiesCount != count) || count > SEN_RELATIONS_BATCH_MAX_ITEMS) {
+        reply->AddString("error", BString("a batch needs one source ref, type and target ref per item, "
+            "optionally properties per item, and at most ") << SEN_RELATIONS_BATCH_MAX_ITEMS << " items");
+        return status != B_OK ? status : B_BAD_VALUE;
+    }
+
+    LOG("adding batch of %d relations...\n", count);
+
+    std::vector<batch_item> items(count);
+    // keeps the resolved configs alive for the whole batch, each type is only resolved once
+    std::map<std::string, std::shared_ptr<const RelationTypeTable>> relationTypes;
+
+    // parse items and resolve their nodes, without writing anything yet
+    for (int32 i = 0; i < count; i++) {
+        batch_item& item = items[i];
+        item.info    = NULL;
+        item.result  = NULL;
+        item.forward = NULL;
+        item.inverse = NULL;
+
+        const char* relationType = NULL;
+
+        item.status = message->FindRef(SEN_RELATION_SOURCE_REF, i, &item.source);
+        if (item.status == B_OK)
+            item.status = message->FindRef(SEN_RELATION_TARGET_REF, i, &item.target);
+        if (item.status == B_OK)
+            item.status = message->FindString(SEN_RELATION_TYPE, i, &relationType);
+        if (item.status == B_OK && propertiesCount > 0)
+            item.status = message->FindMessage(SEN_RELATION_PROPERTIES, i, &item.properties);
+
+        if (item.status == B_OK) {
+            item.relationType = relationType;
+            item.info = configRegistry->Find(relationType, &relationTypes[relationType]);
+            if (item.info == NULL) {
+                LOG("failed to get relation config for type %s\n", relationType);
+                item.status = B_ENTRY_NOT_FOUND;
+            }
+        }
+
+        if (item.status == B_OK) {
+            BNode source(&item.source);
+            BNode target(&item.target);
+
+            if ((item.status = source.InitCheck()) == B_OK
+                && (item.status = target.InitCheck()) == B_OK
+                && (item.status = source.GetNodeRef(&item.sourceNode)) == B_OK) {
+                item.status = target.GetNodeRef(&item.targetNode);
+            }
+        }
+    }
+
+    // chunks of consecutive items, so a batch never locks more than a bounded share of all stripes
+    std::set<int32> chunkStripes;
+    int32 first = 0;
+
+    for (int32 i = 0; i < count; i++) {
+        if (items[i].status != B_OK)
+            continue;
+
+        int32 sourceStripe = nodeLocks->StripeFor(&items[i].sourceNode);
+        int32 targetStripe = nodeLocks->StripeFor(&items[i].targetNode);
+
+        std::set<int32> stripes(chunkStripes);
+        stripes.insert(sourceStripe);
+        stripes.insert(targetStripe);
+
+        if ((int32)stripes.size() > SEN_RELATIONS_BATCH_MAX_STRIPES && ! chunkStripes.empty()) {
+            AddRelationChunk(&items, first, i);
+            first = i;
+            stripes.clear();
+            stripes.insert(sourceStripe);
+            stripes.insert(targetStripe);
+        }
+
+        chunkStripes.swap(stripes);
+    }
+
+    AddRelationChunk(&items, first, count);
+
+    int32 added = 0, existing = 0, failed = 0;
+
+    for (batch_item& item : items) {
+        if (item.status != B_OK) {
+            item.result = strerror(item.status);
+            failed++;
+        } else if (strcmp(item.result, "exists") == 0) {
+            existing++;
+        } else {
+            added++;
+        }
+
+        reply->AddInt32(SEN_RELATION_ITEM_STATUS, item.status);
+        reply->AddString(SEN_RELATION_ITEM_RESULT, item.result);
+    }
+
+    LOG("* added %d relations in batch, %d already existed, %d failed.\n", added, existing, failed);
+
+    reply->what = SEN_RESULT_RELATIONS;
+    reply->AddInt32("added", added);
+    reply->AddInt32("existing", existing);
+    reply->AddInt32("failed", failed);
+    reply->AddString("detail", BString("added ") << added << " of " << count << " relations");
+
+    return B_OK;
+}
+
+void RelationHandler::AddRelationChunk(std::vector<batch_item>* items, int32 first, int32 last)
+{
+    std::map<node_ref, batch_node> nodes;
+    std::map<std::pair<node_ref, std::string>, batch_attribute> attributes;
+
+    for (int32 i = first; i < last; i++) {
+        batch_item& item = (*items)[i];
+        if (item.status != B_OK)
+            continue;
+
+        nodes[item.sourceNode].ref = item.source;
+        nodes[item.targetNode].ref = item.target;
+    }
+
+    if (nodes.empty())
+        return;
+
+    std::vector<node_ref> lockedNodes;
+    for (auto& node : nodes) {
+        lockedNodes.push_back(node.first);
+    }
+
+    // everything from creating IDs to the last write happens under the node locks
+    nodeLocks->Lock(lockedNodes);
+
+    for (auto& node : nodes) {
+        node.second.hasMimeType = false;
+        node.second.status = GetOrCreateId(&node.second.ref, node.second.id, true);
+    }
+
+    auto isClassEntity = [&](batch_node* node) -> bool {
+        if (! node->hasMimeType) {
+            GetTypeForRef(&node->ref, &node->mimeType);
+            node->hasMimeType = true;
+        }
+        return node->mimeType.StartsWith(SEN_CLASS_SUPERTYPE);
+    };
+
+    // each attribute is read once, on first use
+    auto attributeFor = [&](const node_ref& node, const BString& relationType) -> batch_attribute* {
+        std::pair<node_ref, std::string> key(node, relationType.String());
+
+        auto found = attributes.find(key);
+        if (found != attributes.end())
+            return &found->second;
+
+        batch_attribute* attribute = &attributes[key];
+        attribute->node         = node;
+        attribute->relationType = relationType;
+        attribute->changed      = false;
+        attribute->status       = ReadRelationsOfType(&nodes[node].ref, relationType.String(),
+            &attribute->relations);
+
+        return attribute;
+    };
+
+    // apply each item like AddRelation(), forward then inverse, so later items see earlier ones
+    for (int32 i = first; i < last; i++) {
+        batch_item& item = (*items)[i];
+        if (item.status != B_OK)
+            continue;
+
+        batch_node* source = &nodes[item.sourceNode];
+        batch_node* target = &nodes[item.targetNode];
+
+        if ((item.status = source->status) != B_OK || (item.status = target->status) != B_OK)
+            continue;
+
+        bool linkToTarget = true;
+        if ((item.info->flags & SEN_RELATION_FLAG_BIDIR) == 0 && isClassEntity(source))
+            linkToTarget = isClassEntity(target);
+
+        item.forward = attributeFor(item.sourceNode, item.relationType);
+        if ((item.status = item.forward->status) != B_OK)
+            continue;
+
+        if (! linkToTarget) {
+            // add empty relations message for consistency, see AddRelation()
+            if (item.forward->relations.IsEmpty())
+                item.forward->changed = true;
+            item.result = "shallow";
+            continue;
+        }
+
+        if (! batch_add_relation(item.forward, target->id, &item.properties)) {
+            item.result = "exists";
+            continue;
+        }
+        item.result = "added";
+
+        // link back only if the target has no relation of this type yet
+        item.inverse = attributeFor(item.targetNode, item.relationType);
+        if ((item.status = item.inverse->status) != B_OK || ! item.inverse->relations.IsEmpty())
+            continue;
+
+        BMessage inverseConfig;
+        item.info->config.FindMessage(SEN_RELATION_CONFIG_INVERSE, &inverseConfig);
+
+        batch_add_relation(item.inverse, source->id, &inverseConfig);
+    }
+
+    // one write per changed attribute, with its final state
+    for (auto& entry : attributes) {
+        batch_attribute& attribute = entry.second;
+        if (! attribute.changed || attribute.status != B_OK)
+            continue;
+
+        batch_node& node = nodes[attribute.node];
+
+        if (! attribute.newTargetIds.IsEmpty()) {
+            BNode targetIdNode(&node.ref);
+            attribute.status = AddRelationTargetIdAttr(targetIdNode, &attribute.newTargetIds, attribute.relationType);
+
+            if (attribute.status != B_OK) {
+                ERROR("failed to store target IDs in file attrs of %s: %s\n", node.ref.name, strerror(attribute.status));
+                continue;
+            }
+
+            for (int32 i = 0; i < attribute.newTargetIds.CountStrings(); i++) {
+                targetIndex->AddTarget(node.id, &attribute.node, attribute.newTargetIds.StringAt(i).String());
+            }
+        }
+
+        attribute.status = WriteRelation(&node.ref, NULL, attribute.relationType.String(), &attribute.relations);
+    }
+
+    nodeLocks->Unlock(lockedNodes);
+
+    for (int32 i = first; i < last; i++) {
+        batch_item& item = (*items)[i];
+
+        if (item.status == B_OK && item.forward != NULL)
+            item.status = item.forward->status;
+        if (item.status == B_OK && item.inverse != NULL)
+            item.status = item.inverse->status;
+    }
+}
+
 status_t RelationHandler::WriteRelation(const entry_ref *srcRef,  const char* targetId,
-                                        const char *relationType, const BMessage* properties)
+                                        const char *relationType, const BMessage* properties,
+                                        const BMessage* appended)
 {
     char srcId[SEN_ID_LEN];
     status_t status = GetOrCreateId(srcRef, srcId, true);
@@ -359,15 +875,38 @@ status_t RelationHandler::WriteRelation(const entry_ref *srcRef,  const char* ta
     LOG("writing new relation '%s' from %s [%s] -> %s into attribute '%s'...\n",
         relationType, srcRef->name, srcId, targetId, attrName.String());
 
+    StageTimer writeTimer(SEN_STAGE_ATTR_WRITE);
     BNode node(srcRef); // has been checked already at least once here
 
-    ssize_t msgSize = properties->FlattenedSize();
-    char msgBuffer[msgSize];
-    status_t flatten_status = properties->Flatten(msgBuffer, msgSize);
+    // relations that don't fit the record format, e.g. with non-numeric target keys, stay messages
+    std::vector<char> attrBuffer;
+    type_code attrType = SEN_RELATION_RECORD_TYPE;
+    status_t flatten_status = B_BAD_VALUE;
+    bool append = appended != NULL && targetId != NULL
+        && RelationRecord::Format() == SEN_RELATION_FORMAT_RECORD;
+
+    attr_info attrInfo;
+    bool attrExists = node.GetAttrInfo(attrName.String(), &attrInfo) == B_OK;
+
+    if (! append) {
+        // an existing attribute keeps its format: its type can't change in place, and removing it
+        // first would lose all relations of this type if the new write failed
+        bool useRecord = attrExists ? attrInfo.type == SEN_RELATION_RECORD_TYPE
+            : RelationRecord::Format() == SEN_RELATION_FORMAT_RECORD;
+
+        if (useRecord)
+            flatten_status = RelationRecord::Flatten(properties, &attrBuffer);
+
+        if (flatten_status != B_OK) {
+            attrType = B_MESSAGE_TYPE;
+            attrBuffer.resize(properties->FlattenedSize());
+            flatten_status = properties->Flatten(attrBuffer.data(), attrBuffer.size());
+        }
 
-    if (flatten_status != B_OK) {
-        ERROR("failed to store relation properties for relation %s in file %s\n", relationType, srcRef->name);
-        return flatten_status;
+        if (flatten_status != B_OK) {
+            ERROR("failed to store relation properties for relation %s in file %s\n", relationType, srcRef->name);
+            return flatten_status;
+        }
     }
 
     // only now that all is clean, write relation to disk
@@ -379,19 +918,88 @@ status_t RelationHandler::WriteRelation(const entry_ref *srcRef,  const char* ta
             ERROR("failed to store targetId %s in file attrs of %s: %s\n", targetId, srcRef->name, strerror(status));
             return status;
         }
+
+        node_ref srcNodeRef;
+        node.GetNodeRef(&srcNodeRef);
+        targetIndex->AddTarget(srcId, &srcNodeRef, targetId);
+    }
+
+    node_ref nodeRef;
+    bool hasNodeRef = node.GetNodeRef(&nodeRef) == B_OK;
+
+    if (append) {
+        // only the new relation and the record trailer are written, no matter how many relations exist
+        size_t tailSize, baseSize;
+        status = RelationRecord::Append(&node, attrName.String(), targetId, appended, &tailSize, &baseSize);
+
+        if (status == B_OK) {
+            if (hasNodeRef) {
+                // keeps the cached relation and its content hashes for the next add
+                relationCache->Append(&nodeRef, attrName.String(), targetId, appended);
+                if (RelationRecord::NeedsCompaction(tailSize, baseSize))
+                    relationCompactor->Schedule(&nodeRef, attrName.String());
+            }
+            return B_OK;
+        }
+
+        // attribute in message format or corrupt, fall back to a full write
+        if (status != B_BAD_TYPE && status != B_BAD_DATA && status != B_BAD_VALUE) {
+            ERROR("failed to append relation %s for file %s: %s\n", relationType, srcRef->name, strerror(status));
+            return status;
+        }
+
+        if (properties != NULL)
+            return WriteRelation(srcRef, NULL, relationType, properties);
+
+        // the caller only had the record view, read the complete relations now
+        RelationSnapshot current;
+        BMessage relations;
+
+        if ((status = current.Read(&node, attrName.String())) != B_OK
+                || (status = current.ToMessage(&relations)) != B_OK) {
+            ERROR("failed to read relation %s for file %s: %s\n", relationType, srcRef->name, strerror(status));
+            return status;
+        }
+        relations.AddMessage(targetId, appended);
+
+        return WriteRelation(srcRef, NULL, relationType, &relations);
+    }
+
+    // only a record whose relations no longer fit the format changes type, keep its data
+    // to restore it should the new write fail
+    std::vector<char> previous;
+
+    if (attrExists && attrInfo.type != attrType) {
+        previous.resize(attrInfo.size);
+        ssize_t read = node.ReadAttr(attrName.String(), attrInfo.type, 0, previous.data(), previous.size());
+
+        if (read != (ssize_t)previous.size()) {
+            ERROR("failed to read relation %s for file %s before converting it\n", relationType, srcRef->name);
+            return read < 0 ? (status_t)read : B_IO_ERROR;
+        }
+        node.RemoveAttr(attrName.String());
     }
 
     // write complete relation config into target attribute with the canonical relation type name
     // Note: we also write relation config when not linking to a target, currently unused and empty.
     ssize_t result = node.WriteAttr(
         attrName.String(),
-        B_MESSAGE_TYPE,
+        attrType,
         0,
-        msgBuffer,
-        msgSize);
+        attrBuffer.data(),
+        attrBuffer.size());
+
+    // don't wait for the attribute monitor, the next request may already read this relation
+    if (hasNodeRef) {
+        relationCache->Invalidate(&nodeRef, attrName.String());
+    }
 
     if (result <= 0) {
         ERROR("failed to store relation %s for file %s: %s\n", relationType, srcRef->name, strerror(result));
+
+        if (! previous.empty()) {
+            node.WriteAttr(attrName.String(), attrInfo.type, 0, previous.data(), previous.size());
+        }
         return result;
     }
 
@@ -459,7 +1067,8 @@ status_t RelationHandler::GetCompatibleRelations(const BMessage* message, BMessa
         return status;
     }
 
-    BNodeInfo nodeInfo(new BNode(&sourceRef));
+    BNode sourceNode(&sourceRef);
+    BNodeInfo nodeInfo(&sourceNode);
     status = nodeInfo.InitCheck();
     if (status != B_OK) {
         ERROR("could not resolve entryRef '%s': %s\n", sourceRef.name, strerror(status));
@@ -470,33 +1079,22 @@ status_t RelationHandler::GetCompatibleRelations(const BMessage* message, BMessa
     nodeInfo.GetType(mimeType);
     LOG("searching for relations compatible with %s...\n", mimeType);
 
-    BMessage relationTypes;
-    status = BMimeType::GetInstalledTypes(SEN_RELATION_SUPERTYPE, &relationTypes);
+    // relations not applicable to the source type are already filtered out here
+    BStringList types;
+    BMessage relationConfigs;
+    status = compatibilityCache->GetCompatibleRelations(mimeType, &types, &relationConfigs);
     if (status != B_OK) {
-        ERROR("could not get installed MIME types: %s\n", strerror(status));
+        ERROR("could not get compatible relations: %s\n", strerror(status));
         return status;
     }
 
-    LOG("found relations:\n");
-    relationTypes.PrintToStream();
-
-    BStringList types;
-    relationTypes.FindStrings("types", &types);  // as per MimeType API spec
-
     // optionally get relation configs
     bool withConfigs = message->GetBool(SEN_MSG_CONFIGS, true);
 
     if (withConfigs) {
-        BMessage relationConfigs;
-        status = GetRelationConfigs(&types, &relationConfigs);
-        if (status == B_OK) {
-            reply->AddMessage(SEN_RELATION_CONFIG_MAP, &relationConfigs);
-        } else {
-            ERROR("could not get relation configs for compatible relations: %s\n", strerror(status));
-        }
+        reply->AddMessage(SEN_RELATION_CONFIG_MAP, &relationConfigs);
     }
 
-    // todo: filter out relations that exclude this type
     reply->what = SEN_RESULT_RELATIONS;
     reply->AddStrings(SEN_RELATIONS, types);
     reply->AddString("status", BString("got ")
@@ -508,35 +1106,17 @@ status_t RelationHandler::GetCompatibleRelations(const BMessage* message, BMessa
 status_t RelationHandler::GetCompatibleTargetTypes(const BString& relationType, bool withConfigs, BMessage* reply)
 {
     LOG("searching for types compatible with relation %s...\n", relationType.String());
-    BMessage targetTypes;
-    status_t status;
-
-    // associations are meta relations and handled slightly differently, here we always take the meta/ types only
-    if ((relationType == SEN_ASSOC_RELATION_TYPE) || (relationType.StartsWith(SEN_CLASS_SUPERTYPE "/")) ) {
-        LOG("resolving compatible association types...\n");
 
-        status = BMimeType::GetInstalledTypes(SEN_CLASS_SUPERTYPE, &targetTypes);
+    BStringList types;
+    BMessage targetConfigs;
+    status_t status = compatibilityCache->GetCompatibleTargetTypes(relationType.String(), &types, &targetConfigs);
 
-        if (status != B_OK) {
-            ERROR("error getting installed types from MIME db, falling back to any type: %s\n",
-                strerror(status));
-        }
-    } else {
-        LOG("using available template types allowed by relation.\n");
-        // todo: filter out targets excluded by relation type
+    if (status != B_OK) {
+        ERROR("could not get compatible target types for relation %s: %s\n", relationType.String(), strerror(status));
     }
 
-    BStringList types;
-    targetTypes.FindStrings("types", &types);   // as per MimeType API spec
-
     if (withConfigs) {
-        BMessage relationConfigs;
-        status = GetRelationConfigs(&types, &relationConfigs);
-        if (status == B_OK) {
-            reply->AddMessage(SEN_RELATION_CONFIG_MAP, &relationConfigs);
-        } else {
-            ERROR("could not get relation configs for compatible relations: %s\n", strerror(status));
-        }
+        reply->AddMessage(SEN_RELATION_CONFIG_MAP, &targetConfigs);
     }
 
     reply->what = SEN_RESULT_RELATIONS;
@@ -567,21 +1147,20 @@ status_t RelationHandler::GetRelationsOfType(const BMessage* message, BMessage*
     BMessage idToRefMap;
     bool returnIdToRefMap = message->GetBool(SEN_ID_TO_REF_MAP, false);
 
-    BStringList types;
-    types.Add(relationType);
-
-    // contains configs for all compatible relations found
-    BMessage relationConfigMap;
-    // config for the requested relation
-    BMessage relationConfig;
+    // one lookup serves both the config map of the reply and the flags below
+    bigtime_t configStart = system_time();
+    std::shared_ptr<const RelationTypeTable> relationTypes;
+    const relation_type_info* relationInfo = configRegistry->Find(relationType, &relationTypes);
 
-    // currently there will be only 1 type but to be consistent, we use the collection variant
-    // also later, n-ary relations might need more than 1 config.
-    status = GetRelationConfigs(&types, &relationConfigMap);
-    if (status == B_OK) {
+    if (relationInfo != NULL) {
+        // currently there will be only 1 type, later n-ary relations might need more than 1 config.
+        BMessage relationConfigMap;
+        relationConfigMap.AddMessage(relationType, &relationInfo->config);
         reply->AddMessage(SEN_RELATION_CONFIG_MAP, &relationConfigMap);
-        status = relationConfigMap.FindMessage(relationType, &relationConfig);
+    } else {
+        ERROR("failed to get relation config for type %s\n", relationType);
     }
+    RequestTrace::AddStage(SEN_STAGE_CONFIG, configStart);
 
     BMessage relations;
     status = ReadRelationsOfType(&sourceRef, relationType,
@@ -591,7 +1170,7 @@ status_t RelationHandler::GetRelationsOfType(const BMessage* message, BMessage*
 
     if (status == B_OK) {
         // add any inverse relations
-        if (! relationConfig.GetBool(SEN_RELATION_IS_BIDIR, true)) {
+        if (relationInfo != NULL && (relationInfo->flags & SEN_RELATION_FLAG_BIDIR) == 0) {
             status = ResolveInverseRelations(&sourceRef, &relations, relationType);
         }
     }
@@ -604,6 +1183,8 @@ status_t RelationHandler::GetRelationsOfType(const BMessage* message, BMessage*
         return status;
     }
 
+    StageTimer replyTimer(SEN_STAGE_REPLY);
+
     reply->what = SEN_RESULT_RELATIONS;
     reply->AddMessage(SEN_RELATIONS, &relations);
 
@@ -616,7 +1197,7 @@ status_t RelationHandler::GetRelationsOfType(const BMessage* message, BMessage*
     reply->AddString("status", BString("retrieved ") << numberOfRelations
                  << " relations from " << sourceRef.name);
 
-    reply->PrintToStream();
+    TRACE_MSG(SEN_TRACE_LEVEL_DEBUG, "relations of type", reply);
 
     return B_OK;
 }
@@ -632,7 +1213,9 @@ status_t RelationHandler::ReadRelationsOfType(
     BMessage* idToRefMap,
     BStringList* targetIds)
 {
+    bigtime_t openStart = system_time();
     BNode node(sourceRef);
+    RequestTrace::AddStage(SEN_STAGE_NODE_OPEN, openStart);
     status_t status;
 
     if ((status = node.InitCheck()) != B_OK) {
@@ -643,66 +1226,50 @@ status_t RelationHandler::ReadRelationsOfType(
     // read relation config as message from respective relation attribute
     BString attrName;
     GetAttributeNameForRelation(relationType, &attrName);
-    LOG("checking file '%s' for relation %s in atttribute %s\n", sourceRef->name, relationType, attrName.String());
 
-    attr_info attrInfo;
-    if ((status = node.GetAttrInfo(attrName.String(), &attrInfo)) != B_OK) {
-        // if attribute not found, e.g. new relation, this is OK, else it's a real ERROR
-        if (status != B_ENTRY_NOT_FOUND) {
-            ERROR("failed to get attribute info for ref %s: %s\n", sourceRef->name, strerror(status));
+    RelationSnapshot snapshot;
+    bool     cacheMiss   = false;
+    uint32   cacheTicket = 0;
+
+    status = ReadRelationSnapshot(&node, sourceRef, attrName.String(), &snapshot, &cacheMiss, &cacheTicket);
+    if (status != B_OK)
+        return status;
+
+    // records are only converted if the caller wants the relations, and only cached then
+    BMessage relationProperties;
+
+    if (relations != NULL || (cacheMiss && ! snapshot.IsRecord())) {
+        bigtime_t unflattenStart = system_time();
+        status = snapshot.ToMessage(&relationProperties);
+        RequestTrace::AddStage(SEN_STAGE_UNFLATTEN, unflattenStart);
+
+        if (status != B_OK) {
+            ERROR("invalid relation %s in file %s: %s\n", attrName.String(), sourceRef->name, strerror(status));
             return status;
         }
-        LOG("no existing relation of type %s found.\n", relationType);
-        return B_OK;
-    }
 
-    // read relation properties message
-    char* relation_attr_value = new char[attrInfo.size + 1];
-    ssize_t result = node.ReadAttr(
-            attrName.String(),
-            B_MESSAGE_TYPE,
-            0,
-            relation_attr_value,
-            attrInfo.size);
+        node_ref nodeRef;
+        if (cacheMiss && node.GetNodeRef(&nodeRef) == B_OK)
+            relationCache->Put(&nodeRef, attrName.String(), &relationProperties, cacheTicket);
+    }
 
-    if (result == 0) {          // result is bytes read
+    if (snapshot.IsEmpty()) {
         LOG("no relations of type %s found for path %s.\n", relationType, sourceRef->name);
         return B_OK;
-    } else if (result < 0) {    // result is an error code
-        ERROR("failed to read relation %s of file %s: %s\n", relationType, sourceRef->name, strerror(result));
-        return result;
     }
 
-    BMessage relationProperties;
-    relationProperties.Unflatten(relation_attr_value);
-
-    // optionally add targetIds list
+    // target IDs come straight from the record's target table, no properties are unflattened
+    BStringList tids;
     if (targetIds != NULL) {
-        status = ResolveRelationPropertyTargetIds(&relationProperties, targetIds);
-
-        if (result == B_OK) {
-            const char* ids = targetIds->Join(",").String();
-            LOG("got ids: %s\n", ids);
-        } else {
-            ERROR("failed to resolve relation target IDs for relation %s of file %s: %s\n",
-                relationType, sourceRef->name, strerror(result));
-
-            return status;
-        }
+        snapshot.GetTargetIds(targetIds);
+        LOG("got ids: %s\n", targetIds->Join(",").String());
+    } else if (idToRefMap != NULL) {
+        snapshot.GetTargetIds(&tids);
     }
 
     // optionally add target refs
     if (idToRefMap != NULL) {
-        // targetIds might have not been requested but we need them here now
-        if (targetIds != NULL) {
-            status = ResolveRelationTargets(targetIds, idToRefMap);
-        } else {
-            BStringList tids;
-            status = ResolveRelationPropertyTargetIds(&relationProperties, &tids);
-            if (status == B_OK) {
-                status = ResolveRelationTargets(&tids, idToRefMap);
-            }
-        }
+        status = ResolveRelationTargets(targetIds != NULL ? targetIds : &tids, idToRefMap);
 
         if (status == B_OK) {
             LOG("got %d unique relation targets for type %s and file %s, resolving entries...\n",
@@ -714,7 +1281,45 @@ status_t RelationHandler::ReadRelationsOfType(
     }
 
     // add properties associated with a given targetId (nested messages for each relation to the same target)
-    relations->Append(relationProperties);
+    if (relations != NULL)
+        relations->Append(relationProperties);
+
+    return status;
+}
+
+status_t RelationHandler::ReadRelationSnapshot(
+    BNode* node,
+    const entry_ref* sourceRef,
+    const char* attrName,
+    RelationSnapshot* snapshot,
+    bool* cacheMiss,
+    uint32* cacheTicket)
+{
+    node_ref nodeRef;
+    uint32   ticket = 0;
+    status_t status = node->GetNodeRef(&nodeRef);
+
+    if (status == B_OK && relationCache->Get(&nodeRef, attrName, snapshot->UseMessage(), &ticket) == B_OK) {
+        if (cacheMiss != NULL)
+            *cacheMiss = false;
+        return B_OK;
+    }
+
+    if (cacheMiss != NULL)
+        *cacheMiss = true;
+    if (cacheTicket != NULL)
+        *cacheTicket = ticket;
+
+    LOG("checking file '%s' for relation in atttribute %s\n", sourceRef->name, attrName);
+
+    bigtime_t readStart = system_time();
+    status = snapshot->Read(node, attrName);
+    RequestTrace::AddStage(SEN_STAGE_ATTR_READ, readStart);
+
+    if (status != B_OK) {
+        ERROR("failed to read relation %s of file %s: %s\n", attrName, sourceRef->name, strerror(status));
+        relationCache->Invalidate(&nodeRef);
+    }
 
     return status;
 }
@@ -791,46 +1396,37 @@ status_t RelationHandler::ReadRelationNames(const entry_ref* ref, BStringList* r
     return result;
 }
 
-status_t RelationHandler::ResolveRelationPropertyTargetIds(const BMessage* relationProperties, BStringList* ids)
-{
-    char*       idKey;
-    type_code   typeCode;
-    int32       propCount;
-    status_t    result = B_OK;
-
-    LOG(("extracting targetIds from relation properties:\n"));
-    relationProperties->PrintToStream();
-
-    for (int i = 0; i < relationProperties->CountNames(B_MESSAGE_TYPE); i++){
-        result = relationProperties->GetInfo(B_MESSAGE_TYPE, i, &idKey, &typeCode, &propCount);
-        if (result == B_OK && typeCode == B_MESSAGE_TYPE) {
-            ids->Add(BString(idKey));
-        }
-    }
-
-    return result;
-}
-
 status_t RelationHandler::ResolveRelationTargets(BStringList* ids, BMessage *idsToRefs)
 {
     LOG("resolving ids from list with %d targets...\n", ids->CountStrings())
+    StageTimer targetTimer(SEN_STAGE_TARGETS);
 
+    // resolve what we can from the index and collect misses for a batched query
+    BStringList missingIds;
     entry_ref ref;
-    status_t status;
+
     for (int i = 0; i < ids->CountStrings(); i++) {
         BString senId = ids->StringAt(i);
-        if ((status = QueryForUniqueSenId(senId.String(), &ref)) == B_OK) {
-            idsToRefs->AddRef(senId, new entry_ref(ref.device, ref.directory, ref.name));
+        if (idIndex->Lookup(senId.String(), &ref) == B_OK) {
+            idsToRefs->AddRef(senId, &ref);
         } else {
-            if (status == B_ENTRY_NOT_FOUND) {
-                LOG("ignoring stale target reference with ID %s.\n", senId.String());
-                continue;
-            } else {
-                return B_ERROR;
-            }
+            missingIds.Add(senId);
         }
     }
 
+    if (missingIds.IsEmpty()) {
+        return B_OK;
+    }
+
+    status_t status = QueryForSenIds(&missingIds, idsToRefs);
+    if (status != B_OK) {
+        return B_ERROR;
+    }
+
+    if (idsToRefs->CountNames(B_REF_TYPE) < ids->CountStrings()) {
+        LOG("ignoring %d stale target reference(s).\n", ids->CountStrings() - idsToRefs->CountNames(B_REF_TYPE));
+    }
+
     return B_OK;
 }
 
@@ -841,6 +1437,7 @@ status_t RelationHandler::ResolveInverseRelations(const entry_ref* sourceRef, BM
     BMessage inverseRelations;
 
     LOG("resolving INVERSE relations for type %s...\n", relationType);
+    StageTimer inverseTimer(SEN_STAGE_INVERSE);
 
     status_t status = GetOrCreateId(sourceRef, sourceId, true);
 
@@ -868,27 +1465,45 @@ status_t RelationHandler::ResolveInverseRelations(const entry_ref* sourceRef, BM
     reply->AddString("status", BString("got ") << idToRef.CountNames(B_REF_TYPE)
                   << " inverse target(s) for " << sourceId);
 
-    LOG("sending reply for inverse relations for type %s::\n", relationType != NULL ? relationType : "ALL");
-    reply->PrintToStream();
+    LOG("sending reply for inverse relations for type %s.\n", relationType != NULL ? relationType : "ALL");
+    TRACE_MSG(SEN_TRACE_LEVEL_DEBUG, "inverse relations", reply);
 
     return status;
 }
 
 // adds new targetId to existing IDs stored in SEN:TO for quick search and possible back linking.
 status_t RelationHandler::AddRelationTargetIdAttr(BNode& node, const char* targetId, const BString& relationType)
+{
+    BStringList targetIds;
+    targetIds.Add(targetId);
+
+    return AddRelationTargetIdAttr(node, &targetIds, relationType);
+}
+
+// same for many target IDs at once, with a single read and write of SEN:TO.
+status_t RelationHandler::AddRelationTargetIdAttr(BNode& node, const BStringList* newTargetIds,
+                                                  const BString& relationType)
 {
     BString targetIds;
-    status_t status = node.ReadAttrString(SEN_TO_ATTR, &targetIds);
+    node.ReadAttrString(SEN_TO_ATTR, &targetIds);
+
+    // match exact IDs only, a plain substring search would also hit IDs containing targetId
+    BStringList existingIds;
+    RelationTargetIndex::ParseTargetIds(targetIds, &existingIds);
+
+    for (int32 i = 0; i < newTargetIds->CountStrings(); i++) {
+        BString targetId = newTargetIds->StringAt(i);
+        if (existingIds.HasString(targetId))
+            continue;
 
-    if (targetIds.FindFirst(targetId) < 0) {
         if (! targetIds.IsEmpty())
             targetIds.Append(",");
 
         targetIds.Append(targetId);
+        existingIds.Add(targetId);
     }
 
     return node.WriteAttrString(SEN_TO_ATTR, &targetIds);
-
 }
 
 //
@@ -952,118 +1567,39 @@ status_t RelationHandler::GetMessageParameter(
 
 status_t RelationHandler::GetRelationConfigs(const BStringList* relations, BMessage* relationConfigs) {
     status_t status = B_OK;
+    StageTimer configTimer(SEN_STAGE_CONFIG);
 
     for (int i = 0; i < relations->CountStrings(); i++) {
         BString relation = relations->StringAt(i);
-        BMessage relationConf;
-
-        status = GetRelationConfig(relation.String(), &relationConf);
 
-        LOG("got relation config for type %s:\n", relation.String());
-        relationConf.PrintToStream();
+        // add the resolved config straight from the type table, no intermediate copy
+        std::shared_ptr<const RelationTypeTable> relationTypes;
+        const relation_type_info* relationInfo = configRegistry->Find(relation.String(), &relationTypes);
 
-        if (status == B_OK) {
-            status = relationConfigs->AddMessage(relation.String(), &relationConf);
-        } else {
+        if (relationInfo == NULL) {
+            status = B_ENTRY_NOT_FOUND;
             ERROR("failed to get relation config for type %s: %s\n", relation.String(), strerror(status));
             continue;
         }
+
+        LOG("got relation config for type %s.\n", relation.String());
+        TRACE_MSG(SEN_TRACE_LEVEL_DEBUG, "relation config", &relationInfo->config);
+
+        status = relationConfigs->AddMessage(relation.String(), &relationInfo->config);
     }
 
-    LOG("collected relation configs in msg:\n");
-    relationConfigs->PrintToStream();
+    TRACE_MSG(SEN_TRACE_LEVEL_DEBUG, "relation configs", relationConfigs);
 
     return status;
 }
 
 status_t RelationHandler::GetRelationConfig(const char* mimeType, BMessage* relationConfig)
 {
-    BString relation(mimeType);
-    BMimeType relationType(relation);
-    BMessage relationInfo;
-
-    status_t result = relationType.InitCheck() && relationType.IsValid();
-    if (result == B_OK) {
-        // we need to get this from the MIME DB directly as it is not part of
-        // the MimeType but stored as a custom attribute in the file system.
-        BPath path;
-        result = find_directory(B_USER_SETTINGS_DIRECTORY, &path);
-        if (result != B_OK) {
-            ERROR("could not find user settings directory: %s\n", strerror(result));
-            return result;
-        }
-
-        path.Append("mime_db");
-        path.Append(relation.String());
-
-        BNode mimeNode(path.Path());
-        if (mimeNode.InitCheck() != B_OK) {
-            ERROR( "error accessing MIME type file at '%s': %s\n", path.Path(), strerror(result));
-            return result;
-        }
-
-        // FIXME: we need to take into account the default relation config from the supertype!
-        //        BMessage::Append() will not overwrite existing properties but append them,
-        //        but we need a real merge with overwriting config from super in subtypes!
-        attr_info attrInfo;
-        result = mimeNode.GetAttrInfo(SEN_RELATION_CONFIG_ATTR, &attrInfo);
-
-        if (result != B_OK) {
-            // this attribute is optional for relation subtypes, just add defaults
-            if (result == B_ENTRY_NOT_FOUND) {
-                LOG("no relation config found for type %s, using defaults.\n", mimeType);
-
-                // quick hack to add defaults here, see above
-                relationInfo.AddBool(SEN_RELATION_IS_BIDIR, true);
-                relationInfo.AddBool(SEN_RELATION_IS_DYNAMIC, false);
-                relationInfo.AddBool(SEN_RELATION_IS_SELF, false);
-
-                result = B_OK;  // we fixed it:)
-            } else {
-                ERROR("could not get attrInfo for sen relation config for type %s: %s", mimeType, strerror(result));
-                return result;
-            }
-        } else {
-            // read config msg from fs attr
-            char buffer[attrInfo.size];
-
-            size_t sizeResult = mimeNode.ReadAttr(
-                SEN_RELATION_CONFIG_ATTR, B_MESSAGE_TYPE, 0, buffer, attrInfo.size);
-
-            if (sizeResult < attrInfo.size) {
-                if (sizeResult < 0)
-                    result = sizeResult;
-                else
-                    result = B_ERROR;
-
-                ERROR("error reading SEN:CONFIG attribute from MIME type file '%s': %s\n", path.Path(), strerror(result));
-                return result;
-            }
-
-            // materialize the flattened message
-            result = relationInfo.Unflatten(buffer);
-        }
-    }
-
+    status_t result = configRegistry->Get(mimeType, relationConfig);
     if (result != B_OK) {
         ERROR("could not get relation config for type %s: %s\n", mimeType, strerror(result));
     }
 
-    // get base attributes last (not to be overwritten by Unflatten above:)
-    char shortName[B_MIME_TYPE_LENGTH];
-    result = relationType.GetShortDescription(shortName);
-
-    if (result != B_OK) {
-        ERROR("could not get short name for MIME type %s, falling back to type name: %s\n", mimeType, strerror(result));
-        return result;
-    }
-
-    relationInfo.AddString(SEN_RELATION_NAME, shortName);
-    LOG("local relationInfo:\n");
-    relationInfo.PrintToStream();
-
-    relationConfig->Append(relationInfo);
-
     return result;
 }
 
@@ -1103,8 +1639,44 @@ status_t RelationHandler::GetSubtype(const BString* mimeTypeStr, BString* subTyp
 //
 // ID handling
 //
-const char* RelationHandler::GenerateId() {
-    return (new std::string(std::to_string(tsidGenerator->generate())) )->c_str();
+void RelationHandler::GenerateId(char* id)
+{
+    SenId::ToString(tsidGenerator->generate(), id);
+}
+
+uint64 RelationHandler::GenerateRawId()
+{
+    return tsidGenerator->generate();
+}
+
+void RelationHandler::GenerateRawIds(uint64* ids, size_t count)
+{
+    tsidGenerator->generate_batch(ids, count);
+}
+
+void RelationHandler::SetMonotonicIds(bool monotonic)
+{
+    LOG("switching to %s ID generation.\n", monotonic ? "monotonic" : "random");
+    tsidGenerator->set_monotonic(monotonic);
+}
+
+bool RelationHandler::IsMonotonicIds()
+{
+    return tsidGenerator->is_monotonic();
+}
+
+void RelationHandler::GetIdStats(BMessage* stats)
+{
+    tsid_stats tsidStats;
+    tsidGenerator->get_stats(&tsidStats);
+
+    stats->AddBool("monotonic", tsidGenerator->is_monotonic());
+    stats->AddInt64("generated", tsidStats.generated);
+    stats->AddDouble("throughput", tsidStats.throughput);
+    stats->AddInt64("contention", tsidStats.contention);
+    stats->AddInt64("clockSkewed", tsidStats.skewed);
+    stats->AddInt64("bucketsBorrowed", tsidStats.borrowed);
+    stats->AddInt64("bucketWaits", tsidStats.waits);
 }
 
 /**
@@ -1123,31 +1695,41 @@ status_t RelationHandler::GetOrCreateId(const entry_ref *ref, char* id, bool cre
         return result;
     }
 
-    BString idStr;
-    result = node.ReadAttrString(SEN_ID_ATTR, &idStr);
+    // reads both string and binary IDs
+    result = SenId::Read(&node, id);
     if (result == B_ENTRY_NOT_FOUND) {
         if (! createIfMissing) {
             return result;
         }
-        // todo: use try/catch!
-        strncpy(id, GenerateId(), SEN_ID_LEN);
 
-        if (id != NULL) {
-            LOG("generated new ID %s for path %s\n", id, ref->name);
-            if ((result = node.WriteAttrString(SEN_ID_ATTR, new BString(id))) != B_OK) {
-                ERROR("failed to create ID for path %s: %s\n", ref->name, strerror(result));
-                return result;
-            }
+        node_ref nodeRef;
+        if ((result = node.GetNodeRef(&nodeRef)) != B_OK) {
+            ERROR("failed to get node for path %s: %s\n", ref->name, strerror(result));
+            return result;
+        }
+
+        // check again under lock, a concurrent writer may have just created the ID
+        NodeLocker nodeLocker(nodeLocks, &nodeRef);
+        if (SenId::Read(&node, id) == B_OK) {
             return B_OK;
-        } else {
-            ERROR("failed to create ID for path %s\n", ref->name);
-            return B_ERROR;
         }
+
+        uint64 rawId = GenerateRawId();
+        SenId::ToString(rawId, id);
+
+        LOG("generated new ID %s for path %s\n", id, ref->name);
+        if ((result = SenId::Write(&node, rawId)) != B_OK) {
+            ERROR("failed to create ID for path %s: %s\n", ref->name, strerror(result));
+            *id = '\0';
+            return result;
+        }
+        // don't wait for the live query update, the ID may be looked up right away
+        idIndex->Add(id, ref, nodeRef.node);
+        return B_OK;
     } else if (result != B_OK) {
         ERROR("failed to read ID from path %s: %s\n", ref->name, strerror(result));
         return result;
     } else {
-        strncpy(id, idStr.String(), SEN_ID_LEN);
         LOG("got existing ID %s for path %s\n", id, ref->name);
     }
     return B_OK;
@@ -1155,12 +1737,27 @@ status_t RelationHandler::GetOrCreateId(const entry_ref *ref, char* id, bool cre
 
 status_t RelationHandler::QueryForUniqueSenId(const char* sourceId, entry_ref* refFound)
 {
-    BString predicate(BString(SEN_ID_ATTR) << "==" << sourceId);
+    status_t result = idIndex->Lookup(sourceId, refFound);
+    if (result == B_OK) {
+        LOG("found entry %s for ID %s in index\n", refFound->name, sourceId);
+        return B_OK;
+    }
+
+    // index miss or index not ready yet, fall back to query
+    return QueryForSenId(sourceId, refFound);
+}
+
+status_t RelationHandler::QueryForSenId(const char* sourceId, entry_ref* refFound)
+{
+    BString predicate;
+    SenId::GetPredicate(sourceId, &predicate);
     // TODO: all relation queries currently assume we never leave the boot volume
     BVolumeRoster volRoster;
     BVolume bootVolume;
     volRoster.GetBootVolume(&bootVolume);
 
+    MetricsTimer queryTimer(SEN_METRICS_QUERY);
+    RequestTrace::CountQuery();
     BQuery query;
     query.SetVolume(&bootVolume);
     query.SetPredicate(predicate.String());
@@ -1190,9 +1787,98 @@ status_t RelationHandler::QueryForUniqueSenId(const char* sourceId, entry_ref* r
     LOG("found entry %s\n", refFound->name);
     query.Clear();
 
+    // remember for next time
+    BNode node(refFound);
+    node_ref nodeRef;
+    if (node.GetNodeRef(&nodeRef) == B_OK) {
+        idIndex->Add(sourceId, refFound, nodeRef.node);
+    }
+
     return B_OK;
 }
 
+status_t RelationHandler::QueryForSenIds(const BStringList* ids, BMessage* idsToRefs, int32* queryCount)
+{
+    // TODO: all relation queries currently assume we never leave the boot volume
+    BVolumeRoster volRoster;
+    BVolume bootVolume;
+    volRoster.GetBootVolume(&bootVolume);
+
+    int32    idCount = ids->CountStrings();
+    int32    queries = 0;
+    int32    next    = 0;
+    status_t result  = B_OK;
+
+    while (next < idCount) {
+        // OR together as many IDs as the query engine comfortably handles in one predicate
+        BString predicate;
+        int32 chunkSize = 0;
+
+        while (next < idCount && chunkSize < SEN_QUERY_MAX_IDS) {
+            BString term;
+            SenId::GetPredicate(ids->StringAt(next).String(), &term);
+
+            if (chunkSize > 0 && predicate.Length() + term.Length() + 2 > SEN_QUERY_MAX_PREDICATE_LENGTH)
+                break;
+
+            if (chunkSize > 0)
+                predicate << "||";
+            predicate << term;
+
+            chunkSize++;
+            next++;
+        }
+
+        MetricsTimer queryTimer(SEN_METRICS_QUERY);
+        RequestTrace::CountQuery();
+        BQuery query;
+        query.SetVolume(&bootVolume);
+        query.SetPredicate(predicate.String());
+
+        if ((result = query.Fetch()) != B_OK) {
+            ERROR("could not execute query for %d IDs: %s\n", chunkSize, strerror(result));
+            return result;
+        }
+        queries++;
+
+        // fan results back into the map, keyed by the ID found on each entry
+        entry_ref refFound;
+        while ((result = query.GetNextRef(&refFound)) == B_OK) {
+            BNode node(&refFound);
+            BString senId;
+
+            if (SenId::Read(&node, &senId) != B_OK) {
+                ERROR("could not read SEN:ID of query result %s, skipping.\n", refFound.name);
+                continue;
+            }
+            if (idsToRefs->HasRef(senId.String())) {
+                // this should never happen as the SEN:ID MUST be unique!
+                ERROR("Critical error SEN:ID %s is NOT unique!\n", senId.String());
+                continue;
+            }
+            idsToRefs->AddRef(senId.String(), &refFound);
+
+            node_ref nodeRef;
+            if (node.GetNodeRef(&nodeRef) == B_OK) {
+                idIndex->Add(senId.String(), &refFound, nodeRef.node);
+            }
+        }
+
+        if (result != B_ENTRY_NOT_FOUND) {
+            ERROR("error resolving query for %d IDs: %s\n", chunkSize, strerror(result));
+            return result;
+        }
+        result = B_OK;
+    }
+
+    LOG("resolved %d of %d IDs with %d queries.\n", idsToRefs->CountNames(B_REF_TYPE), idCount, queries);
+
+    if (queryCount != NULL)
+        *queryCount = queries;
+
+    return result;
+}
+
 // used to resolve inverse relations where we need to go from target->source
 // todo: offer a live query (passing around a dest messenger) when querying large number of targets,
 //       e.g. for inverse relations with Classification entities!
@@ -1201,13 +1887,22 @@ status_t RelationHandler::QueryForTargetsById(const char* sourceId, BMessage* id
     status_t result;
     LOG("query for inverse relation targets with sourceId %s\n", sourceId);
 
-    // query for files with a SEN:TO attr containing our sourceId
+    // use the reverse index if available, this is O(degree) instead of a volume scan
+    BStringList inverseIds;
+    if ((result = targetIndex->GetSources(sourceId, &inverseIds)) == B_OK) {
+        LOG("got %d inverse relation targets for %s from index\n", inverseIds.CountStrings(), sourceId);
+        return ResolveRelationTargets(&inverseIds, idToRef);
+    }
+
+    // index not ready yet, fall back to query for files with a SEN:TO attr containing our sourceId
     BString predicate(BString(SEN_TO_ATTR) << "== '*" << sourceId << "*'");
     // TODO: all relation queries currently assume we never leave the boot volume
     BVolumeRoster volRoster;
     BVolume bootVolume;
     volRoster.GetBootVolume(&bootVolume);
 
+    MetricsTimer queryTimer(SEN_METRICS_QUERY);
+    RequestTrace::CountQuery();
     BQuery query;
     query.SetVolume(&bootVolume);
     query.SetPredicate(predicate.String());
@@ -1221,6 +1916,18 @@ status_t RelationHandler::QueryForTargetsById(const char* sourceId, BMessage* id
     while (result == B_OK) {
         result = query.GetNextRef(&refFound);
         if (result == B_OK) {
+            // the wildcard query may also match IDs merely containing our sourceId, so check
+            BNode node(&refFound);
+            BString targetIdsAttr;
+            BStringList targetIds;
+
+            if (node.ReadAttrString(SEN_TO_ATTR, &targetIdsAttr) == B_OK) {
+                RelationTargetIndex::ParseTargetIds(targetIdsAttr, &targetIds);
+            }
+            if (! targetIds.HasString(sourceId)) {
+                continue;
+            }
+
             char senId[SEN_ID_LEN];
             result = GetOrCreateId(&refFound, senId);
             if (result == B_OK) {
@@ -15,14 +15,60 @@
 
 #include <sen/Sensei.h>
 
+#include <vector>
+
+#include "CompatibilityCache.h"
 #include "IceDustGenerator.h"
+#include "NodeLockManager.h"
+#include "RelationBatch.h"
+#include "RelationCache.h"
+#include "RelationCompactor.h"
+#include "RelationConfigRegistry.h"
+#include "RelationRecord.h"
+#include "RelationTargetIndex.h"
+#include "RequestCoalescer.h"
+#include "SenIdIndex.h"
+
+// conservative limits for OR-combined ID queries, the query parser needs to hold the whole
+// predicate and the BFS index is consulted once per term
+#define SEN_QUERY_MAX_IDS               32
+#define SEN_QUERY_MAX_PREDICATE_LENGTH  1024
+
+struct batch_item;
 
 class RelationHandler : public BHandler {
 
 public:
         RelationHandler();
+        /**
+         * set up the SEN:ID format from `settings` and the in-memory SEN:ID and relation target
+         * indices, index updates are delivered to `target` and need to be passed on via UpdateIndices().
+         */
+        status_t    Init(const BMessenger& target, const BMessage* settings);
+        /**
+         * pass on live query updates and node monitor messages to the indices, relation cache
+         * and relation config registry.
+         */
+        void        UpdateIndices(const BMessage* message);
+        /**
+         * add size and hit/miss counters of the relation and compatibility caches, node lock
+         * contention, the number of coalesced requests and compaction counters to `stats`.
+         */
+        void        GetCacheStats(BMessage* stats);
 
         status_t    AddRelation             (const BMessage* message, BMessage* reply);
+        /**
+         * add a batch of relations, see SEN_RELATIONS_ADD_BATCH, with the same result as adding
+         * them one by one in order. Configs are resolved once per type.
+         *
+         * Items are processed in chunks that lock at most SEN_RELATIONS_BATCH_MAX_STRIPES node
+         * lock stripes, so while a chunk runs, it serializes all other writes hashing to these
+         * stripes. Every relation attribute touched by a chunk is read and written once.
+         * The reply holds SEN_RELATION_ITEM_STATUS and SEN_RELATION_ITEM_RESULT per item.
+         *
+         * @return B_OK if the batch was processed, even if single items failed.
+         */
+        status_t    AddRelations            (const BMessage* message, BMessage* reply);
         status_t    GetCompatibleRelations  (const BMessage* message, BMessage* reply);
         status_t    GetCompatibleTargetTypes(const BString&  relationType, bool withConfigs, BMessage* reply);
         status_t    GetRelationsOfType      (const BMessage* message, BMessage* reply);
@@ -33,11 +79,49 @@ public:
         // delete all relations of a given type, e.g. when a related file is deleted
         status_t    RemoveAllRelations      (const BMessage* message, BMessage* reply);
 
-        const char* GenerateId();
+        /**
+         * generate a new TSID as decimal string into `id`, which must hold SEN_ID_LEN chars.
+         */
+        void        GenerateId(char* id);
+        uint64      GenerateRawId();
+        /**
+         * generate `count` unique raw IDs at once, e.g. for bulk imports.
+         */
+        void        GenerateRawIds(uint64* ids, size_t count);
+        /**
+         * switch the ID generator between random and monotonic mode at runtime.
+         */
+        void        SetMonotonicIds(bool monotonic);
+        bool        IsMonotonicIds();
+        /**
+         * add ID generator mode, throughput and contention/skew counters to `stats`.
+         */
+        void        GetIdStats(BMessage* stats);
         status_t    GetOrCreateId           (const entry_ref* ref, char* id, bool createIfMissing = false);
         status_t    QueryForUniqueSenId     (const char* sourceId, entry_ref* ref);
+        /**
+         * resolve a single ID with a query, bypassing the ID index.
+         */
+        status_t    QueryForSenId           (const char* sourceId, entry_ref* ref);
+        /**
+         * resolve many IDs with as few queries as possible, bypassing the ID index.
+         * IDs are OR-combined into predicates of at most SEN_QUERY_MAX_IDS terms.
+         *
+         * @param ids           the IDs to resolve
+         * @param idsToRefs     result message mapping each ID found to its entry_ref,
+         *                      IDs not found are simply missing
+         * @param queryCount    optionally receives the number of queries executed
+         * @return `B_OK` or the status code of the first failed query.
+         */
+        status_t    QueryForSenIds          (const BStringList* ids, BMessage* idsToRefs, int32* queryCount = NULL);
         status_t    QueryForTargetsById     (const char* sourceId, BMessage* idToRef);
 
+        /**
+         * resolve target IDs to entry_refs, using the ID index and a batched query for any misses.
+         * Stale IDs without a matching entry are skipped.
+         */
+        status_t    ResolveRelationTargets  (BStringList* ids, BMessage *idsToRefs);
+
         const char* GetMimeTypeForRef       (const entry_ref* ref);
         /**
           * query for any file with a `SEN:TO` attributeS that contains the sourceId for `sourceRef`.
@@ -82,17 +166,41 @@ protected:
                                           BMessage *pluginResult);
 
 private:
+        /**
+         * read the relations of a type, through the relation cache. Only target IDs are taken
+         * from a record directly, `relations` is optional and the only reason to convert it.
+         */
         status_t    ReadRelationsOfType(const entry_ref* ref, const char* relationType, BMessage* relations,
                                                 BMessage* idToRefMap = NULL, BStringList* targetIds = NULL);
+        /**
+         * get the relations in `attrName` from the relation cache, or from the attribute leaving
+         * records in their compact form. An empty snapshot means the node has no such relation.
+         *
+         * @param cacheMiss     optionally set if the relations were not cached
+         * @param cacheTicket   set on a miss for caching the converted relations via RelationCache::Put()
+         */
+        status_t    ReadRelationSnapshot(BNode* node, const entry_ref* ref, const char* attrName,
+                                         RelationSnapshot* snapshot, bool* cacheMiss = NULL,
+                                         uint32* cacheTicket = NULL);
         status_t    ReadRelationNames(const entry_ref* ref, BStringList* relations);
-        status_t    ResolveRelationTargets(BStringList* ids, BMessage *idsToRefs);
-        status_t    ResolveRelationPropertyTargetIds(const BMessage* relationProperties, BStringList* ids);
 
         // write/delete
+        /**
+         * write all relations of a type, `properties` being the complete relation message.
+         * If the relation to `targetId` with properties `appended` is the only change, a record
+         * attribute just gets it appended instead of being rewritten; `properties` may then be NULL
+         * and is only read from disk if the attribute has to be rewritten after all.
+         * An existing attribute keeps its format.
+         */
         status_t    WriteRelation(const entry_ref *srcRef, const char* targetId,
-                                          const char *relationType, const BMessage* properties);
+                                          const char *relationType, const BMessage* properties,
+                                          const BMessage* appended = NULL);
         status_t    RemoveRelationForTypeAndTarget(const entry_ref *ref, const char *relationType, const char *targetId);
         status_t    RemoveAllRelations(const entry_ref *ref);
+        /**
+         * add items [first, last) of a batch with all of their nodes locked.
+         */
+        void        AddRelationChunk(std::vector<batch_item>* items, int32 first, int32 last);
 
         // helper methods
         status_t    GetSubtype(const BString* type, BString* subtype);
@@ -103,6 +211,15 @@ private:
                                         bool mandatory = true);
         void        GetAttributeNameForRelation(const char* relationType, BString* attrName);
         status_t    AddRelationTargetIdAttr(BNode& node, const char* targetId, const BString& relationType);
+        status_t    AddRelationTargetIdAttr(BNode& node, const BStringList* targetIds, const BString& relationType);
 
         IceDustGenerator*   tsidGenerator;
+        SenIdIndex*         idIndex;
+        RelationTargetIndex* targetIndex;
+        RelationCache*      relationCache;
+        RelationConfigRegistry* configRegistry;
+        CompatibilityCache* compatibilityCache;
+        NodeLockManager*    nodeLocks;
+        RequestCoalescer*   requestCoalescer;
+        RelationCompactor*  relationCompactor;
 };
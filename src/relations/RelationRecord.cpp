@@ -0,0 +1,645 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#include <fs_attr.h>
+
+#include <algorithm>
+#include <set>
+#include <string.h>
+
+#include "RelationRecord.h"
+#include "SenId.h"
+#include <sen/Sen.h>
+
+int32 RelationRecord::sFormat = SEN_RELATION_FORMAT_MESSAGE;
+
+static inline uint64 align8(uint64 size)
+{
+    return (size + 7) & ~(uint64)7;
+}
+
+/**
+ * size of the sorted part as described by `header`, 0 if the header is invalid.
+ */
+static uint64 base_size(const relation_record_header* header)
+{
+    if (header->magic != SEN_RELATION_RECORD_MAGIC
+        || header->version != SEN_RELATION_RECORD_VERSION
+        || header->headerSize < sizeof(relation_record_header)
+        || header->headerSize % 8 != 0) {
+        return 0;
+    }
+
+    // 64 bit arithmetic, so corrupt counts can't overflow any bounds check
+    return (uint64)header->headerSize
+        + (uint64)header->targetCount * sizeof(relation_record_target)
+        + ((uint64)header->propertyCount + 1) * sizeof(uint32)
+        + header->blobSize;
+}
+
+/**
+ * parse a target ID, which must survive the round trip unchanged, e.g. no leading zeros.
+ */
+static status_t parse_target_id(const char* name, uint64* id)
+{
+    char canonical[SEN_ID_LEN];
+
+    if (SenId::Parse(name, id) != B_OK)
+        return B_BAD_VALUE;
+
+    SenId::ToString(*id, canonical);
+    return strcmp(canonical, name) == 0 ? B_OK : B_BAD_VALUE;
+}
+
+RelationRecordView::RelationRecordView()
+    : fHeader(NULL),
+      fTargets(NULL),
+      fOffsets(NULL),
+      fBlobs(NULL),
+      fBaseSize(0),
+      fTailSize(0)
+{
+}
+
+status_t RelationRecordView::SetTo(const void* data, size_t size)
+{
+    fHeader = NULL;
+    fAppended.clear();
+
+    const relation_record_header* header = (const relation_record_header*)data;
+    if (size < sizeof(relation_record_header))
+        return B_BAD_DATA;
+
+    uint64 baseSize = base_size(header);
+    if (baseSize == 0 || baseSize > size)
+        return B_BAD_DATA;
+
+    const char* base = (const char*)data;
+    const relation_record_target* targets = (const relation_record_target*)(base + header->headerSize);
+    const uint32* offsets = (const uint32*)(targets + header->targetCount);
+
+    // properties of each target must lie within the offset table, offsets within the blobs
+    for (uint32 i = 0; i < header->targetCount; i++) {
+        if ((uint64)targets[i].firstProperty + targets[i].propertyCount > header->propertyCount)
+            return B_BAD_DATA;
+    }
+    for (uint32 i = 0; i < header->propertyCount; i++) {
+        if (offsets[i] > offsets[i + 1])
+            return B_BAD_DATA;
+    }
+    if (offsets[header->propertyCount] != header->blobSize)
+        return B_BAD_DATA;
+
+    uint64 tailSize = 0;
+
+    if (size > baseSize) {
+        // appended relations, located by the trailer
+        uint64 tailStart = align8(baseSize);
+        if (size < tailStart + sizeof(relation_record_trailer))
+            return B_BAD_DATA;
+
+        const relation_record_trailer* trailer =
+            (const relation_record_trailer*)(base + size - sizeof(relation_record_trailer));
+
+        tailSize = trailer->tailSize;
+        if (trailer->magic != SEN_RELATION_TRAILER_MAGIC || trailer->baseSize != baseSize
+            || tailStart + tailSize + sizeof(relation_record_trailer) != size) {
+            return B_BAD_DATA;
+        }
+
+        uint64 position = tailStart;
+        uint64 tailEnd  = tailStart + tailSize;
+
+        while (position < tailEnd) {
+            const relation_record_entry* entry = (const relation_record_entry*)(base + position);
+            if (position + sizeof(relation_record_entry) + entry->size > tailEnd)
+                return B_BAD_DATA;
+
+            fAppended.push_back(entry);
+            position += align8(sizeof(relation_record_entry) + entry->size);
+        }
+
+        if (position != tailEnd || fAppended.size() != trailer->entryCount) {
+            fAppended.clear();
+            return B_BAD_DATA;
+        }
+    }
+
+    fHeader   = header;
+    fTargets  = targets;
+    fOffsets  = offsets;
+    fBlobs    = (const char*)(offsets + header->propertyCount + 1);
+    fBaseSize = baseSize;
+    fTailSize = tailSize;
+
+    return B_OK;
+}
+
+int32 RelationRecordView::CountTargets() const
+{
+    return fHeader != NULL ? fHeader->targetCount : 0;
+}
+
+uint64 RelationRecordView::TargetAt(int32 index) const
+{
+    return fTargets[index].id;
+}
+
+int32 RelationRecordView::FindTarget(uint64 id) const
+{
+    const relation_record_target* end = fTargets + CountTargets();
+    const relation_record_target* target = std::lower_bound(fTargets, end, id,
+        [](const relation_record_target& entry, uint64 value) { return entry.id < value; });
+
+    if (target == end || target->id != id)
+        return -1;
+
+    return target - fTargets;
+}
+
+int32 RelationRecordView::CountProperties(int32 targetIndex) const
+{
+    return fTargets[targetIndex].propertyCount;
+}
+
+status_t RelationRecordView::GetProperties(int32 targetIndex, int32 propertyIndex,
+    BMessage* properties) const
+{
+    if (targetIndex < 0 || targetIndex >= CountTargets()
+        || propertyIndex < 0 || (uint32)propertyIndex >= fTargets[targetIndex].propertyCount) {
+        return B_BAD_INDEX;
+    }
+
+    uint32 index = fTargets[targetIndex].firstProperty + propertyIndex;
+    if (fOffsets[index] == fOffsets[index + 1]) {
+        properties->MakeEmpty();
+        return B_OK;
+    }
+
+    return properties->Unflatten(fBlobs + fOffsets[index]);
+}
+
+int32 RelationRecordView::CountAppended() const
+{
+    return fAppended.size();
+}
+
+uint64 RelationRecordView::AppendedTargetAt(int32 index) const
+{
+    return fAppended[index]->id;
+}
+
+status_t RelationRecordView::GetAppendedProperties(int32 index, BMessage* properties) const
+{
+    if (index < 0 || index >= CountAppended())
+        return B_BAD_INDEX;
+
+    const relation_record_entry* entry = fAppended[index];
+    if (entry->size == 0) {
+        properties->MakeEmpty();
+        return B_OK;
+    }
+
+    return properties->Unflatten((const char*)(entry + 1));
+}
+
+size_t RelationRecordView::BaseSize() const
+{
+    return fBaseSize;
+}
+
+size_t RelationRecordView::TailSize() const
+{
+    return fTailSize;
+}
+
+void RelationRecordView::GetTargetIds(BStringList* ids) const
+{
+    char id[SEN_ID_LEN];
+
+    for (int32 i = 0; i < CountTargets(); i++) {
+        SenId::ToString(fTargets[i].id, id);
+        ids->Add(id);
+    }
+
+    // appended relations may be to known or new targets
+    std::set<uint64> added;
+    for (const relation_record_entry* entry : fAppended) {
+        if (FindTarget(entry->id) >= 0 || ! added.insert(entry->id).second)
+            continue;
+
+        SenId::ToString(entry->id, id);
+        ids->Add(id);
+    }
+}
+
+status_t RelationRecordView::ToMessage(BMessage* relations) const
+{
+    char id[SEN_ID_LEN];
+
+    for (int32 i = 0; i < CountTargets(); i++) {
+        SenId::ToString(fTargets[i].id, id);
+
+        for (int32 p = 0; p < CountProperties(i); p++) {
+            BMessage properties;
+            status_t result = GetProperties(i, p, &properties);
+            if (result == B_OK)
+                result = relations->AddMessage(id, &properties);
+            if (result != B_OK)
+                return result;
+        }
+    }
+
+    // appended relations go after the existing ones of their target, just like AddMessage()
+    for (int32 i = 0; i < CountAppended(); i++) {
+        SenId::ToString(fAppended[i]->id, id);
+
+        BMessage properties;
+        status_t result = GetAppendedProperties(i, &properties);
+        if (result == B_OK)
+            result = relations->AddMessage(id, &properties);
+        if (result != B_OK)
+            return result;
+    }
+
+    return B_OK;
+}
+
+RelationSnapshot::RelationSnapshot()
+    : fIsRecord(false)
+{
+}
+
+status_t RelationSnapshot::Read(const BNode* node, const char* attrName)
+{
+    fIsRecord = false;
+    fMessage.MakeEmpty();
+
+    attr_info attrInfo;
+    status_t result = node->GetAttrInfo(attrName, &attrInfo);
+    if (result != B_OK)
+        return result == B_ENTRY_NOT_FOUND ? B_OK : result;     // no relation of this type yet
+
+    if (attrInfo.size == 0)
+        return B_OK;
+
+    // uint64 buffer for the aligned record view
+    fBuffer.resize((attrInfo.size + sizeof(uint64) - 1) / sizeof(uint64));
+    ssize_t size = node->ReadAttr(attrName, attrInfo.type, 0, fBuffer.data(), attrInfo.size);
+    if (size < 0)
+        return size;
+    if (size == 0)
+        return B_OK;
+
+    if (attrInfo.type == SEN_RELATION_RECORD_TYPE) {
+        if ((result = fRecord.SetTo(fBuffer.data(), size)) == B_OK)
+            fIsRecord = true;
+        return result;
+    }
+
+    result = fMessage.Unflatten((const char*)fBuffer.data());
+    fBuffer.clear();
+
+    return result;
+}
+
+BMessage* RelationSnapshot::UseMessage()
+{
+    fIsRecord = false;
+    fBuffer.clear();
+    fMessage.MakeEmpty();
+
+    return &fMessage;
+}
+
+bool RelationSnapshot::IsRecord() const
+{
+    return fIsRecord;
+}
+
+bool RelationSnapshot::IsEmpty() const
+{
+    if (fIsRecord)
+        return fRecord.CountTargets() == 0 && fRecord.CountAppended() == 0;
+
+    return fMessage.IsEmpty();
+}
+
+status_t RelationSnapshot::FindProperties(const char* targetId, const BMessage* properties) const
+{
+    BMessage existing;
+    status_t result;
+
+    if (! fIsRecord) {
+        for (int32 index = 0; (result = fMessage.FindMessage(targetId, index, &existing)) == B_OK; index++) {
+            if (existing.HasSameData(*properties))
+                return B_OK;
+        }
+        return result;
+    }
+
+    uint64 id;
+    if (parse_target_id(targetId, &id) != B_OK)
+        return B_NAME_NOT_FOUND;    // can't be in a record
+
+    // only the candidate target's properties are unflattened
+    int32 targetIndex = fRecord.FindTarget(id);
+    if (targetIndex >= 0) {
+        for (int32 index = 0; index < fRecord.CountProperties(targetIndex); index++) {
+            if ((result = fRecord.GetProperties(targetIndex, index, &existing)) != B_OK)
+                return result;
+            if (existing.HasSameData(*properties))
+                return B_OK;
+        }
+    }
+
+    for (int32 index = 0; index < fRecord.CountAppended(); index++) {
+        if (fRecord.AppendedTargetAt(index) != id)
+            continue;
+        if ((result = fRecord.GetAppendedProperties(index, &existing)) != B_OK)
+            return result;
+        if (existing.HasSameData(*properties))
+            return B_OK;
+    }
+
+    return B_NAME_NOT_FOUND;
+}
+
+int32 RelationSnapshot::CountProperties(const char* targetId) const
+{
+    if (! fIsRecord) {
+        type_code type;
+        int32 count = 0;
+        return fMessage.GetInfo(targetId, &type, &count) == B_OK ? count : 0;
+    }
+
+    uint64 id;
+    if (parse_target_id(targetId, &id) != B_OK)
+        return 0;
+
+    int32 targetIndex = fRecord.FindTarget(id);
+    int32 count = targetIndex >= 0 ? fRecord.CountProperties(targetIndex) : 0;
+
+    for (int32 index = 0; index < fRecord.CountAppended(); index++) {
+        if (fRecord.AppendedTargetAt(index) == id)
+            count++;
+    }
+
+    return count;
+}
+
+void RelationSnapshot::GetTargetIds(BStringList* ids) const
+{
+    if (fIsRecord) {
+        fRecord.GetTargetIds(ids);
+        return;
+    }
+
+    char*       idKey;
+    type_code   type;
+    int32       count;
+
+    for (int32 i = 0; fMessage.GetInfo(B_MESSAGE_TYPE, i, &idKey, &type, &count) == B_OK; i++) {
+        ids->Add(idKey);
+    }
+}
+
+status_t RelationSnapshot::ToMessage(BMessage* relations) const
+{
+    if (fIsRecord)
+        return fRecord.ToMessage(relations);
+
+    return relations->Append(fMessage);
+}
+
+void RelationRecord::SetFormat(relation_format format)
+{
+    atomic_set(&sFormat, format);
+}
+
+relation_format RelationRecord::Format()
+{
+    return static_cast<relation_format>(atomic_get(&sFormat));
+}
+
+status_t RelationRecord::Flatten(const BMessage* relations, std::vector<char>* record)
+{
+    struct target_entry {
+        uint64      id;
+        const char* name;
+        int32       count;
+    };
+    std::vector<target_entry> targets;
+
+    char* name;
+    type_code type;
+    int32 count;
+    int32 propertyCount = 0;
+
+    for (int32 i = 0; relations->GetInfo(B_ANY_TYPE, i, &name, &type, &count) == B_OK; i++) {
+        uint64 id;
+        if (type != B_MESSAGE_TYPE || parse_target_id(name, &id) != B_OK)
+            return B_BAD_VALUE;
+
+        targets.push_back({ id, name, count });
+        propertyCount += count;
+    }
+
+    std::sort(targets.begin(), targets.end(),
+        [](const target_entry& a, const target_entry& b) { return a.id < b.id; });
+
+    // flatten all properties first to know the blob size
+    std::vector<uint32> offsets;
+    std::vector<char> blobs;
+    offsets.reserve(propertyCount + 1);
+
+    for (const target_entry& target : targets) {
+        for (int32 p = 0; p < target.count; p++) {
+            offsets.push_back(blobs.size());
+
+            BMessage properties;
+            status_t result = relations->FindMessage(target.name, p, &properties);
+            if (result != B_OK)
+                return result;
+
+            ssize_t size = properties.FlattenedSize();
+            blobs.resize(blobs.size() + size);
+            if ((result = properties.Flatten(blobs.data() + blobs.size() - size, size)) != B_OK)
+                return result;
+        }
+    }
+    offsets.push_back(blobs.size());
+
+    relation_record_header header;
+    header.magic         = SEN_RELATION_RECORD_MAGIC;
+    header.version       = SEN_RELATION_RECORD_VERSION;
+    header.headerSize    = sizeof(header);
+    header.targetCount   = targets.size();
+    header.propertyCount = propertyCount;
+    header.blobSize      = blobs.size();
+    header.reserved      = 0;
+
+    size_t tableSize  = targets.size() * sizeof(relation_record_target);
+    size_t offsetSize = offsets.size() * sizeof(uint32);
+
+    record->resize(sizeof(header) + tableSize + offsetSize + blobs.size());
+    char* position = record->data();
+
+    memcpy(position, &header, sizeof(header));
+    position += sizeof(header);
+
+    uint32 firstProperty = 0;
+    for (const target_entry& target : targets) {
+        relation_record_target entry = { target.id, firstProperty, (uint32)target.count };
+        memcpy(position, &entry, sizeof(entry));
+        position += sizeof(entry);
+        firstProperty += target.count;
+    }
+
+    memcpy(position, offsets.data(), offsetSize);
+    position += offsetSize;
+    memcpy(position, blobs.data(), blobs.size());
+
+    return B_OK;
+}
+
+status_t RelationRecord::Append(BNode* node, const char* attrName, const char* targetId,
+    const BMessage* properties, size_t* tailSize, size_t* baseSize)
+{
+    uint64 id;
+    if (parse_target_id(targetId, &id) != B_OK)
+        return B_BAD_VALUE;
+
+    attr_info attrInfo;
+    status_t result = node->GetAttrInfo(attrName, &attrInfo);
+
+    if (result == B_ENTRY_NOT_FOUND) {
+        // first relation of this type, start with a sorted part of one
+        BMessage relations;
+        relations.AddMessage(targetId, properties);
+
+        std::vector<char> record;
+        if ((result = Flatten(&relations, &record)) != B_OK)
+            return result;
+
+        ssize_t written = node->WriteAttr(attrName, SEN_RELATION_RECORD_TYPE, 0, record.data(), record.size());
+        if (written < 0)
+            return written;
+
+        if (tailSize != NULL)
+            *tailSize = 0;
+        if (baseSize != NULL)
+            *baseSize = record.size();
+
+        return written == (ssize_t)record.size() ? B_OK : B_ERROR;
+    }
+
+    if (result != B_OK)
+        return result;
+    if (attrInfo.type != SEN_RELATION_RECORD_TYPE)
+        return B_BAD_TYPE;
+
+    relation_record_header header;
+    if (node->ReadAttr(attrName, SEN_RELATION_RECORD_TYPE, 0, &header, sizeof(header)) != sizeof(header))
+        return B_BAD_DATA;
+
+    uint64 base = base_size(&header);
+    if (base == 0 || base > (uint64)attrInfo.size)
+        return B_BAD_DATA;
+
+    relation_record_trailer trailer;
+    off_t position;
+
+    if ((uint64)attrInfo.size == base) {
+        // no tail yet, pad up to it
+        trailer.baseSize   = base;
+        trailer.tailSize   = 0;
+        trailer.entryCount = 0;
+        trailer.magic      = SEN_RELATION_TRAILER_MAGIC;
+        position = base;
+    } else {
+        position = attrInfo.size - sizeof(trailer);
+        if (node->ReadAttr(attrName, SEN_RELATION_RECORD_TYPE, position, &trailer, sizeof(trailer))
+                != sizeof(trailer)
+            || trailer.magic != SEN_RELATION_TRAILER_MAGIC || trailer.baseSize != base
+            || align8(base) + trailer.tailSize + sizeof(trailer) != (uint64)attrInfo.size) {
+            return B_BAD_DATA;
+        }
+    }
+
+    // padding, the new entry and the new trailer replacing the old one in a single write
+    size_t padding = align8(position) - position;
+    ssize_t propertiesSize = properties->FlattenedSize();
+    size_t entrySize = align8(sizeof(relation_record_entry) + propertiesSize);
+
+    std::vector<char> buffer(padding + entrySize + sizeof(trailer), 0);
+
+    relation_record_entry entry = { id, (uint32)propertiesSize, 0 };
+    memcpy(buffer.data() + padding, &entry, sizeof(entry));
+
+    if ((result = properties->Flatten(buffer.data() + padding + sizeof(entry), propertiesSize)) != B_OK)
+        return result;
+
+    trailer.tailSize   += entrySize;
+    trailer.entryCount += 1;
+    memcpy(buffer.data() + padding + entrySize, &trailer, sizeof(trailer));
+
+    ssize_t written = node->WriteAttr(attrName, SEN_RELATION_RECORD_TYPE, position, buffer.data(), buffer.size());
+    if (written < 0)
+        return written;
+    if (written != (ssize_t)buffer.size())
+        return B_ERROR;
+
+    if (tailSize != NULL)
+        *tailSize = trailer.tailSize;
+    if (baseSize != NULL)
+        *baseSize = base;
+
+    return B_OK;
+}
+
+status_t RelationRecord::Compact(BNode* node, const char* attrName)
+{
+    attr_info attrInfo;
+    status_t result = node->GetAttrInfo(attrName, &attrInfo);
+    if (result != B_OK)
+        return result;
+    if (attrInfo.type != SEN_RELATION_RECORD_TYPE)
+        return B_BAD_TYPE;
+
+    // uint64 buffer for the aligned record view
+    std::vector<uint64> buffer((attrInfo.size + sizeof(uint64) - 1) / sizeof(uint64));
+    ssize_t size = node->ReadAttr(attrName, SEN_RELATION_RECORD_TYPE, 0, buffer.data(), attrInfo.size);
+    if (size < 0)
+        return size;
+
+    RelationRecordView view;
+    if ((result = view.SetTo(buffer.data(), size)) != B_OK)
+        return result;
+
+    if (view.CountAppended() == 0)
+        return B_OK;
+
+    BMessage relations;
+    if ((result = view.ToMessage(&relations)) != B_OK)
+        return result;
+
+    std::vector<char> record;
+    if ((result = Flatten(&relations, &record)) != B_OK)
+        return result;
+
+    // writing at 0 truncates the attribute
+    ssize_t written = node->WriteAttr(attrName, SEN_RELATION_RECORD_TYPE, 0, record.data(), record.size());
+    if (written < 0)
+        return written;
+
+    return written == (ssize_t)record.size() ? B_OK : B_ERROR;
+}
+
+bool RelationRecord::NeedsCompaction(size_t tailSize, size_t baseSize)
+{
+    return tailSize >= SEN_RELATION_COMPACT_MIN_TAIL && tailSize >= baseSize / 2;
+}
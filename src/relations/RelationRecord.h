@@ -0,0 +1,222 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#pragma once
+
+#include <Message.h>
+#include <Node.h>
+#include <StringList.h>
+#include <SupportDefs.h>
+
+#include <vector>
+
+// attribute type of relations in the compact format, relations in the legacy format are B_MESSAGE_TYPE
+#define SEN_RELATION_RECORD_TYPE    'SRrc'
+#define SEN_RELATION_RECORD_MAGIC   'SRrc'
+#define SEN_RELATION_RECORD_VERSION 1
+#define SEN_RELATION_TRAILER_MAGIC  'SRtl'
+
+// compact once the unsorted tail is at least this large and half the size of the sorted part
+#define SEN_RELATION_COMPACT_MIN_TAIL   4096
+
+enum relation_format {
+    SEN_RELATION_FORMAT_MESSAGE = 0,    // flattened BMessage (default, readable by all clients)
+    SEN_RELATION_FORMAT_RECORD          // compact record, see RelationRecord
+};
+
+/**
+ * on-attribute layout, all in host byte order like flattened messages:
+ *
+ *   header
+ *   target table      targetCount entries sorted by target ID
+ *   offset table      propertyCount + 1 offsets of the property blobs, relative to the first blob
+ *   property blobs    flattened property messages, grouped by target in table order
+ *
+ * followed by an optional tail of relations appended since the last compaction:
+ *
+ *   entries           at the next 8 byte boundary, each an entry header and the flattened
+ *                     properties, padded to 8 bytes
+ *   trailer           locates the tail, so appending only needs to read and rewrite the trailer
+ */
+struct relation_record_header {
+    uint32  magic;
+    uint16  version;
+    uint16  headerSize;         // for adding fields in later versions
+    uint32  targetCount;
+    uint32  propertyCount;
+    uint32  blobSize;
+    uint32  reserved;           // keeps the target table 8 byte aligned
+};
+
+struct relation_record_target {
+    uint64  id;
+    uint32  firstProperty;
+    uint32  propertyCount;
+};
+
+struct relation_record_entry {
+    uint64  id;
+    uint32  size;               // of the flattened properties, without padding
+    uint32  reserved;
+};
+
+struct relation_record_trailer {
+    uint64  baseSize;           // size of the sorted part, before padding
+    uint64  tailSize;           // size of all entries including padding
+    uint32  entryCount;
+    uint32  magic;
+};
+
+/**
+ * read-only view of a relation record in the compact format, directly on the read buffer.
+ * Target IDs are enumerated and looked up without copying, properties of a single relation
+ * are only unflattened on request. The buffer must stay valid and 8 byte aligned while in use.
+ */
+class RelationRecordView {
+
+public:
+                    RelationRecordView();
+
+    /**
+     * check the header, all table bounds and the tail of `data`.
+     *
+     * @return B_OK or B_BAD_DATA if this is no valid record.
+     */
+    status_t        SetTo(const void* data, size_t size);
+
+    /**
+     * number of targets in the sorted part, appended relations are counted separately.
+     */
+    int32           CountTargets() const;
+    uint64          TargetAt(int32 index) const;
+    /**
+     * binary search for the table index of `id`, -1 if not found.
+     */
+    int32           FindTarget(uint64 id) const;
+
+    int32           CountProperties(int32 targetIndex) const;
+    /**
+     * unflatten the `propertyIndex`th property message of the target at `targetIndex`.
+     */
+    status_t        GetProperties(int32 targetIndex, int32 propertyIndex, BMessage* properties) const;
+
+    /**
+     * relations appended after the sorted part, oldest first.
+     */
+    int32           CountAppended() const;
+    uint64          AppendedTargetAt(int32 index) const;
+    status_t        GetAppendedProperties(int32 index, BMessage* properties) const;
+
+    size_t          BaseSize() const;
+    size_t          TailSize() const;
+
+    /**
+     * add all target IDs including appended ones as decimal strings, like the names
+     * of the legacy relation message.
+     */
+    void            GetTargetIds(BStringList* ids) const;
+    /**
+     * convert to the legacy format, a message keyed by target ID with one property message
+     * per relation to that target.
+     */
+    status_t        ToMessage(BMessage* relations) const;
+
+private:
+    const relation_record_header*   fHeader;
+    const relation_record_target*   fTargets;
+    const uint32*                   fOffsets;
+    const char*                     fBlobs;
+    size_t                          fBaseSize;
+    size_t                          fTailSize;
+    std::vector<const relation_record_entry*> fAppended;
+};
+
+/**
+ * all relations of one type as read from their attribute, in either format.
+ * A record stays in the read buffer and is queried through RelationRecordView, so duplicate
+ * checks and target IDs need no conversion; ToMessage() builds the legacy message on demand.
+ */
+class RelationSnapshot {
+
+public:
+                    RelationSnapshot();
+
+    /**
+     * read the relation attribute, a missing or empty attribute gives an empty snapshot.
+     *
+     * @return B_OK or the error from reading or checking the attribute.
+     */
+    status_t        Read(const BNode* node, const char* attrName);
+    /**
+     * switch to relations in the legacy format and return the message to fill in,
+     * e.g. from the relation cache.
+     */
+    BMessage*       UseMessage();
+
+    bool            IsRecord() const;
+    bool            IsEmpty() const;
+
+    /**
+     * look up a relation to `targetId` with the same properties as `properties`.
+     *
+     * @return B_OK if found, B_NAME_NOT_FOUND if not, or the error from reading the properties.
+     */
+    status_t        FindProperties(const char* targetId, const BMessage* properties) const;
+    /**
+     * number of relations to `targetId`, including appended ones.
+     */
+    int32           CountProperties(const char* targetId) const;
+    void            GetTargetIds(BStringList* ids) const;
+    /**
+     * add all relations to `relations` in the legacy format.
+     */
+    status_t        ToMessage(BMessage* relations) const;
+
+private:
+                    RelationSnapshot(const RelationSnapshot&);     // the view points into fBuffer
+    RelationSnapshot& operator=(const RelationSnapshot&);
+
+    std::vector<uint64>     fBuffer;
+    RelationRecordView      fRecord;
+    BMessage                fMessage;
+    bool                    fIsRecord;
+};
+
+class RelationRecord {
+
+public:
+    static void             SetFormat(relation_format format);
+    static relation_format  Format();
+
+    /**
+     * encode a relation message in the legacy format into a compact record.
+     *
+     * @return B_OK, or B_BAD_VALUE if a field is no numeric target ID with property messages,
+     *         such relations can only be stored as message.
+     */
+    static status_t         Flatten(const BMessage* relations, std::vector<char>* record);
+
+    /**
+     * add one relation to a record attribute by rewriting only its trailer, creating the
+     * attribute if needed. The caller must hold the node lock.
+     *
+     * @param tailSize  optionally receives the size of the tail after appending
+     * @param baseSize  optionally receives the size of the sorted part
+     * @return B_OK, B_BAD_TYPE if the attribute is in message format, B_BAD_VALUE if `targetId`
+     *         is no numeric ID or B_BAD_DATA for a corrupt record.
+     */
+    static status_t         Append(BNode* node, const char* attrName, const char* targetId,
+                                const BMessage* properties, size_t* tailSize = NULL,
+                                size_t* baseSize = NULL);
+    /**
+     * merge the tail of a record attribute into its sorted part. The caller must hold the node lock.
+     */
+    static status_t         Compact(BNode* node, const char* attrName);
+    static bool             NeedsCompaction(size_t tailSize, size_t baseSize);
+
+private:
+    static int32            sFormat;
+};
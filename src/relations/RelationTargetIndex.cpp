@@ -0,0 +1,313 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#include <Autolock.h>
+#include <dirent.h>
+#include <NodeMonitor.h>
+#include <VolumeRoster.h>
+#include <Volume.h>
+
+#include "RelationTargetIndex.h"
+#include "SenId.h"
+#include <sen/Sen.h>
+
+RelationTargetIndex::RelationTargetIndex()
+    : fLock("RelationTargetIndex"),
+      fBuildThread(-1),
+      fReady(false)
+{
+}
+
+RelationTargetIndex::~RelationTargetIndex()
+{
+    if (fBuildThread >= 0) {
+        status_t exitValue;
+        wait_for_thread(fBuildThread, &exitValue);
+    }
+    fLiveQuery.Clear();
+}
+
+status_t RelationTargetIndex::Init(const BMessenger& target)
+{
+    // TODO: all relation queries currently assume we never leave the boot volume
+    BVolumeRoster volRoster;
+    BVolume bootVolume;
+    volRoster.GetBootVolume(&bootVolume);
+
+    fLiveQuery.SetVolume(&bootVolume);
+    fLiveQuery.SetPredicate(SEN_TO_ATTR "==\"*\"");
+
+    status_t result = fLiveQuery.SetTarget(target);
+    if (result != B_OK) {
+        ERROR("failed to set up live query for relation target index: %s\n", strerror(result));
+        return result;
+    }
+
+    fBuildThread = spawn_thread(_BuildThread, "sen target index", B_LOW_PRIORITY, this);
+    if (fBuildThread < 0) {
+        ERROR("failed to spawn relation target index thread: %s\n", strerror(fBuildThread));
+        return fBuildThread;
+    }
+
+    return resume_thread(fBuildThread);
+}
+
+bool RelationTargetIndex::IsReady()
+{
+    BAutolock _(fLock);
+    return fReady;
+}
+
+status_t RelationTargetIndex::GetSources(const char* targetId, BStringList* sourceIds)
+{
+    BAutolock _(fLock);
+
+    if (! fReady)
+        return B_NOT_INITIALIZED;
+
+    auto it = fTargetToSources.find(targetId);
+    if (it == fTargetToSources.end())
+        return B_OK;
+
+    for (const std::string& sourceId : it->second) {
+        sourceIds->Add(sourceId.c_str());
+    }
+
+    return B_OK;
+}
+
+void RelationTargetIndex::AddTarget(const char* sourceId, const node_ref* sourceNode, const char* targetId)
+{
+    BAutolock _(fLock);
+
+    fTargetToSources[targetId].insert(sourceId);
+    fSourceToTargets[sourceId].insert(targetId);
+
+    if (sourceNode != NULL) {
+        fNodeToSource[*sourceNode] = sourceId;
+        fSourceToNode.emplace(sourceId, *sourceNode);
+    }
+}
+
+void RelationTargetIndex::RemoveTarget(const char* sourceId, const char* targetId)
+{
+    BAutolock _(fLock);
+
+    auto sources = fTargetToSources.find(targetId);
+    if (sources != fTargetToSources.end()) {
+        sources->second.erase(sourceId);
+        if (sources->second.empty())
+            fTargetToSources.erase(sources);
+    }
+
+    auto targets = fSourceToTargets.find(sourceId);
+    if (targets != fSourceToTargets.end()) {
+        targets->second.erase(targetId);
+        if (targets->second.empty())
+            fSourceToTargets.erase(targets);
+    }
+}
+
+void RelationTargetIndex::RemoveSource(const char* sourceId)
+{
+    BAutolock _(fLock);
+    _RemoveSourceLocked(sourceId);
+    fSourceToNode.erase(sourceId);
+}
+
+void RelationTargetIndex::RemoveNode(const node_ref* sourceNode)
+{
+    BAutolock _(fLock);
+
+    auto it = fNodeToSource.find(*sourceNode);
+    if (it == fNodeToSource.end())
+        return;
+
+    // only drop the targets if the ID still belongs to this node and not to the original of a copy
+    if (_IsOwnerLocked(it->second, sourceNode)) {
+        _RemoveSourceLocked(it->second);
+        fSourceToNode.erase(it->second);
+    }
+    fNodeToSource.erase(it);
+}
+
+void RelationTargetIndex::HandleQueryUpdate(const BMessage* message)
+{
+    int32 opcode;
+    int32 device;
+    ino_t directory, node;
+    const char* name;
+
+    if (message->FindInt32("opcode", &opcode) != B_OK
+        || message->FindInt32("device", &device) != B_OK
+        || message->FindInt64("directory", &directory) != B_OK
+        || message->FindInt64("node", &node) != B_OK
+        || message->FindString("name", &name) != B_OK) {
+        return;
+    }
+
+    entry_ref ref(device, directory, name);
+    node_ref  nodeRef(device, node);
+    BString   sourceId;
+    BStringList targetIds;
+
+    switch (opcode) {
+        case B_ENTRY_CREATED:
+        {
+            if (_ReadNode(&ref, &sourceId, &targetIds) == B_OK) {
+                _SetTargets(sourceId.String(), &nodeRef, targetIds);
+            }
+            break;
+        }
+        case B_ENTRY_REMOVED:
+        {
+            // updates of other live queries arrive here as well, only drop nodes really without SEN:TO
+            if (_ReadNode(&ref, &sourceId, &targetIds) != B_OK) {
+                RemoveNode(&nodeRef);
+            }
+            break;
+        }
+    }
+}
+
+void RelationTargetIndex::HandleNodeMonitor(const BMessage* message)
+{
+    int32 opcode;
+    int32 device;
+    ino_t node;
+
+    if (message->FindInt32("opcode", &opcode) != B_OK
+        || message->FindInt32("device", &device) != B_OK
+        || message->FindInt64("node", &node) != B_OK) {
+        return;
+    }
+
+    if (opcode == B_ENTRY_REMOVED) {
+        node_ref nodeRef(device, node);
+        RemoveNode(&nodeRef);
+    }
+}
+
+void RelationTargetIndex::ParseTargetIds(const BString& targetIdsAttr, BStringList* targetIds)
+{
+    targetIdsAttr.Split(",", true, *targetIds);
+}
+
+/*
+ * private methods
+ */
+
+status_t RelationTargetIndex::_BuildThread(void* data)
+{
+    return static_cast<RelationTargetIndex*>(data)->_Build();
+}
+
+status_t RelationTargetIndex::_Build()
+{
+    LOG("building relation target index...\n");
+    bigtime_t start = system_time();
+
+    status_t result = fLiveQuery.Fetch();
+    if (result != B_OK) {
+        ERROR("could not execute query for relation target index: %s\n", strerror(result));
+        return result;
+    }
+
+    char buffer[4096];
+    struct dirent* dirents = reinterpret_cast<struct dirent*>(buffer);
+    int32 count;
+    int32 sourceCount = 0;
+
+    while ((count = fLiveQuery.GetNextDirents(dirents, sizeof(buffer))) > 0) {
+        struct dirent* dent = dirents;
+
+        for (int32 i = 0; i < count; i++) {
+            entry_ref ref(dent->d_pdev, dent->d_pino, dent->d_name);
+            node_ref  nodeRef(dent->d_dev, dent->d_ino);
+            BString   sourceId;
+            BStringList targetIds;
+
+            if (_ReadNode(&ref, &sourceId, &targetIds) == B_OK) {
+                _SetTargets(sourceId.String(), &nodeRef, targetIds);
+                sourceCount++;
+            }
+            dent = reinterpret_cast<struct dirent*>(reinterpret_cast<char*>(dent) + dent->d_reclen);
+        }
+    }
+
+    BAutolock _(fLock);
+    fReady = true;
+
+    LOG("relation target index ready with %d sources and %zu targets after %" B_PRId64 "ms.\n",
+        sourceCount, fTargetToSources.size(), (system_time() - start) / 1000);
+
+    return B_OK;
+}
+
+status_t RelationTargetIndex::_ReadNode(const entry_ref* ref, BString* sourceId, BStringList* targetIds)
+{
+    BNode node(ref);
+    status_t result = node.InitCheck();
+
+    if (result == B_OK)
+        result = SenId::Read(&node, sourceId);
+
+    BString targetIdsAttr;
+    if (result == B_OK)
+        result = node.ReadAttrString(SEN_TO_ATTR, &targetIdsAttr);
+
+    if (result == B_OK)
+        ParseTargetIds(targetIdsAttr, targetIds);
+
+    return result;
+}
+
+void RelationTargetIndex::_SetTargets(const char* sourceId, const node_ref* sourceNode,
+                                      const BStringList& targetIds)
+{
+    BAutolock _(fLock);
+
+    fNodeToSource[*sourceNode] = sourceId;
+
+    // keep the original, copies are cleaned up by the server
+    if (! _IsOwnerLocked(sourceId, sourceNode)) {
+        LOG("source ID %s already indexed for another node, keeping original.\n", sourceId);
+        return;
+    }
+
+    // replace any previously known targets of this source
+    _RemoveSourceLocked(sourceId);
+
+    for (int32 i = 0; i < targetIds.CountStrings(); i++) {
+        BString targetId = targetIds.StringAt(i);
+        fTargetToSources[targetId.String()].insert(sourceId);
+        fSourceToTargets[sourceId].insert(targetId.String());
+    }
+    fSourceToNode[sourceId] = *sourceNode;
+}
+
+void RelationTargetIndex::_RemoveSourceLocked(const std::string& sourceId)
+{
+    auto targets = fSourceToTargets.find(sourceId);
+    if (targets == fSourceToTargets.end())
+        return;
+
+    for (const std::string& targetId : targets->second) {
+        auto sources = fTargetToSources.find(targetId);
+        if (sources != fTargetToSources.end()) {
+            sources->second.erase(sourceId);
+            if (sources->second.empty())
+                fTargetToSources.erase(sources);
+        }
+    }
+    fSourceToTargets.erase(targets);
+}
+
+bool RelationTargetIndex::_IsOwnerLocked(const std::string& sourceId, const node_ref* sourceNode)
+{
+    auto owner = fSourceToNode.find(sourceId);
+    return owner == fSourceToNode.end() || owner->second == *sourceNode;
+}
@@ -0,0 +1,80 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#pragma once
+
+#include <Entry.h>
+#include <Locker.h>
+#include <Message.h>
+#include <Messenger.h>
+#include <Node.h>
+#include <Query.h>
+#include <String.h>
+#include <StringList.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+
+/**
+ * reverse adjacency index mapping a relation target ID to the IDs of all sources
+ * listing it in their SEN:TO attribute.
+ *
+ * This replaces the `SEN:TO == '*<id>*'` substring query for inverse relations, which
+ * cannot use the attribute index and may also match IDs merely containing the source ID.
+ * Populated from a live query for all nodes with SEN:TO, then kept current by the
+ * server's own relation writes and query/node monitor updates for removed entries.
+ */
+class RelationTargetIndex {
+
+public:
+                RelationTargetIndex();
+                ~RelationTargetIndex();
+
+    status_t    Init(const BMessenger& target);
+    bool        IsReady();
+
+    /**
+     * get the IDs of all sources pointing to targetId.
+     *
+     * @return B_OK (possibly with an empty list), or B_NOT_INITIALIZED while still building.
+     */
+    status_t    GetSources(const char* targetId, BStringList* sourceIds);
+
+    void        AddTarget(const char* sourceId, const node_ref* sourceNode, const char* targetId);
+    void        RemoveTarget(const char* sourceId, const char* targetId);
+    void        RemoveSource(const char* sourceId);
+    void        RemoveNode(const node_ref* sourceNode);
+
+    void        HandleQueryUpdate(const BMessage* message);
+    void        HandleNodeMonitor(const BMessage* message);
+
+    /**
+     * split a SEN:TO attribute value into its exact target IDs.
+     */
+    static void ParseTargetIds(const BString& targetIdsAttr, BStringList* targetIds);
+
+private:
+    static status_t _BuildThread(void* data);
+    status_t        _Build();
+    status_t        _ReadNode(const entry_ref* ref, BString* sourceId, BStringList* targetIds);
+    void            _SetTargets(const char* sourceId, const node_ref* sourceNode,
+                                const BStringList& targetIds);
+    void            _RemoveSourceLocked(const std::string& sourceId);
+    bool            _IsOwnerLocked(const std::string& sourceId, const node_ref* sourceNode);
+
+    BLocker                                                 fLock;
+    BQuery                                                  fLiveQuery;
+    thread_id                                               fBuildThread;
+    bool                                                    fReady;
+
+    std::unordered_map<std::string, std::set<std::string> > fTargetToSources;
+    std::unordered_map<std::string, std::set<std::string> > fSourceToTargets;
+    std::map<node_ref, std::string>                         fNodeToSource;
+    // node owning each source ID, copies carrying the same ID until the server strips them don't
+    std::unordered_map<std::string, node_ref>               fSourceToNode;
+};
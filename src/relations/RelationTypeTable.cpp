@@ -0,0 +1,86 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#include "RelationTypeTable.h"
+#include <sen/Sen.h>
+
+const relation_type_info* RelationTypeTable::Find(const char* relationType) const
+{
+    // MIME types are case insensitive and stored in lower case in the MIME DB
+    BString key(relationType);
+    key.ToLower();
+
+    auto it = fTypeIds.find(key.String());
+    if (it == fTypeIds.end())
+        return NULL;
+
+    return &fTypes[it->second];
+}
+
+const relation_type_info* RelationTypeTable::At(int32 id) const
+{
+    if (id < 0 || id >= (int32)fTypes.size() || fTypes[id].id < 0)
+        return NULL;
+
+    return &fTypes[id];
+}
+
+int32 RelationTypeTable::CountTypes() const
+{
+    return fTypeIds.size();
+}
+
+void RelationTypeTable::MergeConfig(BMessage* base, const BMessage* overlay)
+{
+    char*       name;
+    type_code   type;
+    int32       count;
+
+    for (int32 i = 0; overlay->GetInfo(B_ANY_TYPE, i, &name, &type, &count) == B_OK; i++) {
+        bool fixedSize = true;
+        overlay->GetInfo(name, &type, &count, &fixedSize);
+
+        base->RemoveName(name);
+
+        for (int32 j = 0; j < count; j++) {
+            const void* data;
+            ssize_t     size;
+
+            if (overlay->FindData(name, type, j, &data, &size) == B_OK) {
+                base->AddData(name, type, data, size, fixedSize);
+            }
+        }
+    }
+}
+
+/*
+ * private methods
+ */
+
+void RelationTypeTable::Add(int32 id, const char* relationType, const BMessage* config)
+{
+    if (id >= (int32)fTypes.size()) {
+        relation_type_info empty;
+        empty.id    = -1;
+        empty.flags = 0;
+        fTypes.resize(id + 1, empty);
+    }
+
+    relation_type_info& info = fTypes[id];
+    info.id     = id;
+    info.type   = relationType;
+    info.config = *config;
+    info.flags  = 0;
+
+    if (config->GetBool(SEN_RELATION_IS_BIDIR, true))
+        info.flags |= SEN_RELATION_FLAG_BIDIR;
+    if (config->GetBool(SEN_RELATION_IS_DYNAMIC, false))
+        info.flags |= SEN_RELATION_FLAG_DYNAMIC;
+    if (config->GetBool(SEN_RELATION_IS_SELF, false))
+        info.flags |= SEN_RELATION_FLAG_SELF;
+
+    fTypeIds[relationType] = id;
+}
@@ -0,0 +1,58 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#pragma once
+
+#include <Message.h>
+#include <String.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum relation_type_flags {
+    SEN_RELATION_FLAG_BIDIR     = 1 << 0,
+    SEN_RELATION_FLAG_DYNAMIC   = 1 << 1,
+    SEN_RELATION_FLAG_SELF      = 1 << 2
+};
+
+/**
+ * a relation type with its config fully resolved, i.e. built-in defaults overridden
+ * by the relation supertype config overridden by the type's own config.
+ */
+struct relation_type_info {
+    int32       id;         // small integer ID, stable for the lifetime of the server
+    BString     type;       // full MIME type in lower case
+    uint32      flags;      // relation_type_flags
+    BMessage    config;     // merged config as sent to clients
+};
+
+/**
+ * immutable table of all known relation types, built by the RelationConfigRegistry
+ * whenever a relation type changes and shared with readers, so lookups need no locking
+ * and no BMessage merging.
+ */
+class RelationTypeTable {
+
+public:
+    const relation_type_info*   Find(const char* relationType) const;
+    const relation_type_info*   At(int32 id) const;
+    int32                       CountTypes() const;
+
+    /**
+     * merge `overlay` into `base`, replacing fields with the same name instead of
+     * appending values like BMessage::Append().
+     */
+    static void                 MergeConfig(BMessage* base, const BMessage* overlay);
+
+private:
+    friend class RelationConfigRegistry;
+
+    void                        Add(int32 id, const char* relationType, const BMessage* config);
+
+    std::vector<relation_type_info>         fTypes;     // indexed by id, id -1 for removed types
+    std::unordered_map<std::string, int32>  fTypeIds;
+};
@@ -0,0 +1,137 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#include <Autolock.h>
+#include <Entry.h>
+#include <StringList.h>
+
+#include "RequestCoalescer.h"
+#include <sen/Sen.h>
+
+RequestCoalescer::inflight_request::inflight_request()
+    : done(create_sem(0, "sen coalesced request")),
+      leader(find_thread(NULL)),
+      waiters(0)
+{
+}
+
+RequestCoalescer::inflight_request::~inflight_request()
+{
+    if (done >= 0)
+        delete_sem(done);
+}
+
+RequestCoalescer::RequestCoalescer()
+    : fLock("RequestCoalescer"),
+      fCoalesced(0)
+{
+}
+
+bool RequestCoalescer::MakeKey(const BMessage* request, BString* key)
+{
+    switch (request->what) {
+        case SEN_RELATIONS_GET:
+        case SEN_RELATIONS_GET_ALL:
+        case SEN_RELATIONS_GET_SELF:
+        case SEN_RELATIONS_GET_ALL_SELF:
+            break;
+        default:
+            return false;
+    }
+
+    key->SetToFormat("%" B_PRIu32 "|", request->what);
+
+    entry_ref ref;
+    const char* path;
+
+    if (request->FindRef(SEN_RELATION_SOURCE_REF, &ref) == B_OK && ref.name != NULL) {
+        *key << ref.device << ":" << ref.directory << ":" << ref.name;
+    } else if (request->FindString(SEN_RELATION_SOURCE_REF, &path) == B_OK) {
+        *key << path;
+    } else {
+        return false;   // let the handler report the missing parameter
+    }
+
+    *key << "|" << request->GetString(SEN_RELATION_TYPE, "");
+
+    // flags in a stable order, clients may add them in any order
+    BStringList flags;
+    char*       name;
+    type_code   type;
+
+    for (int32 i = 0; request->GetInfo(B_BOOL_TYPE, i, &name, &type) == B_OK; i++) {
+        BString flag(name);
+        flag << "=" << request->GetBool(name);
+        flags.Add(flag);
+    }
+    flags.Sort();
+
+    *key << "|" << flags.Join(",");
+    return true;
+}
+
+bool RequestCoalescer::Join(const BString& key, BMessage* reply)
+{
+    std::shared_ptr<inflight_request> request;
+    {
+        BAutolock _(fLock);
+
+        auto it = fInFlight.find(key.String());
+        if (it == fInFlight.end()) {
+            // lead, unless we cannot notify followers
+            std::shared_ptr<inflight_request> leader = std::make_shared<inflight_request>();
+            if (leader->done >= 0)
+                fInFlight[key.String()] = leader;
+            return false;
+        }
+
+        request = it->second;
+        request->waiters++;
+        fCoalesced++;
+    }
+
+    status_t result;
+    do {
+        result = acquire_sem(request->done);
+    } while (result == B_INTERRUPTED);
+
+    if (result != B_OK) {
+        ERROR("failed to wait for coalesced request, processing it again: %s\n", strerror(result));
+        return false;
+    }
+
+    *reply = request->reply;
+    return true;
+}
+
+void RequestCoalescer::Finish(const BString& key, const BMessage* reply)
+{
+    std::shared_ptr<inflight_request> request;
+    int32 waiters;
+    {
+        BAutolock _(fLock);
+
+        auto it = fInFlight.find(key.String());
+        // only the leading thread completes a request, followers that had to process it themselves do not
+        if (it == fInFlight.end() || it->second->leader != find_thread(NULL))
+            return;
+
+        request = it->second;
+        request->reply = *reply;
+        waiters = request->waiters;
+
+        fInFlight.erase(it);
+    }
+
+    if (waiters > 0)
+        release_sem_etc(request->done, waiters, 0);
+}
+
+int64 RequestCoalescer::CountCoalesced()
+{
+    BAutolock _(fLock);
+    return fCoalesced;
+}
@@ -0,0 +1,68 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#pragma once
+
+#include <Locker.h>
+#include <Message.h>
+#include <OS.h>
+#include <String.h>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+/**
+ * coalesces identical read requests in flight, e.g. several Tracker windows and add-ons
+ * asking for the relations of the same selection within milliseconds.
+ *
+ * The first request for a key leads and is processed normally, identical requests
+ * arriving meanwhile wait for it and get a copy of its reply instead of repeating all
+ * attribute reads and queries. A write finishing while the leader runs may thus not be
+ * seen by its followers, just as if they had arrived a moment earlier.
+ */
+class RequestCoalescer {
+
+public:
+                RequestCoalescer();
+
+    /**
+     * build the key identifying `request` from its what, source ref, relation type and
+     * flags.
+     *
+     * @return false if the request cannot be coalesced.
+     */
+    static bool MakeKey(const BMessage* request, BString* key);
+
+    /**
+     * attach to an identical request in flight and wait for its reply.
+     *
+     * @return true if `reply` holds the reply of the leading request, false if the caller
+     *         needs to process the request itself and then call Finish().
+     */
+    bool        Join(const BString& key, BMessage* reply);
+    /**
+     * hand the reply of a leading request to all requests attached meanwhile.
+     */
+    void        Finish(const BString& key, const BMessage* reply);
+
+    int64       CountCoalesced();
+
+private:
+    struct inflight_request {
+                    inflight_request();
+                    ~inflight_request();
+
+        sem_id      done;
+        thread_id   leader;
+        int32       waiters;
+        BMessage    reply;
+    };
+
+    BLocker                                                             fLock;
+    std::unordered_map<std::string, std::shared_ptr<inflight_request>> fInFlight;
+    int64                                                               fCoalesced;
+};
@@ -18,6 +18,9 @@
 #include <Volume.h>
 
 #include "RelationHandler.h"
+#include "../server/Metrics.h"
+#include "../server/RequestTrace.h"
+#include "../server/Tracer.h"
 #include <sen/Sen.h>
 #include <sen/Sensei.h>
 
@@ -40,8 +43,8 @@ status_t RelationHandler::GetSelfRelations(const BMessage* message, BMessage* re
         return status;
     }
 
-    LOG("got types/plugins config for source type %s:\n", sourceType);
-    pluginConfig.PrintToStream();
+    LOG("got types/plugins config for source type %s.\n", sourceType);
+    TRACE_MSG(SEN_TRACE_LEVEL_DEBUG, "plugin types", &pluginConfig);
 
     reply->what = SENSEI_MESSAGE_RESULT;
     reply->AddMessage(SENSEI_PLUGIN_CONFIG_KEY, new BMessage(pluginConfig));
@@ -149,8 +152,7 @@ status_t RelationHandler::GetSelfRelationsOfType (const BMessage* message, BMess
         clientHasConfig = true;
     }
 
-    LOG(("* got plugin config:\n"));
-    pluginConfig.PrintToStream();
+    TRACE_MSG(SEN_TRACE_LEVEL_DEBUG, "plugin config", &pluginConfig);
     // TODO: merge optional relation config provided in plugin config into MIME relation config
 
     // client may send the desired plugin signature already, saving us the hassle
@@ -205,7 +207,10 @@ status_t RelationHandler::ResolveSelfRelationsWithPlugin(
     LOG("got plugin app signature: %s\n", pluginSig);
 
     // execute plugin and return result
+    bigtime_t start = system_time();
     status_t result = be_roster->Launch(pluginSig);
+    Metrics::RecordTiming(SEN_METRICS_PLUGIN_LAUNCH, system_time() - start);
+
     if (result != B_OK) {
         ERROR("failed to launch plugin %s: %s\n", pluginSig, strerror(result));
         return result;
@@ -223,18 +228,20 @@ status_t RelationHandler::ResolveSelfRelationsWithPlugin(
     BMessage refsMsg(B_REFS_RECEIVED);
     refsMsg.AddRef("refs", sourceRef);
 
-    LOG("Sending refs to plugin %s:\n", pluginSig);
-    refsMsg.PrintToStream();
+    LOG("Sending refs to plugin %s.\n", pluginSig);
+    TRACE_MSG(SEN_TRACE_LEVEL_INFO, "plugin request", &refsMsg);
 
     BMessenger pluginMessenger(pluginSig);
     BMessage   pluginReply;
 
+    start  = system_time();
     result = pluginMessenger.SendMessage(&refsMsg, &pluginReply);
+    Metrics::RecordTiming(SEN_METRICS_PLUGIN_CALL, system_time() - start);
 
     // check result from communication
     if (result != B_OK) {
         ERROR("failed to communicate with plugin %s: %s\n", pluginSig, strerror(result));
-        pluginReply.PrintToStream();
+        TRACE_MSG(SEN_TRACE_LEVEL_ERROR, "plugin reply", &pluginReply);
         return result;
     }
 
@@ -242,7 +249,7 @@ status_t RelationHandler::ResolveSelfRelationsWithPlugin(
     result = pluginReply.GetInt32("result", B_OK);
     if (result != B_OK) {
         ERROR("error in plugin execution: %s\n", strerror(result));
-        pluginReply.PrintToStream();
+        TRACE_MSG(SEN_TRACE_LEVEL_ERROR, "plugin reply", &pluginReply);
         return result;
     }
 
@@ -282,8 +289,8 @@ status_t RelationHandler::ResolveSelfRelationsWithPlugin(
         result = TransformPluginResult(&rootNode, &typeMapping, &attrMapping, &pluginReplyTransformed);
 
     if (result != B_OK) {
-        ERROR("could not transform plugin result: %s\nResult so far:\n", strerror(result));
-        pluginReplyTransformed.PrintToStream();
+        ERROR("could not transform plugin result: %s\n", strerror(result));
+        TRACE_MSG(SEN_TRACE_LEVEL_ERROR, "transformed plugin reply", &pluginReplyTransformed);
         return result;
     }
 
@@ -405,7 +412,10 @@ status_t RelationHandler::TransformPluginResult(
 
             if (itemId == NULL || strlen(itemId) == 0) {
                 propertiesMsg.RemoveName(SENSEI_ITEM_ID);
-                status = propertiesMsg.AddString(SEN_RELATION_ITEM_ID, GenerateId() );
+
+                char newItemId[SEN_ID_LEN];
+                GenerateId(newItemId);
+                status = propertiesMsg.AddString(SEN_RELATION_ITEM_ID, newItemId);
             }
 
             if (nestedProperties > 0 && flatProperties == 0) {
@@ -435,6 +445,8 @@ status_t RelationHandler::GetPluginsForTypeAndFeature(
 	BVolume bootVolume;
 	volRoster.GetBootVolume(&bootVolume);
 
+	MetricsTimer queryTimer(SEN_METRICS_QUERY);
+	RequestTrace::CountQuery();
 	BQuery query;
 	query.SetVolume(&bootVolume);
 	query.SetPredicate(predicate.String());
@@ -498,8 +510,7 @@ status_t RelationHandler::GetPluginsForTypeAndFeature(
             return B_OK;
         } else {
             LOG("found %u suitable plugins.\n", pluginCount);
-            LOG("plugin output map is:\n");
-            pluginConfig->PrintToStream();
+            TRACE_MSG(SEN_TRACE_LEVEL_DEBUG, "plugin output map", pluginConfig);
         }
     } else {
         // something else went wrong
@@ -0,0 +1,288 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#include <errno.h>
+#include <fs_attr.h>
+#include <fs_index.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include <Entry.h>
+#include <Query.h>
+#include <VolumeRoster.h>
+#include <Volume.h>
+
+#include "SenId.h"
+#include <sen/Sen.h>
+
+int32 SenId::sFormat   = SEN_ID_FORMAT_STRING;
+int32 SenId::sMigrated = 0;
+
+void SenId::SetFormat(sen_id_format format)
+{
+    atomic_set(&sFormat, format);
+}
+
+sen_id_format SenId::Format()
+{
+    return static_cast<sen_id_format>(atomic_get(&sFormat));
+}
+
+status_t SenId::Read(BNode* node, char* id)
+{
+    // make sure to always initialize ID so it is empty in case of error
+    *id = '\0';
+
+    // try the format in use first, nodes may carry the other one until migrated
+    bool binaryFirst = Format() == SEN_ID_FORMAT_BINARY;
+    status_t result = B_ENTRY_NOT_FOUND;
+
+    for (int32 attempt = 0; attempt < 2 && result == B_ENTRY_NOT_FOUND; attempt++) {
+        if (binaryFirst == (attempt == 0)) {
+            uint64  value;
+            ssize_t size = node->ReadAttr(SEN_TSID_ATTR, B_UINT64_TYPE, 0, &value, sizeof(value));
+
+            if (size == sizeof(value)) {
+                ToString(value, id);
+                result = B_OK;
+            } else if (size != B_ENTRY_NOT_FOUND) {
+                result = size < 0 ? size : B_BAD_DATA;
+                ERROR("invalid %s attribute: %s\n", SEN_TSID_ATTR, strerror(result));
+            }
+        } else {
+            BString idStr;
+            result = node->ReadAttrString(SEN_ID_ATTR, &idStr);
+            if (result == B_OK) {
+                strlcpy(id, idStr.String(), SEN_ID_LEN);
+            }
+        }
+    }
+
+    return result;
+}
+
+status_t SenId::Read(BNode* node, BString* id)
+{
+    char buffer[SEN_ID_LEN];
+    status_t result = Read(node, buffer);
+
+    if (result == B_OK)
+        id->SetTo(buffer);
+
+    return result;
+}
+
+status_t SenId::Write(BNode* node, uint64 id)
+{
+    if (Format() == SEN_ID_FORMAT_BINARY) {
+        ssize_t size = node->WriteAttr(SEN_TSID_ATTR, B_UINT64_TYPE, 0, &id, sizeof(id));
+        if (size != sizeof(id))
+            return size < 0 ? size : B_IO_ERROR;
+        // fall through, the string ID is always written for clients and tools reading SEN:ID
+    }
+
+    char buffer[SEN_ID_LEN];
+    ToString(id, buffer);
+
+    BString idStr(buffer);
+    return node->WriteAttrString(SEN_ID_ATTR, &idStr);
+}
+
+void SenId::ToString(uint64 id, char* buffer)
+{
+    snprintf(buffer, SEN_ID_LEN, "%" B_PRIu64, id);
+}
+
+status_t SenId::Parse(const char* id, uint64* value)
+{
+    if (id == NULL || *id == '\0')
+        return B_BAD_VALUE;
+
+    char* end;
+    errno = 0;
+    *value = strtoull(id, &end, 10);
+
+    if (errno != 0 || *end != '\0')
+        return B_BAD_VALUE;
+
+    return B_OK;
+}
+
+void SenId::GetPredicate(const char* id, BString* predicate)
+{
+    uint64 value;
+
+    if (Format() == SEN_ID_FORMAT_STRING || Parse(id, &value) != B_OK) {
+        *predicate << "(" SEN_ID_ATTR "==\"" << id << "\")";
+        return;
+    }
+
+    // integer equality on the numeric index, plus the string ID while still migrating
+    *predicate << "(" SEN_TSID_ATTR "==" << value << ")";
+    if (! IsMigrated()) {
+        predicate->Prepend("(");
+        *predicate << "||(" SEN_ID_ATTR "==\"" << id << "\"))";
+    }
+}
+
+const char* SenId::GetAnyIdPredicate()
+{
+    if (Format() == SEN_ID_FORMAT_BINARY)
+        return "(" SEN_TSID_ATTR ">0)||(" SEN_ID_ATTR "==\"*\")";
+
+    return SEN_ID_ATTR "==\"*\"";
+}
+
+status_t SenId::StartMigration()
+{
+    // the index must exist before any query uses SEN:TSID, e.g. the live query of the SEN:ID index,
+    // queries on an attribute without index fail
+    status_t result = _CreateIndex();
+    if (result != B_OK) {
+        ERROR("failed to create index for %s, falling back to string IDs: %s\n", SEN_TSID_ATTR, strerror(result));
+        SetFormat(SEN_ID_FORMAT_STRING);
+        return result;
+    }
+
+    thread_id migrationThread = spawn_thread(_Migrate, "sen id migration", B_LOW_PRIORITY, NULL);
+    if (migrationThread < 0) {
+        ERROR("failed to spawn SEN:ID migration thread: %s\n", strerror(migrationThread));
+        return migrationThread;
+    }
+
+    return resume_thread(migrationThread);
+}
+
+bool SenId::IsMigrated()
+{
+    return atomic_get(&sMigrated) != 0;
+}
+
+status_t SenId::_CreateIndex()
+{
+    // TODO: all relation queries currently assume we never leave the boot volume
+    BVolumeRoster volRoster;
+    BVolume bootVolume;
+
+    status_t result = volRoster.GetBootVolume(&bootVolume);
+    if (result != B_OK)
+        return result;
+
+    if (fs_create_index(bootVolume.Device(), SEN_TSID_ATTR, B_UINT64_TYPE, 0) != 0 && errno != B_FILE_EXISTS)
+        return errno;
+
+    return B_OK;
+}
+
+/**
+ * collect the refs matching `predicate` on `volume`, so the nodes can be written to while
+ * not iterating the index of the query.
+ */
+static status_t collect_refs(BVolume* volume, const char* predicate, std::vector<entry_ref>* refs)
+{
+    BQuery query;
+    query.SetVolume(volume);
+    query.SetPredicate(predicate);
+
+    status_t result = query.Fetch();
+    if (result != B_OK)
+        return result;
+
+    entry_ref ref;
+    while (query.GetNextRef(&ref) == B_OK) {
+        refs->push_back(ref);
+    }
+
+    return B_OK;
+}
+
+status_t SenId::_Migrate(void* data)
+{
+    // TODO: all relation queries currently assume we never leave the boot volume
+    BVolumeRoster volRoster;
+    BVolume bootVolume;
+    volRoster.GetBootVolume(&bootVolume);
+
+    LOG("migrating string IDs to %s...\n", SEN_TSID_ATTR);
+    bigtime_t start = system_time();
+
+    std::vector<entry_ref> refs;
+    status_t result = collect_refs(&bootVolume, SEN_ID_ATTR "==\"*\"", &refs);
+    if (result != B_OK) {
+        ERROR("could not execute query for SEN:ID migration: %s\n", strerror(result));
+        return result;
+    }
+
+    int32 migrated = 0, restored = 0, failed = 0;
+
+    for (const entry_ref& ref : refs) {
+        BNode node(&ref);
+        BString idStr;
+        uint64 id, existingId;
+
+        if (node.InitCheck() != B_OK || node.ReadAttrString(SEN_ID_ATTR, &idStr) != B_OK)
+            continue;
+
+        // already migrated on an earlier run
+        if (node.ReadAttr(SEN_TSID_ATTR, B_UINT64_TYPE, 0, &existingId, sizeof(existingId)) == sizeof(existingId))
+            continue;
+
+        if (Parse(idStr.String(), &id) != B_OK) {
+            ERROR("cannot migrate invalid SEN:ID '%s' of %s, skipping.\n", idStr.String(), ref.name);
+            failed++;
+            continue;
+        }
+
+        // the string ID stays for clients and tools still reading SEN:ID
+        ssize_t size = node.WriteAttr(SEN_TSID_ATTR, B_UINT64_TYPE, 0, &id, sizeof(id));
+        if (size != sizeof(id)) {
+            ERROR("failed to migrate SEN:ID of %s.\n", ref.name);
+            failed++;
+            continue;
+        }
+        migrated++;
+    }
+
+    // nodes migrated by earlier versions lost their string ID, restore it
+    refs.clear();
+    if ((result = collect_refs(&bootVolume, SEN_TSID_ATTR ">0", &refs)) != B_OK) {
+        ERROR("could not execute query for restoring SEN:ID: %s\n", strerror(result));
+        return result;
+    }
+
+    for (const entry_ref& ref : refs) {
+        BNode node(&ref);
+        attr_info attrInfo;
+        uint64 id;
+
+        if (node.InitCheck() != B_OK || node.GetAttrInfo(SEN_ID_ATTR, &attrInfo) == B_OK
+            || node.ReadAttr(SEN_TSID_ATTR, B_UINT64_TYPE, 0, &id, sizeof(id)) != sizeof(id)) {
+            continue;
+        }
+
+        char idStr[SEN_ID_LEN];
+        ToString(id, idStr);
+
+        BString idString(idStr);
+        if (node.WriteAttrString(SEN_ID_ATTR, &idString) != B_OK) {
+            ERROR("failed to restore SEN:ID of %s.\n", ref.name);
+            failed++;
+            continue;
+        }
+        restored++;
+    }
+
+    // only switch to pure numeric queries when every string ID has its numeric twin
+    if (failed == 0)
+        atomic_set(&sMigrated, 1);
+
+    LOG("migrated %d IDs and restored %d string IDs (%d failed) after %" B_PRId64 "ms.\n",
+        migrated, restored, failed, (system_time() - start) / 1000);
+
+    return failed == 0 ? B_OK : B_ERROR;
+}
@@ -0,0 +1,74 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#pragma once
+
+#include <Node.h>
+#include <String.h>
+#include <SupportDefs.h>
+
+// native 64 bit TSID attribute, indexed as B_UINT64_TYPE.
+// A separate name is needed since a BFS index can only hold one type per attribute name.
+#define SEN_TSID_ATTR       "SEN:TSID"
+
+enum sen_id_format {
+    SEN_ID_FORMAT_STRING = 0,   // decimal string in SEN:ID (default, compatible with all clients)
+    SEN_ID_FORMAT_BINARY        // uint64 in SEN:TSID for queries, SEN:ID is kept alongside
+};
+
+/**
+ * encapsulates reading, writing and querying SEN IDs in both the legacy decimal string
+ * and the native binary format, so callers only ever deal with the decimal representation.
+ */
+class SenId {
+
+public:
+    static void             SetFormat(sen_id_format format);
+    static sen_id_format    Format();
+
+    /**
+     * read the ID of a node in either format into `id`, which must hold SEN_ID_LEN chars.
+     *
+     * @return B_OK, B_ENTRY_NOT_FOUND if the node has no ID, or the error of reading the attribute.
+     */
+    static status_t         Read(BNode* node, char* id);
+    static status_t         Read(BNode* node, BString* id);
+    /**
+     * write an ID in the current format, always including the string SEN:ID read by other
+     * clients and tools.
+     */
+    static status_t         Write(BNode* node, uint64 id);
+
+    /**
+     * allocation free conversion into `buffer` of SEN_ID_LEN chars.
+     */
+    static void             ToString(uint64 id, char* buffer);
+    static status_t         Parse(const char* id, uint64* value);
+
+    /**
+     * build a query predicate matching the given ID in the attribute(s) currently in use.
+     */
+    static void             GetPredicate(const char* id, BString* predicate);
+    /**
+     * predicate matching all nodes having an ID in any format.
+     */
+    static const char*      GetAnyIdPredicate();
+
+    /**
+     * create the SEN:TSID index if needed, then start adding SEN:TSID to all nodes with a string
+     * ID on the boot volume in a background thread. SEN:ID itself is kept.
+     * Must run before any ID query, if the index cannot be created, IDs stay in string format.
+     */
+    static status_t         StartMigration();
+    static bool             IsMigrated();
+
+private:
+    static status_t         _CreateIndex();
+    static status_t         _Migrate(void* data);
+
+    static int32            sFormat;
+    static int32            sMigrated;
+};
@@ -0,0 +1,306 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#include <Autolock.h>
+#include <dirent.h>
+#include <NodeMonitor.h>
+#include <VolumeRoster.h>
+#include <Volume.h>
+
+#include "SenId.h"
+#include "SenIdIndex.h"
+#include <sen/Sen.h>
+
+SenIdIndex::SenIdIndex()
+    : fLock("SenIdIndex"),
+      fBuildThread(-1),
+      fReady(false)
+{
+}
+
+SenIdIndex::~SenIdIndex()
+{
+    if (fBuildThread >= 0) {
+        status_t exitValue;
+        wait_for_thread(fBuildThread, &exitValue);
+    }
+    fLiveQuery.Clear();
+}
+
+status_t SenIdIndex::Init(const BMessenger& target)
+{
+    // TODO: all relation queries currently assume we never leave the boot volume
+    BVolumeRoster volRoster;
+    BVolume bootVolume;
+    volRoster.GetBootVolume(&bootVolume);
+
+    fLiveQuery.SetVolume(&bootVolume);
+    fLiveQuery.SetPredicate(SenId::GetAnyIdPredicate());
+
+    status_t result = fLiveQuery.SetTarget(target);
+    if (result != B_OK) {
+        ERROR("failed to set up live query for SEN:ID index: %s\n", strerror(result));
+        return result;
+    }
+
+    // initial population may take a while on large volumes, don't block the server meanwhile.
+    fBuildThread = spawn_thread(_BuildThread, "sen id index", B_LOW_PRIORITY, this);
+    if (fBuildThread < 0) {
+        ERROR("failed to spawn SEN:ID index thread: %s\n", strerror(fBuildThread));
+        return fBuildThread;
+    }
+
+    return resume_thread(fBuildThread);
+}
+
+bool SenIdIndex::IsReady()
+{
+    BAutolock _(fLock);
+    return fReady;
+}
+
+int32 SenIdIndex::CountEntries()
+{
+    BAutolock _(fLock);
+    return fIdToEntry.size();
+}
+
+status_t SenIdIndex::Lookup(const char* id, entry_ref* ref, node_ref* nodeRef)
+{
+    BAutolock _(fLock);
+
+    auto it = fIdToEntry.find(id);
+    if (it == fIdToEntry.end()) {
+        return fReady ? B_ENTRY_NOT_FOUND : B_NOT_INITIALIZED;
+    }
+
+    const IndexEntry& entry = it->second;
+    ref->device    = entry.device;
+    ref->directory = entry.directory;
+    ref->set_name(entry.name.String());
+
+    if (nodeRef != NULL) {
+        nodeRef->device = entry.device;
+        nodeRef->node   = entry.node;
+    }
+
+    return B_OK;
+}
+
+void SenIdIndex::Add(const char* id, const entry_ref* ref, ino_t node)
+{
+    IndexEntry entry;
+    entry.device    = ref->device;
+    entry.node      = node;
+    entry.directory = ref->directory;
+    entry.name      = ref->name;
+
+    BAutolock _(fLock);
+    _AddLocked(id, entry);
+}
+
+void SenIdIndex::Remove(const char* id)
+{
+    BAutolock _(fLock);
+
+    auto it = fIdToEntry.find(id);
+    if (it == fIdToEntry.end())
+        return;
+
+    fNodeToId.erase(NodeKey{it->second.device, it->second.node});
+    fIdToEntry.erase(it);
+}
+
+void SenIdIndex::RemoveNode(dev_t device, ino_t node)
+{
+    BAutolock _(fLock);
+
+    auto it = fNodeToId.find(NodeKey{device, node});
+    if (it == fNodeToId.end())
+        return;
+
+    auto entry = fIdToEntry.find(it->second);
+    // only drop the ID if it still belongs to this node and not to the original of a copy
+    if (entry != fIdToEntry.end() && entry->second.device == device && entry->second.node == node) {
+        fIdToEntry.erase(entry);
+    }
+    fNodeToId.erase(it);
+}
+
+void SenIdIndex::HandleQueryUpdate(const BMessage* message)
+{
+    int32 opcode;
+    if (message->FindInt32("opcode", &opcode) != B_OK)
+        return;
+
+    int32 device;
+    ino_t directory, node;
+    const char* name;
+
+    if (message->FindInt32("device", &device) != B_OK
+        || message->FindInt64("node", &node) != B_OK) {
+        return;
+    }
+
+    switch (opcode) {
+        case B_ENTRY_CREATED:
+        {
+            if (message->FindInt64("directory", &directory) != B_OK
+                || message->FindString("name", &name) != B_OK) {
+                break;
+            }
+            entry_ref ref(device, directory, name);
+            BString id;
+            if (_ReadId(&ref, &id) == B_OK) {
+                Add(id.String(), &ref, node);
+            }
+            break;
+        }
+        case B_ENTRY_REMOVED:
+        {
+            // node lost its SEN:ID (or was deleted), updates of other live queries arrive here
+            // as well though, so only drop nodes really without SEN:ID
+            if (message->FindInt64("directory", &directory) == B_OK
+                && message->FindString("name", &name) == B_OK) {
+                entry_ref ref(device, directory, name);
+                BString id;
+                if (_ReadId(&ref, &id) == B_OK)
+                    break;
+            }
+            RemoveNode(device, node);
+            break;
+        }
+    }
+}
+
+void SenIdIndex::HandleNodeMonitor(const BMessage* message)
+{
+    int32 opcode;
+    if (message->FindInt32("opcode", &opcode) != B_OK)
+        return;
+
+    int32 device;
+    ino_t node;
+
+    if (message->FindInt32("device", &device) != B_OK
+        || message->FindInt64("node", &node) != B_OK) {
+        return;
+    }
+
+    switch (opcode) {
+        case B_ENTRY_MOVED:
+        {
+            ino_t toDirectory;
+            const char* name;
+
+            if (message->FindInt64("to directory", &toDirectory) != B_OK
+                || message->FindString("name", &name) != B_OK) {
+                break;
+            }
+
+            BAutolock _(fLock);
+            auto it = fNodeToId.find(NodeKey{device, node});
+            if (it == fNodeToId.end())
+                break;
+
+            auto entry = fIdToEntry.find(it->second);
+            if (entry != fIdToEntry.end() && entry->second.node == node) {
+                entry->second.directory = toDirectory;
+                entry->second.name      = name;
+            }
+            break;
+        }
+        case B_ENTRY_REMOVED:
+        {
+            RemoveNode(device, node);
+            break;
+        }
+    }
+}
+
+/*
+ * private methods
+ */
+
+status_t SenIdIndex::_BuildThread(void* data)
+{
+    return static_cast<SenIdIndex*>(data)->_Build();
+}
+
+status_t SenIdIndex::_Build()
+{
+    LOG("building SEN:ID index...\n");
+    bigtime_t start = system_time();
+
+    status_t result = fLiveQuery.Fetch();
+    if (result != B_OK) {
+        ERROR("could not execute query for SEN:ID index: %s\n", strerror(result));
+        return result;
+    }
+
+    char buffer[4096];
+    struct dirent* dirents = reinterpret_cast<struct dirent*>(buffer);
+    int32 count;
+
+    while ((count = fLiveQuery.GetNextDirents(dirents, sizeof(buffer))) > 0) {
+        struct dirent* dent = dirents;
+
+        for (int32 i = 0; i < count; i++) {
+            entry_ref ref(dent->d_pdev, dent->d_pino, dent->d_name);
+            BString id;
+
+            if (_ReadId(&ref, &id) == B_OK) {
+                Add(id.String(), &ref, dent->d_ino);
+            }
+            dent = reinterpret_cast<struct dirent*>(reinterpret_cast<char*>(dent) + dent->d_reclen);
+        }
+    }
+
+    BAutolock _(fLock);
+    fReady = true;
+
+    LOG("SEN:ID index ready with %zu entries after %" B_PRId64 "ms.\n",
+        fIdToEntry.size(), (system_time() - start) / 1000);
+
+    return B_OK;
+}
+
+void SenIdIndex::_AddLocked(const std::string& id, const IndexEntry& entry)
+{
+    NodeKey key{entry.device, entry.node};
+
+    auto existing = fIdToEntry.find(id);
+    if (existing != fIdToEntry.end()) {
+        if (existing->second.device == entry.device && existing->second.node == entry.node) {
+            // same node, just refresh location
+            existing->second = entry;
+            return;
+        }
+        // keep the original, copies are cleaned up by the server
+        LOG("SEN:ID %s already indexed for another node, keeping original.\n", id.c_str());
+        return;
+    }
+
+    // a node can only carry one ID, drop a stale mapping if its ID changed
+    auto oldId = fNodeToId.find(key);
+    if (oldId != fNodeToId.end() && oldId->second != id) {
+        fIdToEntry.erase(oldId->second);
+    }
+
+    fIdToEntry[id]  = entry;
+    fNodeToId[key]  = id;
+}
+
+status_t SenIdIndex::_ReadId(const entry_ref* ref, BString* id)
+{
+    BNode node(ref);
+    status_t result = node.InitCheck();
+
+    if (result == B_OK)
+        result = SenId::Read(&node, id);
+
+    return result;
+}
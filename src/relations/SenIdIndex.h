@@ -0,0 +1,98 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#pragma once
+
+#include <Entry.h>
+#include <Locker.h>
+#include <Message.h>
+#include <Messenger.h>
+#include <Node.h>
+#include <Query.h>
+#include <String.h>
+
+#include <string>
+#include <unordered_map>
+
+/**
+ * resident SEN:ID -> node lookup table, so resolving relation targets does not need
+ * a fresh BQuery per ID.
+ *
+ * The index is populated once from a live query for all nodes carrying a SEN:ID and
+ * then kept up to date from the query updates (ID added/removed) and volume node monitor
+ * events (entry moved/removed) forwarded by the server.
+ * Callers should fall back to a regular query on a miss, see RelationHandler::QueryForUniqueSenId().
+ */
+class SenIdIndex {
+
+public:
+                SenIdIndex();
+                ~SenIdIndex();
+
+    /**
+     * start the live query on the boot volume and populate the index in the background.
+     *
+     * @param target    messenger receiving B_QUERY_UPDATE messages, usually the server
+     * @return B_OK or the error from setting up the live query.
+     */
+    status_t    Init(const BMessenger& target);
+    bool        IsReady();
+    int32       CountEntries();
+
+    /**
+     * look up the entry for the given SEN:ID.
+     *
+     * @return B_OK if found, B_ENTRY_NOT_FOUND on a miss or B_NOT_INITIALIZED while still building.
+     */
+    status_t    Lookup(const char* id, entry_ref* ref, node_ref* nodeRef = NULL);
+
+    /**
+     * register an ID for a node. An existing mapping for that ID to another node is kept,
+     * since the first node holding an ID is the original and any later one a copy.
+     */
+    void        Add(const char* id, const entry_ref* ref, ino_t node);
+    void        Remove(const char* id);
+    void        RemoveNode(dev_t device, ino_t node);
+
+    void        HandleQueryUpdate(const BMessage* message);
+    void        HandleNodeMonitor(const BMessage* message);
+
+private:
+    struct IndexEntry {
+        dev_t       device;
+        ino_t       node;
+        ino_t       directory;
+        BString     name;
+    };
+
+    struct NodeKey {
+        dev_t       device;
+        ino_t       node;
+
+        bool operator==(const NodeKey& other) const {
+            return device == other.device && node == other.node;
+        }
+    };
+
+    struct NodeKeyHash {
+        size_t operator()(const NodeKey& key) const {
+            return std::hash<ino_t>()(key.node) ^ (std::hash<dev_t>()(key.device) << 1);
+        }
+    };
+
+    static status_t _BuildThread(void* data);
+    status_t        _Build();
+    void            _AddLocked(const std::string& id, const IndexEntry& entry);
+    status_t        _ReadId(const entry_ref* ref, BString* id);
+
+    BLocker                                             fLock;
+    BQuery                                              fLiveQuery;
+    thread_id                                           fBuildThread;
+    bool                                                fReady;
+
+    std::unordered_map<std::string, IndexEntry>         fIdToEntry;
+    std::unordered_map<NodeKey, std::string, NodeKeyHash> fNodeToId;
+};
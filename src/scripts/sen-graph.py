@@ -21,6 +21,7 @@ def catattr(attr, path):
 def main():
     outsvg = sys.argv[1] if len(sys.argv) > 1 else '/tmp/sen-graph.svg'
 
+    # SEN:ID holds the string ID in both ID formats, the binary SEN:TSID is only added for faster queries
     print('querying SEN:ID index...')
     paths = query('SEN:ID=="*"')
     print(f'found {len(paths)} SEN nodes')
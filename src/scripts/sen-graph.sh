@@ -5,6 +5,7 @@
 OUTSVG="${2:-sen-graph.svg}"
 DOTFILE=$(mktemp /tmp/sen-XXXXXX.dot)
 
+# SEN:ID holds the string ID in both ID formats, the binary SEN:TSID is only added for faster queries
 echo "querying SEN:ID index..."
 
 {
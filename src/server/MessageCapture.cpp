@@ -0,0 +1,222 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#include <Autolock.h>
+#include <File.h>
+#include <Locker.h>
+#include <String.h>
+
+#include <string.h>
+#include <vector>
+
+#include "MessageCapture.h"
+#include <sen/Sen.h>
+
+struct capture_header {
+    uint32  magic;
+    uint32  version;
+};
+
+// fixed part of a record following its size
+struct capture_record_header {
+    int64   received;
+    int64   latency;
+    uint32  requestSize;
+} __attribute__((packed));
+
+static BLocker  sLock("sen capture");
+static BFile*   sFile = NULL;
+static BString  sPath;
+static int32    sActive = 0;
+static int64    sRecords = 0;
+static int64    sBytes = 0;
+
+status_t MessageCapture::Start(const char* path)
+{
+    BAutolock _(sLock);
+
+    if (sFile != NULL) {
+        if (sPath == path)
+            return B_OK;
+        Stop();
+    }
+
+    BFile* file = new BFile(path, B_READ_WRITE | B_CREATE_FILE | B_OPEN_AT_END);
+    status_t result = file->InitCheck();
+
+    off_t size = 0;
+    if (result == B_OK)
+        result = file->GetSize(&size);
+
+    if (result == B_OK) {
+        capture_header header;
+
+        if (size == 0) {
+            header.magic   = SEN_CAPTURE_MAGIC;
+            header.version = SEN_CAPTURE_VERSION;
+            result = file->WriteExactly(&header, sizeof(header));
+        } else if (file->ReadAt(0, &header, sizeof(header)) != sizeof(header)
+            || header.magic != SEN_CAPTURE_MAGIC || header.version != SEN_CAPTURE_VERSION) {
+            // never append to something else
+            result = B_BAD_DATA;
+        }
+    }
+
+    if (result != B_OK) {
+        ERROR("failed to start capture to %s: %s\n", path, strerror(result));
+        delete file;
+        return result;
+    }
+
+    sFile = file;
+    sPath = path;
+    atomic_set64(&sRecords, 0);
+    atomic_set64(&sBytes, 0);
+    atomic_set(&sActive, 1);
+
+    LOG("capturing requests to %s\n", path);
+    return B_OK;
+}
+
+void MessageCapture::Stop()
+{
+    BAutolock _(sLock);
+
+    if (sFile == NULL)
+        return;
+
+    atomic_set(&sActive, 0);
+    delete sFile;
+    sFile = NULL;
+
+    LOG("stopped capture to %s after %" B_PRId64 " requests\n", sPath.String(), atomic_get64(&sRecords));
+}
+
+bool MessageCapture::IsActive()
+{
+    return atomic_get(&sActive) != 0;
+}
+
+void MessageCapture::Received(BMessage* message)
+{
+    if (! IsActive())
+        return;
+
+    // only capture client requests, not our own control message or system notifications
+    switch (message->what) {
+        case SEN_CORE_CAPTURE:
+        case B_NODE_MONITOR:
+        case B_QUERY_UPDATE:
+            return;
+    }
+
+    message->AddInt64(SEN_CAPTURE_RECEIVED, system_time());
+}
+
+void MessageCapture::Record(const BMessage* message, const BMessage* reply)
+{
+    bigtime_t received;
+    if (! IsActive() || message->FindInt64(SEN_CAPTURE_RECEIVED, &received) != B_OK)
+        return;
+
+    capture_record_header header;
+    header.latency  = system_time() - received;
+    header.received = real_time_clock_usecs() - header.latency;
+
+    BMessage request(*message);
+    request.RemoveName(SEN_CAPTURE_RECEIVED);
+
+    ssize_t requestSize = request.FlattenedSize();
+    ssize_t replySize   = reply->FlattenedSize();
+    header.requestSize  = requestSize;
+
+    uint32 recordSize = sizeof(header) + requestSize + replySize;
+    std::vector<char> buffer(sizeof(recordSize) + recordSize);
+
+    char* position = buffer.data();
+    memcpy(position, &recordSize, sizeof(recordSize));
+    position += sizeof(recordSize);
+    memcpy(position, &header, sizeof(header));
+    position += sizeof(header);
+
+    if (request.Flatten(position, requestSize) != B_OK
+        || reply->Flatten(position + requestSize, replySize) != B_OK) {
+        return;
+    }
+
+    BAutolock _(sLock);
+
+    if (sFile == NULL)
+        return;
+
+    // one write per record, so a crash leaves at most a truncated last record
+    status_t result = sFile->WriteExactly(buffer.data(), buffer.size());
+    if (result != B_OK) {
+        ERROR("failed to write capture record, stopping capture: %s\n", strerror(result));
+        Stop();
+        return;
+    }
+
+    atomic_add64(&sRecords, 1);
+    atomic_add64(&sBytes, buffer.size());
+}
+
+void MessageCapture::GetStats(BMessage* stats)
+{
+    BAutolock _(sLock);
+
+    stats->AddBool("active", sFile != NULL);
+    stats->AddString("path", sPath);
+    stats->AddInt64("records", atomic_get64(&sRecords));
+    stats->AddInt64("bytes", atomic_get64(&sBytes));
+}
+
+status_t MessageCapture::ReadHeader(BDataIO* input)
+{
+    capture_header header;
+
+    status_t result = input->ReadExactly(&header, sizeof(header));
+    if (result != B_OK)
+        return result;
+
+    if (header.magic != SEN_CAPTURE_MAGIC || header.version != SEN_CAPTURE_VERSION)
+        return B_BAD_DATA;
+
+    return B_OK;
+}
+
+status_t MessageCapture::ReadRecord(BDataIO* input, capture_record* record)
+{
+    uint32 recordSize;
+    size_t bytesRead = 0;
+
+    status_t result = input->ReadExactly(&recordSize, sizeof(recordSize), &bytesRead);
+    if (result != B_OK)
+        return bytesRead == 0 ? B_LAST_BUFFER_ERROR : result;
+
+    if (recordSize < sizeof(capture_record_header))
+        return B_BAD_DATA;
+
+    std::vector<char> buffer(recordSize);
+    if ((result = input->ReadExactly(buffer.data(), recordSize)) != B_OK)
+        return result;
+
+    capture_record_header header;
+    memcpy(&header, buffer.data(), sizeof(header));
+
+    if (header.requestSize > recordSize - sizeof(header))
+        return B_BAD_DATA;
+
+    const char* data = buffer.data() + sizeof(header);
+
+    record->received = header.received;
+    record->latency  = header.latency;
+
+    if ((result = record->request.Unflatten(data)) != B_OK)
+        return result;
+
+    return record->reply.Unflatten(data + header.requestSize);
+}
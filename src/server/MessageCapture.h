@@ -0,0 +1,72 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#pragma once
+
+#include <DataIO.h>
+#include <Message.h>
+#include <OS.h>
+
+// start capturing to "path" (default <temp>/sen/capture.log) with "enable" = true, stop with false.
+// The reply always holds the current capture stats.
+#ifndef SEN_CORE_CAPTURE
+#define SEN_CORE_CAPTURE            'SCcp'
+#endif
+
+#define SEN_CAPTURE_MAGIC           'SCap'
+#define SEN_CAPTURE_VERSION         1
+// arrival time stamped on requests while capturing, not part of the captured request
+#define SEN_CAPTURE_RECEIVED        "sen:received"
+
+/**
+ * one captured request with its reply.
+ *
+ * On disk, a capture file starts with magic and version (uint32 each), followed by records of
+ * uint32 size of the rest of the record, int64 arrival wall clock time and int64 latency in µs,
+ * uint32 size of the flattened request, the flattened request and the flattened reply,
+ * all in host byte order.
+ */
+struct capture_record {
+    bigtime_t   received;
+    bigtime_t   latency;
+    BMessage    request;
+    BMessage    reply;
+};
+
+/**
+ * records incoming requests, their replies and handling latency to an append-only log
+ * for replaying production load, see tools/replay.
+ *
+ * Requests are stamped on arrival in SenServer::MessageReceived(), so the latency includes
+ * waiting for a worker, and recorded where the reply is sent.
+ */
+class MessageCapture {
+
+public:
+    static status_t Start(const char* path);
+    static void     Stop();
+    static bool     IsActive();
+
+    /**
+     * stamp the arrival time on a client request if capturing.
+     */
+    static void     Received(BMessage* message);
+    /**
+     * append a stamped request and its reply to the log, unstamped requests are ignored.
+     */
+    static void     Record(const BMessage* request, const BMessage* reply);
+
+    /**
+     * add "active", "path", "records" and "bytes" to `stats`.
+     */
+    static void     GetStats(BMessage* stats);
+
+    static status_t ReadHeader(BDataIO* input);
+    /**
+     * read the next record, B_LAST_BUFFER_ERROR at the end of the log.
+     */
+    static status_t ReadRecord(BDataIO* input, capture_record* record);
+};
@@ -0,0 +1,221 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#include <Autolock.h>
+#include <Locker.h>
+
+#include <ctype.h>
+#include <map>
+#include <string.h>
+#include <string>
+
+#include "Metrics.h"
+
+struct request_metrics {
+    LatencyHistogram    latency;
+    int64               errors = 0;
+};
+
+static BLocker                                  sLock("sen metrics");
+static std::map<uint32, request_metrics>        sRequests;
+static std::map<status_t, int64>                sErrors;
+static std::map<std::string, LatencyHistogram>  sTimings;
+
+/**
+ * message type as 4 char code if printable, e.g. 'SCst', else in hex.
+ */
+static BString what_to_name(uint32 what)
+{
+    char code[5] = {
+        (char)(what >> 24), (char)(what >> 16), (char)(what >> 8), (char)what, '\0'
+    };
+
+    for (int i = 0; i < 4; i++) {
+        if (! isalnum(code[i])) {
+            BString hex;
+            hex.SetToFormat("0x%08" B_PRIx32, what);
+            return hex;
+        }
+    }
+    return BString(code);
+}
+
+static BString sanitize(const char* name)
+{
+    BString result(name);
+    for (int32 i = 0; i < result.Length(); i++) {
+        if (! isalnum(result[i]))
+            result.SetByteAt(i, '_');
+    }
+    return result;
+}
+
+LatencyHistogram::LatencyHistogram()
+    : fCount(0),
+      fTotal(0),
+      fMax(0)
+{
+    for (int32 i = 0; i < SEN_METRICS_BUCKETS; i++) {
+        fBuckets[i] = 0;
+    }
+}
+
+void LatencyHistogram::Record(bigtime_t duration)
+{
+    if (duration < 0)
+        duration = 0;
+
+    // bucket i holds durations below 2^(i+1) µs
+    int32 bucket = 0;
+    while (bucket < SEN_METRICS_BUCKETS - 1 && (duration >> (bucket + 1)) > 0) {
+        bucket++;
+    }
+
+    fBuckets[bucket]++;
+    fCount++;
+    fTotal += duration;
+    if (duration > fMax)
+        fMax = duration;
+}
+
+int64 LatencyHistogram::Count() const
+{
+    return fCount;
+}
+
+bigtime_t LatencyHistogram::Percentile(double fraction) const
+{
+    if (fCount == 0)
+        return 0;
+
+    int64 rank = (int64)(fraction * fCount + 0.5);
+    if (rank < 1)
+        rank = 1;
+
+    int64 seen = 0;
+    for (int32 i = 0; i < SEN_METRICS_BUCKETS; i++) {
+        seen += fBuckets[i];
+        if (seen >= rank) {
+            bigtime_t upperBound = ((bigtime_t)1 << (i + 1)) - 1;
+            return upperBound < fMax ? upperBound : fMax;
+        }
+    }
+    return fMax;
+}
+
+void LatencyHistogram::GetStats(BMessage* stats) const
+{
+    stats->AddInt64("count", fCount);
+    stats->AddInt64("total", fTotal);
+    stats->AddInt64("avg", fCount > 0 ? fTotal / fCount : 0);
+    stats->AddInt64("max", fMax);
+    stats->AddInt64("p50", Percentile(0.50));
+    stats->AddInt64("p95", Percentile(0.95));
+    stats->AddInt64("p99", Percentile(0.99));
+}
+
+void Metrics::RecordRequest(uint32 what, bigtime_t duration, status_t result)
+{
+    BAutolock _(sLock);
+
+    request_metrics& request = sRequests[what];
+    request.latency.Record(duration);
+
+    if (result != B_OK) {
+        request.errors++;
+        sErrors[result]++;
+    }
+}
+
+void Metrics::RecordTiming(const char* name, bigtime_t duration)
+{
+    BAutolock _(sLock);
+    sTimings[name].Record(duration);
+}
+
+void Metrics::GetStats(BMessage* stats)
+{
+    BAutolock _(sLock);
+
+    BMessage requests;
+    for (const auto& entry : sRequests) {
+        BMessage request;
+        entry.second.latency.GetStats(&request);
+        request.AddInt64("errors", entry.second.errors);
+        requests.AddMessage(what_to_name(entry.first).String(), &request);
+    }
+    stats->AddMessage("requests", &requests);
+
+    BMessage errors;
+    for (const auto& entry : sErrors) {
+        errors.AddInt64(strerror(entry.first), entry.second);
+    }
+    stats->AddMessage("errors", &errors);
+
+    BMessage timings;
+    for (const auto& entry : sTimings) {
+        BMessage timing;
+        entry.second.GetStats(&timing);
+        timings.AddMessage(entry.first.c_str(), &timing);
+    }
+    stats->AddMessage("timings", &timings);
+}
+
+void Metrics::FormatText(const BMessage* stats, BString* text, const char* prefix)
+{
+    char*     name;
+    type_code type;
+    int32     count;
+
+    for (int32 i = 0; stats->GetInfo(B_ANY_TYPE, i, &name, &type, &count) == B_OK; i++) {
+        for (int32 j = 0; j < count; j++) {
+            BString key(prefix);
+            key << "_" << sanitize(name);
+            if (count > 1)
+                key << "_" << j;
+
+            switch (type) {
+                case B_MESSAGE_TYPE:
+                {
+                    BMessage nested;
+                    if (stats->FindMessage(name, j, &nested) == B_OK)
+                        FormatText(&nested, text, key.String());
+                    continue;
+                }
+                case B_BOOL_TYPE:
+                    *text << key << " " << (stats->GetBool(name, j, false) ? 1 : 0) << "\n";
+                    break;
+                case B_INT32_TYPE:
+                    *text << key << " " << stats->GetInt32(name, j, 0) << "\n";
+                    break;
+                case B_INT64_TYPE:
+                    *text << key << " " << stats->GetInt64(name, j, 0) << "\n";
+                    break;
+                case B_DOUBLE_TYPE:
+                {
+                    BString value;
+                    value.SetToFormat("%g", stats->GetDouble(name, j, 0.0));
+                    *text << key << " " << value << "\n";
+                    break;
+                }
+                default:
+                    // strings and other data are not metrics
+                    break;
+            }
+        }
+    }
+}
+
+MetricsTimer::MetricsTimer(const char* name)
+    : fName(name),
+      fStart(system_time())
+{
+}
+
+MetricsTimer::~MetricsTimer()
+{
+    Metrics::RecordTiming(fName, system_time() - fStart);
+}
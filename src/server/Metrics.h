@@ -0,0 +1,80 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#pragma once
+
+#include <Message.h>
+#include <OS.h>
+#include <String.h>
+
+// log2 buckets of microseconds, the last one collects everything above ~35 minutes
+#define SEN_METRICS_BUCKETS     32
+
+// names of timed operations besides requests
+#define SEN_METRICS_QUERY           "query"
+#define SEN_METRICS_PLUGIN_LAUNCH   "pluginLaunch"
+#define SEN_METRICS_PLUGIN_CALL     "pluginCall"
+
+/**
+ * latency histogram with power of 2 buckets, percentiles are estimated by bucket upper bound.
+ * Not thread safe, guarded by the Metrics lock.
+ */
+class LatencyHistogram {
+
+public:
+                LatencyHistogram();
+
+    void        Record(bigtime_t duration);
+    int64       Count() const;
+    bigtime_t   Percentile(double fraction) const;
+    /**
+     * add count, total, avg, max, p50, p95 and p99 in microseconds to `stats`.
+     */
+    void        GetStats(BMessage* stats) const;
+
+private:
+    int64       fBuckets[SEN_METRICS_BUCKETS];
+    int64       fCount;
+    bigtime_t   fTotal;
+    bigtime_t   fMax;
+};
+
+/**
+ * server wide counters and latency histograms per request type, error counts per status code
+ * and timings of queries and plugin calls, reported with SEN_CORE_STATUS.
+ */
+class Metrics {
+
+public:
+    static void     RecordRequest(uint32 what, bigtime_t duration, status_t result);
+    static void     RecordTiming(const char* name, bigtime_t duration);
+
+    /**
+     * add "requests" keyed by message type, "errors" keyed by error text and "timings"
+     * keyed by operation name to `stats`.
+     */
+    static void     GetStats(BMessage* stats);
+
+    /**
+     * flatten all numeric and boolean fields of `stats` and its nested messages into lines of
+     * "<prefix>_<path> <value>", e.g. "sen_caches_relations_hits 42", for local scrapers.
+     */
+    static void     FormatText(const BMessage* stats, BString* text, const char* prefix = "sen");
+};
+
+/**
+ * records the time from construction to destruction as timing `name`, e.g. for a query.
+ */
+class MetricsTimer {
+
+public:
+                MetricsTimer(const char* name);
+                ~MetricsTimer();
+
+private:
+    const char* fName;
+    bigtime_t   fStart;
+};
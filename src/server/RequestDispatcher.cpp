@@ -0,0 +1,384 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#include <Autolock.h>
+#include <Entry.h>
+#include <String.h>
+
+#include <string.h>
+
+#include "RequestDispatcher.h"
+#include "SenServer.h"
+#include <sen/Sen.h>
+
+static const char* kLaneNames[SEN_LANE_COUNT] = {
+    SEN_MSG_PRIORITY_INTERACTIVE,
+    SEN_MSG_PRIORITY_BACKGROUND
+};
+
+RequestWorker::RequestWorker(RequestDispatcher* dispatcher, SenServer* server, int32 index)
+    : fDispatcher(dispatcher),
+      fServer(server),
+      fIndex(index),
+      fThread(-1),
+      fPending(-1),
+      fLock("RequestWorker"),
+      fProcessed(0)
+{
+    for (int32 lane = 0; lane < SEN_LANE_COUNT; lane++) {
+        fRunning[lane] = 0;
+    }
+}
+
+RequestWorker::~RequestWorker()
+{
+    Stop();
+
+    for (int32 lane = 0; lane < SEN_LANE_COUNT; lane++) {
+        for (queued_request& request : fQueues[lane]) {
+            delete request.message;
+        }
+    }
+}
+
+status_t RequestWorker::Start()
+{
+    fPending = create_sem(0, "sen worker requests");
+    if (fPending < 0)
+        return fPending;
+
+    BString name("sen worker ");
+    name << fIndex;
+
+    fThread = spawn_thread(_WorkerThread, name.String(), B_NORMAL_PRIORITY, this);
+    if (fThread < 0) {
+        ERROR("failed to spawn worker thread: %s\n", strerror(fThread));
+        return fThread;
+    }
+
+    return resume_thread(fThread);
+}
+
+void RequestWorker::Stop()
+{
+    if (fThread < 0)
+        return;
+
+    // queued behind all background work, so everything still pending gets done
+    Enqueue(NULL, SEN_LANE_BACKGROUND);
+
+    status_t exitValue;
+    wait_for_thread(fThread, &exitValue);
+    fThread = -1;
+
+    delete_sem(fPending);
+    fPending = -1;
+}
+
+void RequestWorker::Enqueue(BMessage* message, request_lane lane)
+{
+    {
+        BAutolock _(fLock);
+        fQueues[lane].push_back(queued_request{ message, system_time() });
+    }
+    release_sem(fPending);
+}
+
+int32 RequestWorker::QueueDepth(request_lane lane)
+{
+    BAutolock _(fLock);
+    return fQueues[lane].size() + fRunning[lane];
+}
+
+void RequestWorker::GetStats(BMessage* stats)
+{
+    BAutolock _(fLock);
+
+    stats->AddInt32("queued", fQueues[SEN_LANE_INTERACTIVE].size() + fQueues[SEN_LANE_BACKGROUND].size());
+    stats->AddBool("busy", fRunning[SEN_LANE_INTERACTIVE] + fRunning[SEN_LANE_BACKGROUND] > 0);
+    stats->AddInt64("processed", fProcessed);
+}
+
+/*
+ * private methods
+ */
+
+status_t RequestWorker::_WorkerThread(void* data)
+{
+    static_cast<RequestWorker*>(data)->_Run();
+    return B_OK;
+}
+
+void RequestWorker::_Run()
+{
+    while (true) {
+        status_t result;
+        do {
+            result = acquire_sem(fPending);
+        } while (result == B_INTERRUPTED);
+
+        if (result != B_OK)
+            return;
+
+        queued_request request;
+        request_lane   lane = SEN_LANE_INTERACTIVE;
+        {
+            BAutolock _(fLock);
+
+            // interactive work always goes first
+            if (fQueues[SEN_LANE_INTERACTIVE].empty())
+                lane = SEN_LANE_BACKGROUND;
+
+            request = fQueues[lane].front();
+            fQueues[lane].pop_front();
+
+            if (request.message == NULL)
+                return;
+
+            fRunning[lane]++;
+        }
+
+        fDispatcher->_RequestStarted(lane, system_time() - request.enqueued);
+
+        // bulk work yields the CPU to interactive requests on other workers
+        if (lane == SEN_LANE_BACKGROUND)
+            set_thread_priority(fThread, B_LOW_PRIORITY);
+
+        fServer->HandleRequest(request.message);
+        delete request.message;
+
+        if (lane == SEN_LANE_BACKGROUND)
+            set_thread_priority(fThread, B_NORMAL_PRIORITY);
+
+        BAutolock _(fLock);
+        fRunning[lane]--;
+        fProcessed++;
+    }
+}
+
+RequestDispatcher::RequestDispatcher(SenServer* server)
+    : fServer(server)
+{
+    for (int32 lane = 0; lane < SEN_LANE_COUNT; lane++) {
+        fStarted[lane]   = 0;
+        fWaitTotal[lane] = 0;
+        fWaitMax[lane]   = 0;
+    }
+}
+
+RequestDispatcher::~RequestDispatcher()
+{
+    for (RequestWorker* worker : fWorkers) {
+        delete worker;
+    }
+}
+
+status_t RequestDispatcher::Init(int32 workerCount)
+{
+    if (workerCount > SEN_DISPATCH_MAX_WORKERS)
+        workerCount = SEN_DISPATCH_MAX_WORKERS;
+
+    for (int32 i = 0; i < workerCount; i++) {
+        RequestWorker* worker = new RequestWorker(this, fServer, i);
+
+        status_t result = worker->Start();
+        if (result != B_OK) {
+            delete worker;
+            // not critical as long as there is at least one worker
+            if (fWorkers.empty())
+                return result;
+            break;
+        }
+        fWorkers.push_back(worker);
+    }
+
+    LOG("dispatching requests to %zu worker(s).\n", fWorkers.size());
+    return B_OK;
+}
+
+bool RequestDispatcher::Dispatch(BMessage* message)
+{
+    if (fWorkers.empty())
+        return false;
+
+    request_lane   lane   = GetLane(message);
+    RequestWorker* worker = NULL;
+
+    if (_IsWrite(message)) {
+        // same node -> same worker, so writes to a node never run concurrently
+        node_ref nodeRef;
+        if (_GetSourceNode(message, &nodeRef) != B_OK)
+            return false;   // let the handler report the bad parameter
+
+        uint64 hash = (uint64)nodeRef.device * 31 + (uint64)nodeRef.node;
+        worker = fWorkers[hash % fWorkers.size()];
+    } else if (_IsRead(message) || message->what == SEN_CORE_TEST
+        || message->what == SEN_RELATIONS_ADD_BATCH) {
+        // batches span too many nodes for worker affinity, they rely on the node locks only
+
+        // keep the last worker free of background reads for interactive requests
+        size_t candidates = fWorkers.size();
+        if (lane == SEN_LANE_BACKGROUND && candidates > 1)
+            candidates--;
+
+        // least interactive work first, then least work overall
+        int64 minDepth = INT64_MAX;
+
+        for (size_t i = 0; i < candidates; i++) {
+            RequestWorker* candidate = fWorkers[i];
+            int64 interactive = candidate->QueueDepth(SEN_LANE_INTERACTIVE);
+            int64 background  = candidate->QueueDepth(SEN_LANE_BACKGROUND);
+            int64 depth = lane == SEN_LANE_INTERACTIVE
+                ? (interactive << 16) + background
+                : interactive + background;
+
+            if (depth < minDepth) {
+                minDepth = depth;
+                worker   = candidate;
+            }
+        }
+    } else {
+        return false;
+    }
+
+    BMessage* detached = fServer->DetachCurrentMessage();
+    if (detached == NULL)
+        return false;
+
+    worker->Enqueue(detached, lane);
+    return true;
+}
+
+int32 RequestDispatcher::CountWorkers()
+{
+    return fWorkers.size();
+}
+
+void RequestDispatcher::GetStats(BMessage* stats)
+{
+    stats->AddInt32("workers", fWorkers.size());
+
+    for (RequestWorker* worker : fWorkers) {
+        BMessage workerStats;
+        worker->GetStats(&workerStats);
+        stats->AddMessage("worker", &workerStats);
+    }
+
+    for (int32 lane = 0; lane < SEN_LANE_COUNT; lane++) {
+        int32 depth = 0;
+        for (RequestWorker* worker : fWorkers) {
+            depth += worker->QueueDepth((request_lane)lane);
+        }
+
+        int64 started   = atomic_get64(&fStarted[lane]);
+        int64 waitTotal = atomic_get64(&fWaitTotal[lane]);
+
+        BMessage laneStats;
+        laneStats.AddInt32("depth", depth);
+        laneStats.AddInt64("started", started);
+        laneStats.AddInt64("avgWait", started > 0 ? waitTotal / started : 0);
+        laneStats.AddInt64("maxWait", atomic_get64(&fWaitMax[lane]));
+
+        stats->AddMessage(kLaneNames[lane], &laneStats);
+    }
+}
+
+request_lane RequestDispatcher::GetLane(const BMessage* message)
+{
+    const char* priority;
+    if (message->FindString(SEN_MSG_PRIORITY, &priority) == B_OK) {
+        return strcmp(priority, SEN_MSG_PRIORITY_BACKGROUND) == 0
+            ? SEN_LANE_BACKGROUND : SEN_LANE_INTERACTIVE;
+    }
+
+    type_code type;
+    int32 count = 0;
+
+    switch (message->what) {
+        case SEN_CORE_TEST:
+            return SEN_LANE_BACKGROUND;
+        case SEN_QUERY_ID_FOR_REF:
+            message->GetInfo("refs", &type, &count);
+            break;
+        case SEN_QUERY_REF_FOR_ID:
+            message->GetInfo(SEN_ID_ATTR, &type, &count);
+            break;
+        case SEN_RELATIONS_ADD_BATCH:
+            message->GetInfo(SEN_RELATION_SOURCE_REF, &type, &count);
+            break;
+    }
+
+    return count > SEN_DISPATCH_BULK_THRESHOLD ? SEN_LANE_BACKGROUND : SEN_LANE_INTERACTIVE;
+}
+
+/*
+ * private methods
+ */
+
+void RequestDispatcher::_RequestStarted(request_lane lane, bigtime_t waitTime)
+{
+    atomic_add64(&fStarted[lane], 1);
+    atomic_add64(&fWaitTotal[lane], waitTime);
+
+    int64 max = atomic_get64(&fWaitMax[lane]);
+    while (waitTime > max) {
+        int64 previous = atomic_test_and_set64(&fWaitMax[lane], waitTime, max);
+        if (previous == max)
+            break;
+        max = previous;
+    }
+}
+
+bool RequestDispatcher::_IsRead(const BMessage* message)
+{
+    switch (message->what) {
+        case SEN_RELATIONS_GET:
+        case SEN_RELATIONS_GET_ALL:
+        case SEN_RELATIONS_GET_SELF:
+        case SEN_RELATIONS_GET_ALL_SELF:
+        case SEN_RELATIONS_GET_COMPATIBLE:
+        case SEN_RELATIONS_GET_COMPATIBLE_TYPES:
+        case SEN_QUERY_REF_FOR_ID:
+            return true;
+        case SEN_QUERY_ID_FOR_REF:
+            return ! message->GetBool("createIfMissing");
+        default:
+            return false;
+    }
+}
+
+bool RequestDispatcher::_IsWrite(const BMessage* message)
+{
+    switch (message->what) {
+        case SEN_RELATION_ADD:
+        case SEN_RELATION_REMOVE:
+        case SEN_RELATIONS_REMOVE_ALL:
+            return true;
+        case SEN_QUERY_ID_FOR_REF:
+            return message->GetBool("createIfMissing");
+        default:
+            return false;
+    }
+}
+
+status_t RequestDispatcher::_GetSourceNode(const BMessage* message, node_ref* nodeRef)
+{
+    entry_ref ref;
+    const char* refName = message->what == SEN_QUERY_ID_FOR_REF ? "refs" : SEN_RELATION_SOURCE_REF;
+
+    status_t result = message->FindRef(refName, &ref);
+    if (result != B_OK) {
+        const char* path;
+        if (message->FindString(refName, &path) != B_OK || (result = get_ref_for_path(path, &ref)) != B_OK)
+            return result;
+    }
+
+    BNode node(&ref);
+    if ((result = node.InitCheck()) != B_OK)
+        return result;
+
+    return node.GetNodeRef(nodeRef);
+}
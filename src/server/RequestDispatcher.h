@@ -0,0 +1,140 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#pragma once
+
+#include <Locker.h>
+#include <Message.h>
+#include <Node.h>
+#include <OS.h>
+
+#include <deque>
+#include <vector>
+
+#define SEN_DISPATCH_DEFAULT_WORKERS    4
+#define SEN_DISPATCH_MAX_WORKERS        32
+// requests resolving more IDs/refs than this at once are considered bulk work
+#define SEN_DISPATCH_BULK_THRESHOLD     64
+
+// optional request field overriding the lane, either "interactive" or "background"
+#define SEN_MSG_PRIORITY                "priority"
+#define SEN_MSG_PRIORITY_INTERACTIVE    "interactive"
+#define SEN_MSG_PRIORITY_BACKGROUND     "background"
+
+enum request_lane {
+    SEN_LANE_INTERACTIVE = 0,   // e.g. Tracker menus, always scheduled first
+    SEN_LANE_BACKGROUND,        // bulk jobs, run at low thread priority
+    SEN_LANE_COUNT
+};
+
+class SenServer;
+class RequestDispatcher;
+
+struct queued_request {
+    BMessage*   message;
+    bigtime_t   enqueued;
+};
+
+/**
+ * a worker thread with its own queue of detached request messages per lane.
+ *
+ * Requests are processed by SenServer::HandleRequest() and replied to from the worker
+ * thread, which works since a detached message keeps the return address of its sender.
+ * Interactive requests are always taken first.
+ */
+class RequestWorker {
+
+public:
+                RequestWorker(RequestDispatcher* dispatcher, SenServer* server, int32 index);
+                ~RequestWorker();
+
+    status_t    Start();
+    /**
+     * finish all queued requests, then stop the thread.
+     */
+    void        Stop();
+
+    /**
+     * queue a request, taking ownership of `message`. A NULL message stops the worker.
+     */
+    void        Enqueue(BMessage* message, request_lane lane);
+    /**
+     * number of queued and running requests in the given lane.
+     */
+    int32       QueueDepth(request_lane lane);
+    void        GetStats(BMessage* stats);
+
+private:
+    static status_t _WorkerThread(void* data);
+    void            _Run();
+
+    RequestDispatcher*          fDispatcher;
+    SenServer*                  fServer;
+    int32                       fIndex;
+    thread_id                   fThread;
+    sem_id                      fPending;   // one count per queued message
+    BLocker                     fLock;
+    std::deque<queued_request>  fQueues[SEN_LANE_COUNT];
+
+    int32                       fRunning[SEN_LANE_COUNT];
+    int64                       fProcessed;
+};
+
+/**
+ * routes relation and query requests from the application looper to a pool of workers,
+ * so slow requests (inverse queries, plugin launches) no longer block other clients
+ * and cheap requests like SEN_CORE_STATUS stay on the application thread.
+ *
+ * Read-only requests go to the least busy worker and run concurrently. Writes go to the
+ * worker selected by the source node, so writes to the same node are processed in order.
+ * Batch adds touch many nodes and are placed like reads instead. They are only serialized
+ * with other writes by the node locks, so they are not ordered with single writes still in flight.
+ *
+ * Requests are classified into an interactive and a background lane, by their
+ * SEN_MSG_PRIORITY field or else by message type and size. With more than one worker,
+ * the last one never gets background reads, so interactive requests always find a worker
+ * not tied up in bulk work.
+ */
+class RequestDispatcher {
+
+public:
+                RequestDispatcher(SenServer* server);
+                ~RequestDispatcher();
+
+    /**
+     * start `workerCount` workers, capped at SEN_DISPATCH_MAX_WORKERS.
+     * With 0 workers, Dispatch() never takes a message and everything runs on the application thread.
+     */
+    status_t    Init(int32 workerCount);
+
+    /**
+     * hand off the server's current message to a worker if it is a relation, query or test request.
+     *
+     * @return true if the message was detached and queued, false if the caller needs to handle it.
+     */
+    bool        Dispatch(BMessage* message);
+    int32       CountWorkers();
+    void        GetStats(BMessage* stats);
+
+    static request_lane GetLane(const BMessage* message);
+
+private:
+    friend class RequestWorker;
+
+    void        _RequestStarted(request_lane lane, bigtime_t waitTime);
+
+    bool        _IsRead(const BMessage* message);
+    bool        _IsWrite(const BMessage* message);
+    status_t    _GetSourceNode(const BMessage* message, node_ref* nodeRef);
+
+    SenServer*                      fServer;
+    std::vector<RequestWorker*>     fWorkers;
+
+    // per lane wait time statistics
+    int64                           fStarted[SEN_LANE_COUNT];
+    int64                           fWaitTotal[SEN_LANE_COUNT];
+    int64                           fWaitMax[SEN_LANE_COUNT];
+};
@@ -0,0 +1,81 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#include <String.h>
+
+#include "RequestTrace.h"
+
+static const char* kStageNames[SEN_STAGE_COUNT] = {
+    "nodeOpen",
+    "attrRead",
+    "unflatten",
+    "attrWrite",
+    "configLookup",
+    "targetResolution",
+    "inverseLookup",
+    "replyBuild"
+};
+
+// requests are processed on a single thread, so each thread has at most one trace
+static thread_local RequestTrace* sCurrentTrace = NULL;
+
+RequestTrace::RequestTrace()
+    : fPrevious(sCurrentTrace),
+      fStart(system_time()),
+      fQueries(0)
+{
+    for (int32 stage = 0; stage < SEN_STAGE_COUNT; stage++) {
+        fTimes[stage]  = 0;
+        fCounts[stage] = 0;
+    }
+    sCurrentTrace = this;
+}
+
+RequestTrace::~RequestTrace()
+{
+    sCurrentTrace = fPrevious;
+}
+
+void RequestTrace::AddStage(request_stage stage, bigtime_t start)
+{
+    RequestTrace* trace = sCurrentTrace;
+    if (trace == NULL)
+        return;
+
+    trace->fTimes[stage] += system_time() - start;
+    trace->fCounts[stage]++;
+}
+
+void RequestTrace::CountQuery()
+{
+    if (sCurrentTrace != NULL)
+        sCurrentTrace->fQueries++;
+}
+
+void RequestTrace::GetTimings(BMessage* timings)
+{
+    timings->AddInt64("total", system_time() - fStart);
+    timings->AddInt32("queries", fQueries);
+
+    for (int32 stage = 0; stage < SEN_STAGE_COUNT; stage++) {
+        if (fCounts[stage] == 0)
+            continue;
+
+        timings->AddInt64(kStageNames[stage], fTimes[stage]);
+        timings->AddInt32(BString(kStageNames[stage]) << "Count", fCounts[stage]);
+    }
+}
+
+StageTimer::StageTimer(request_stage stage)
+    : fStage(stage),
+      fStart(system_time())
+{
+}
+
+StageTimer::~StageTimer()
+{
+    RequestTrace::AddStage(fStage, fStart);
+}
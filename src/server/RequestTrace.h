@@ -0,0 +1,76 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#pragma once
+
+#include <Message.h>
+#include <OS.h>
+
+// optional request flag, adds a message with stage timings under the same name to the reply
+#ifndef SEN_MSG_TRACE
+#define SEN_MSG_TRACE   "trace"
+#endif
+
+enum request_stage {
+    SEN_STAGE_NODE_OPEN = 0,
+    SEN_STAGE_ATTR_READ,
+    SEN_STAGE_UNFLATTEN,
+    SEN_STAGE_ATTR_WRITE,
+    SEN_STAGE_CONFIG,
+    SEN_STAGE_TARGETS,
+    SEN_STAGE_INVERSE,
+    SEN_STAGE_REPLY,
+    SEN_STAGE_COUNT
+};
+
+/**
+ * time spent per stage of a single request, collected while it is processed on the calling
+ * thread and sent back with the reply when the request has SEN_MSG_TRACE set.
+ *
+ * Stages may nest, e.g. the inverse lookup includes its own node opens and attribute reads,
+ * so stage times do not add up to the total.
+ */
+class RequestTrace {
+
+public:
+    /**
+     * start tracing the calling thread until destruction.
+     */
+                    RequestTrace();
+                    ~RequestTrace();
+
+    /**
+     * add the time since `start` to `stage` of the calling thread's trace, if any.
+     */
+    static void     AddStage(request_stage stage, bigtime_t start);
+    static void     CountQuery();
+
+    /**
+     * add "total", "queries" and per stage "<stage>" and "<stage>Count" to `timings`, times in µs.
+     */
+    void            GetTimings(BMessage* timings);
+
+private:
+    RequestTrace*   fPrevious;
+    bigtime_t       fStart;
+    bigtime_t       fTimes[SEN_STAGE_COUNT];
+    int32           fCounts[SEN_STAGE_COUNT];
+    int32           fQueries;
+};
+
+/**
+ * adds the time from construction to destruction to a stage of the current request trace.
+ */
+class StageTimer {
+
+public:
+                StageTimer(request_stage stage);
+                ~StageTimer();
+
+private:
+    request_stage   fStage;
+    bigtime_t       fStart;
+};
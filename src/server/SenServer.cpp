@@ -6,9 +6,18 @@
 
 #include <sen/Sen.h>
 #include "SenServer.h"
+#include "MessageCapture.h"
+#include "Metrics.h"
+#include "RequestDispatcher.h"
+#include "Tracer.h"
 #include "../relations/RelationHandler.h"
+#include "../relations/SenId.h"
 
+#include <algorithm>
+#include <fs_attr.h>
 #include <stdio.h>
+#include <string>
+#include <vector>
 
 #include <AppFileInfo.h>
 #include <Directory.h>
@@ -20,6 +29,7 @@
 #include <Resources.h>
 #include <Roster.h>
 #include <String.h>
+#include <StringList.h>
 #include <VolumeRoster.h>
 #include <Volume.h>
 
@@ -44,6 +54,8 @@ SenServer::SenServer() : BApplication(SEN_SERVER_SIGNATURE)
 	// setup feature-specific handlers for initializing SEN modules and later redirecting messages appropriately
     relationHandler  = new RelationHandler();
     senConfigHandler = new SenConfigHandler();
+    dispatcher       = new RequestDispatcher(this);
+    relationStatus   = B_NO_INIT;
 
 	// see also https://www.haiku-os.org/legacy-docs/bebook/BQuery_Overview.html#id611851
     BVolumeRoster volRoster;
@@ -58,6 +70,10 @@ SenServer::~SenServer()
 {
     LOG("Goodbye:)\n");
     stop_watching(this);
+
+    // let workers finish pending requests before the handlers go away
+    delete dispatcher;
+    MessageCapture::Stop();
 }
 
 void SenServer::ReadyToRun()
@@ -69,13 +85,40 @@ void SenServer::ReadyToRun()
         Quit();
     }
 
+    // not critical, relation lookups fall back to queries without the indices
+    BMessage settings;
+    senConfigHandler->GetConfig(&settings);
+
+    status = relationStatus = relationHandler->Init(BMessenger(this), &settings);
+    if (status != B_OK) {
+        ERROR("failed to set up relation indices, falling back to queries: %s\n", strerror(status));
+    }
+
+    // not critical either, requests are then handled on the application thread
+    status = dispatcher->Init(settings.GetInt32(SEN_CONFIG_WORKERS, SEN_DISPATCH_DEFAULT_WORKERS));
+    if (status != B_OK) {
+        ERROR("failed to start request workers, handling requests sequentially: %s\n", strerror(status));
+    }
+
     BApplication::ReadyToRun();
 }
 
 void SenServer::MessageReceived(BMessage* message)
+{
+    MessageCapture::Received(message);
+
+    // relation and query requests may take a while, don't block other clients
+    if (dispatcher->Dispatch(message))
+        return;
+
+    HandleRequest(message);
+}
+
+void SenServer::HandleRequest(BMessage* message)
 {
 	BMessage* reply = new BMessage();
 	status_t result;
+    bigtime_t start = system_time();
 
 	switch (message->what) {
 		case SEN_CORE_INFO:
@@ -117,11 +160,69 @@ void SenServer::MessageReceived(BMessage* message)
 		 	result = B_OK;
 		 	reply->what = SEN_RESULT_STATUS;
 
-		 	reply->AddString("status", "operational");
-		 	reply->AddBool("healthy", true);
+            // degraded if running without indices or workers, requests are still served but slower
+            bool healthy = relationStatus == B_OK && dispatcher->CountWorkers() > 0;
+		 	reply->AddString("status", healthy ? "operational" : "degraded");
+		 	reply->AddBool("healthy", healthy);
+
+            BMessage idStats;
+            relationHandler->GetIdStats(&idStats);
+            reply->AddMessage("ids", &idStats);
+
+            BMessage cacheStats;
+            relationHandler->GetCacheStats(&cacheStats);
+            reply->AddMessage("caches", &cacheStats);
+
+            BMessage dispatchStats;
+            dispatcher->GetStats(&dispatchStats);
+            reply->AddMessage("dispatch", &dispatchStats);
+
+            BMessage metrics;
+            Metrics::GetStats(&metrics);
+            reply->AddMessage("metrics", &metrics);
+
+            // optional flat text format of all of the above for local scrapers
+            if (message->GetBool("text")) {
+                BString text;
+                Metrics::FormatText(reply, &text);
+                reply->AddString("text", text);
+            }
 
 		 	break;
 		}
+        case SEN_CORE_TRACE_DUMP:
+        {
+            result = B_OK;
+            reply->what = SEN_CORE_TRACE_DUMP;
+
+            // records are only formatted here, on demand
+            Tracer::Dump(reply, message->GetInt64("since", 0), message->GetBool("stdout"));
+            break;
+        }
+        case SEN_CORE_CAPTURE:
+        {
+            result = B_OK;
+            reply->what = SEN_CORE_CAPTURE;
+
+            if (message->GetBool("enable", true)) {
+                BString capturePath = message->GetString("path", "");
+                if (capturePath.IsEmpty()) {
+                    BPath path;
+                    if (find_directory(B_SYSTEM_TEMP_DIRECTORY, &path) != B_OK)
+                        path.SetTo("/tmp");
+                    path.Append("sen");
+                    create_directory(path.Path(), 0755);
+                    path.Append("capture.log");
+                    capturePath = path.Path();
+                }
+                result = MessageCapture::Start(capturePath.String());
+            } else {
+                MessageCapture::Stop();
+            }
+
+            MessageCapture::GetStats(reply);
+            break;
+        }
         case SEN_CORE_TEST:
 		{
             result = B_OK;
@@ -142,14 +243,59 @@ void SenServer::MessageReceived(BMessage* message)
                 break;
             }
             outputDir.SetTo(path.Path());
+
+            // optional benchmarks instead of the default TSID test
+            BString benchmark = message->GetString("benchmark", "");
+            if (benchmark == "resolve") {
+                result = BenchmarkIdResolution(&path, message, reply);
+                reply->AddBool("testPassed", result == B_OK);
+                break;
+            }
+
+            if (benchmark == "relations") {
+                result = StressRelationWrites(&path, message, reply);
+                reply->AddBool("testPassed", result == B_OK);
+                break;
+            }
+
+            if (benchmark == "batch") {
+                result = VerifyRelationBatch(&path, message, reply);
+                reply->AddBool("testPassed", result == B_OK);
+                break;
+            }
+
+            if (benchmark == "copy") {
+                result = VerifyTargetIndexCopy(&path, message, reply);
+                reply->AddBool("testPassed", result == B_OK);
+                break;
+            }
+
+            if (benchmark == "tsid") {
+                result = BenchmarkIdGeneration(message, reply);
+                reply->AddBool("testPassed", result == B_OK);
+                break;
+            }
+
             BFile file;
             int32 numFiles = message->GetInt32("count", 1000);
 
+            // optionally exercise the batch API, reserving all IDs up front
+            std::vector<uint64> batchIds;
+            if (message->GetBool("batch", false)) {
+                batchIds.resize(numFiles);
+                relationHandler->GenerateRawIds(batchIds.data(), numFiles);
+            }
+
             // create some temp files and ensure they are unique
             for (int32 i = 0; i < numFiles; i++) {
-                const char* tsid = relationHandler->GenerateId();
+                char tsid[SEN_ID_LEN];
+                if (batchIds.empty())
+                    relationHandler->GenerateId(tsid);
+                else
+                    SenId::ToString(batchIds[i], tsid);
+
                 LOG("TSID: %s\n", tsid);
-                result = file.SetTo(&outputDir, tsid, B_CREATE_FILE);
+                result = file.SetTo(&outputDir, tsid, B_CREATE_FILE | B_FAIL_IF_EXISTS);
                 if (result == B_OK) {
                     result = file.Flush();
                 } else {
@@ -167,15 +313,32 @@ void SenServer::MessageReceived(BMessage* message)
         }
         case SEN_QUERY_REF_FOR_ID:
         {
-            result = B_OK;
-            BString id;
-            entry_ref ref;
+            BStringList ids;
+
+            if ((result = message->FindStrings(SEN_ID_ATTR, &ids)) != B_OK) {
+                ERROR("missing %s parameter!\n", SEN_ID_ATTR);
+                break;
+            }
+
+            if (ids.CountStrings() == 1) {
+                entry_ref ref;
+                if ((result = relationHandler->QueryForUniqueSenId(ids.StringAt(0).String(), &ref)) == B_OK) {
+                    reply->AddRef("ref", &ref);
+                }
+                break;
+            }
 
-            // TODO: support arrays like in SEN_QUERY_ID_FOR_REF, needs slight refactoring
-            if ((result = message->FindString(SEN_ID_ATTR, &id)) == B_OK) {
-                if ((result = relationHandler->QueryForUniqueSenId(id.String(), &ref)) == B_OK) {
-                    reply->AddRef("ref", new entry_ref(ref.device, ref.directory, ref.name));
+            // resolve arrays in one go, refs are returned in order of the IDs found
+            BMessage idToRef;
+            if ((result = relationHandler->ResolveRelationTargets(&ids, &idToRef)) == B_OK) {
+                for (int32 i = 0; i < ids.CountStrings(); i++) {
+                    entry_ref ref;
+                    if (idToRef.FindRef(ids.StringAt(i).String(), &ref) == B_OK) {
+                        reply->AddRef("ref", &ref);
+                        reply->AddString("ids", ids.StringAt(i));
+                    } // ignore not found IDs like in SEN_QUERY_ID_FOR_REF
                 }
+                reply->AddMessage(SEN_ID_TO_REF_MAP, &idToRef);
             }
             break;
         }
@@ -213,6 +376,9 @@ void SenServer::MessageReceived(BMessage* message)
             if (message->FindInt32("opcode", &opcode) == B_OK) {
                 switch (opcode) {
                     case B_ENTRY_CREATED: {
+                        // new relation types in the MIME DB
+                        relationHandler->UpdateIndices(message);
+
                         entry_ref ref;
                         BString name;
 
@@ -255,11 +421,25 @@ void SenServer::MessageReceived(BMessage* message)
                         }
                         break;
                     }
-                    break;
+                    case B_ENTRY_MOVED:
+                    case B_ENTRY_REMOVED:
+                    case B_ATTR_CHANGED:    // fallthrough
+                    {
+                        // keep ID and target indices and the relation cache in sync with renamed/deleted entries
+                        // and relations changed by other applications
+                        relationHandler->UpdateIndices(message);
+                        break;
+                    }
                 }
             }
             break;
         }
+        case B_QUERY_UPDATE:
+        {
+            // live query updates for nodes gaining or losing a SEN:ID or SEN:TO
+            relationHandler->UpdateIndices(message);
+            return; // no reply needed
+        }
         // Config - redirect to SenConfigHandler, except for trivial case
         case SEN_CONFIG_GET:
         {
@@ -281,6 +461,7 @@ void SenServer::MessageReceived(BMessage* message)
         case SEN_RELATIONS_GET_COMPATIBLE:
         case SEN_RELATIONS_GET_COMPATIBLE_TYPES:
 		case SEN_RELATION_ADD:
+		case SEN_RELATIONS_ADD_BATCH:
 		case SEN_RELATION_REMOVE:
 		case SEN_RELATIONS_REMOVE_ALL: // fallthrough
         {
@@ -297,9 +478,606 @@ void SenServer::MessageReceived(BMessage* message)
 	reply->AddInt32("resultCode", result);
 	reply->AddString("result", strerror(result));
 
+    Metrics::RecordRequest(message->what, system_time() - start, result);
+    MessageCapture::Record(message, reply);
+
 	message->SendReply(reply);
 }
 
+/**
+ * compare resolving relation target IDs with one query per ID against chunked OR-queries,
+ * both bypassing the ID index, for a set of freshly created target files.
+ * Result counts may be passed in as "counts" (int32 array), default is 10, 100 and 1000 targets.
+ */
+status_t SenServer::BenchmarkIdResolution(const BPath* basePath, const BMessage* message, BMessage* reply)
+{
+    std::vector<int32> counts;
+    int32 count;
+
+    for (int32 i = 0; message->FindInt32("counts", i, &count) == B_OK; i++) {
+        counts.push_back(count);
+    }
+    if (counts.empty()) {
+        counts = { 10, 100, 1000 };
+    }
+
+    status_t result = B_OK;
+
+    for (size_t c = 0; c < counts.size() && result == B_OK; c++) {
+        int32 targetCount = counts[c];
+
+        BPath path(*basePath);
+        path.Append(BString("resolve-") << targetCount);
+
+        BDirectory dir;
+        result = dir.CreateDirectory(path.Path(), NULL);
+        if (result != B_OK && result != B_FILE_EXISTS) {
+            ERROR("failed to set up benchmark directory %s: %s\n", path.Path(), strerror(result));
+            break;
+        }
+        dir.SetTo(path.Path());
+
+        // set up targets
+        BStringList ids;
+        for (int32 i = 0; i < targetCount; i++) {
+            BString name("target-");
+            name << i;
+
+            BFile file(&dir, name.String(), B_CREATE_FILE | B_READ_WRITE);
+            BEntry entry(&dir, name.String());
+            entry_ref ref;
+            char id[SEN_ID_LEN];
+
+            if ((result = file.InitCheck()) == B_OK && (result = entry.GetRef(&ref)) == B_OK)
+                result = relationHandler->GetOrCreateId(&ref, id, true);
+
+            if (result != B_OK) {
+                ERROR("failed to set up benchmark target %s: %s\n", name.String(), strerror(result));
+                break;
+            }
+            ids.Add(id);
+        }
+
+        if (result == B_OK) {
+            // untimed warm-up pass, so neither variant pays for cold caches of the other
+            BMessage warmUp;
+            relationHandler->QueryForSenIds(&ids, &warmUp);
+
+            bigtime_t perIdTime = 0;
+            bigtime_t chunkedTime = 0;
+            int32 perIdResolved = 0;
+            int32 chunkedQueries = 0;
+            BMessage idToRef;
+
+            // alternate the order per run to even out any remaining bias
+            for (int32 pass = 0; pass < 2 && result == B_OK; pass++) {
+                bool perIdPass = (pass + c) % 2 == 0;
+                bigtime_t start = system_time();
+
+                if (perIdPass) {
+                    // one query per ID, like ResolveRelationTargets used to do
+                    for (int32 i = 0; i < ids.CountStrings(); i++) {
+                        entry_ref ref;
+                        if (relationHandler->QueryForSenId(ids.StringAt(i).String(), &ref) == B_OK)
+                            perIdResolved++;
+                    }
+                    perIdTime = system_time() - start;
+                } else {
+                    // chunked OR-queries
+                    result = relationHandler->QueryForSenIds(&ids, &idToRef, &chunkedQueries);
+                    chunkedTime = system_time() - start;
+                }
+            }
+
+            BMessage benchmarkResult;
+            benchmarkResult.AddInt32("count", targetCount);
+            benchmarkResult.AddInt32("perIdQueries", ids.CountStrings());
+            benchmarkResult.AddInt32("perIdResolved", perIdResolved);
+            benchmarkResult.AddInt64("perIdTime", perIdTime);
+            benchmarkResult.AddInt32("chunkedQueries", chunkedQueries);
+            benchmarkResult.AddInt32("chunkedResolved", idToRef.CountNames(B_REF_TYPE));
+            benchmarkResult.AddInt64("chunkedTime", chunkedTime);
+            reply->AddMessage("benchmark", &benchmarkResult);
+
+            LOG("resolved %d targets: per ID %" B_PRId64 "us with %d queries, "
+                "chunked %" B_PRId64 "us with %d queries.\n",
+                targetCount, perIdTime, ids.CountStrings(), chunkedTime, chunkedQueries);
+        }
+
+        // clean up, collect first as removing entries while iterating the directory may skip some
+        std::vector<entry_ref> refs;
+        entry_ref ref;
+        dir.Rewind();
+        while (dir.GetNextRef(&ref) == B_OK) {
+            refs.push_back(ref);
+        }
+        for (const entry_ref& targetRef : refs) {
+            BEntry entry(&targetRef);
+            entry.Remove();
+        }
+        BEntry dirEntry(path.Path());
+        dirEntry.Remove();
+    }
+
+    return result;
+}
+
+struct relation_stress_job {
+    RelationHandler*    handler;
+    entry_ref           source;
+    entry_ref           target;
+    const char*         relationType;
+    int32               thread;
+    int32               iterations;
+    int32               failed;
+};
+
+static status_t relation_stress_thread(void* data)
+{
+    relation_stress_job* job = static_cast<relation_stress_job*>(data);
+
+    for (int32 i = 0; i < job->iterations; i++) {
+        BMessage add(SEN_RELATION_ADD);
+        add.AddRef(SEN_RELATION_SOURCE_REF, &job->source);
+        add.AddRef(SEN_RELATION_TARGET_REF, &job->target);
+        add.AddString(SEN_RELATION_TYPE, job->relationType);
+
+        // unique properties, so every call adds a new relation instance
+        BMessage properties;
+        properties.AddString("stress", BString() << job->thread << ":" << i);
+        add.AddMessage(SEN_RELATION_PROPERTIES, &properties);
+
+        BMessage reply;
+        if (job->handler->AddRelation(&add, &reply) != B_OK)
+            job->failed++;
+    }
+
+    return B_OK;
+}
+
+/**
+ * add relations between the same two nodes from "threads" threads (default 8) in both
+ * directions, "iterations" times each (default 50), and verify no relation got lost.
+ * The relation type to use must be passed in as "relationType".
+ */
+status_t SenServer::StressRelationWrites(const BPath* basePath, const BMessage* message, BMessage* reply)
+{
+    const char* relationType;
+    if (message->FindString("relationType", &relationType) != B_OK) {
+        ERROR("missing relationType parameter for relation stress test.\n");
+        return B_BAD_VALUE;
+    }
+
+    int32 threadCount = message->GetInt32("threads", 8);
+    int32 iterations  = message->GetInt32("iterations", 50);
+
+    // set up a fresh pair of nodes
+    entry_ref refs[2];
+    BDirectory dir(basePath->Path());
+    const char* names[2] = { "stress-a", "stress-b" };
+
+    for (int32 i = 0; i < 2; i++) {
+        BEntry entry(&dir, names[i]);
+        entry.Remove();
+
+        BFile file;
+        status_t result = dir.CreateFile(names[i], &file, true);
+        if (result == B_OK)
+            result = entry.SetTo(&dir, names[i]);
+        if (result == B_OK)
+            result = entry.GetRef(&refs[i]);
+
+        if (result != B_OK) {
+            ERROR("failed to set up stress test file %s: %s\n", names[i], strerror(result));
+            return result;
+        }
+    }
+
+    std::vector<relation_stress_job> jobs(threadCount);
+    std::vector<thread_id> threads;
+
+    bigtime_t start = system_time();
+
+    for (int32 t = 0; t < threadCount; t++) {
+        relation_stress_job& job = jobs[t];
+        job.handler      = relationHandler;
+        job.source       = refs[t % 2];
+        job.target       = refs[(t + 1) % 2];
+        job.relationType = relationType;
+        job.thread       = t;
+        job.iterations   = iterations;
+        job.failed       = 0;
+
+        thread_id thread = spawn_thread(relation_stress_thread, "sen relation stress", B_NORMAL_PRIORITY, &job);
+        if (thread >= 0 && resume_thread(thread) == B_OK)
+            threads.push_back(thread);
+    }
+
+    for (thread_id thread : threads) {
+        status_t exitValue;
+        wait_for_thread(thread, &exitValue);
+    }
+
+    bigtime_t duration = system_time() - start;
+
+    // count the relation instances each direction must hold now
+    int32 expected[2] = { 0, 0 };
+    int32 failed = 0;
+
+    for (size_t t = 0; t < threads.size(); t++) {
+        expected[t % 2] += iterations;
+        failed += jobs[t].failed;
+    }
+
+    int32 lost = 0;
+
+    for (int32 i = 0; i < 2; i++) {
+        BMessage get(SEN_RELATIONS_GET);
+        get.AddRef(SEN_RELATION_SOURCE_REF, &refs[i]);
+        get.AddString(SEN_RELATION_TYPE, relationType);
+
+        BMessage relationsReply, relations;
+        relationHandler->GetRelationsOfType(&get, &relationsReply);
+        relationsReply.FindMessage(SEN_RELATIONS, &relations);
+
+        // relations are keyed by target ID, each holding one message per relation instance
+        int32 found = 0;
+        char* targetId;
+        type_code type;
+        int32 count;
+
+        for (int32 n = 0; relations.GetInfo(B_MESSAGE_TYPE, n, &targetId, &type, &count) == B_OK; n++) {
+            BMessage properties;
+            for (int32 p = 0; relations.FindMessage(targetId, p, &properties) == B_OK; p++) {
+                if (properties.HasString("stress"))
+                    found++;
+            }
+        }
+
+        LOG("%s: found %d of %d relation(s).\n", names[i], found, expected[i]);
+        lost += expected[i] - found;
+
+        BEntry(&refs[i]).Remove();
+    }
+
+    BMessage stressResult;
+    stressResult.AddInt32("threads", threads.size());
+    stressResult.AddInt32("iterations", iterations);
+    stressResult.AddInt64("time", duration);
+    stressResult.AddInt32("failed", failed);
+    stressResult.AddInt32("lost", lost);
+    reply->AddMessage("benchmark", &stressResult);
+
+    LOG("relation stress test: %d thread(s) x %d in %" B_PRId64 "us, %d failed, %d lost.\n",
+        (int32)threads.size(), iterations, duration, failed, lost);
+
+    return (failed == 0 && lost == 0) ? B_OK : B_ERROR;
+}
+
+// chained relations with a repeated and a reversed one, as (source, target, properties) node indices
+static const int32 kBatchNodes = 4;
+static const int32 kBatchEdges[][3] = {
+    { 0, 1, 0 }, { 1, 2, 1 }, { 2, 3, 2 }, { 0, 2, 3 }, { 3, 0, 4 }, { 0, 1, 0 }, { 1, 0, 6 }
+};
+
+/**
+ * collect the relations of `ref` as "target index:property hash" strings, so relations of two
+ * node sets with different IDs can be compared.
+ */
+static void batch_relation_keys(RelationHandler* handler, const entry_ref* ref, const char* relationType,
+    const BStringList* ids, std::vector<std::string>* keys)
+{
+    BMessage get(SEN_RELATIONS_GET);
+    get.AddRef(SEN_RELATION_SOURCE_REF, ref);
+    get.AddString(SEN_RELATION_TYPE, relationType);
+
+    BMessage relationsReply, relations;
+    handler->GetRelationsOfType(&get, &relationsReply);
+    relationsReply.FindMessage(SEN_RELATIONS, &relations);
+
+    char* targetId;
+    type_code type;
+    int32 count;
+
+    for (int32 n = 0; relations.GetInfo(B_MESSAGE_TYPE, n, &targetId, &type, &count) == B_OK; n++) {
+        BMessage properties;
+        for (int32 p = 0; relations.FindMessage(targetId, p, &properties) == B_OK; p++) {
+            BString key;
+            key << ids->IndexOf(targetId) << ":" << RelationCache::HashProperties(&properties);
+            keys->push_back(key.String());
+        }
+    }
+
+    std::sort(keys->begin(), keys->end());
+}
+
+/**
+ * add the same chained relations to two fresh sets of nodes, once one by one and once as a
+ * single batch, and verify every node ends up with the same relations.
+ * The relation type to use must be passed in as "relationType".
+ */
+status_t SenServer::VerifyRelationBatch(const BPath* basePath, const BMessage* message, BMessage* reply)
+{
+    const char* relationType;
+    if (message->FindString("relationType", &relationType) != B_OK) {
+        ERROR("missing relationType parameter for relation batch test.\n");
+        return B_BAD_VALUE;
+    }
+
+    // set up fresh nodes for sequential adds (set 0) and the batch (set 1)
+    entry_ref refs[2][kBatchNodes];
+    BDirectory dir(basePath->Path());
+
+    for (int32 set = 0; set < 2; set++) {
+        for (int32 i = 0; i < kBatchNodes; i++) {
+            BString name;
+            name << (set == 0 ? "batch-single-" : "batch-all-") << i;
+
+            BEntry entry(&dir, name.String());
+            entry.Remove();
+
+            BFile file;
+            status_t result = dir.CreateFile(name.String(), &file, true);
+            if (result == B_OK)
+                result = entry.SetTo(&dir, name.String());
+            if (result == B_OK)
+                result = entry.GetRef(&refs[set][i]);
+
+            if (result != B_OK) {
+                ERROR("failed to set up batch test file %s: %s\n", name.String(), strerror(result));
+                return result;
+            }
+        }
+    }
+
+    int32 edgeCount = sizeof(kBatchEdges) / sizeof(kBatchEdges[0]);
+    BMessage batch(SEN_RELATIONS_ADD_BATCH);
+
+    for (int32 e = 0; e < edgeCount; e++) {
+        BMessage properties;
+        properties.AddString("edge", BString() << kBatchEdges[e][2]);
+
+        BMessage add(SEN_RELATION_ADD), addReply;
+        add.AddRef(SEN_RELATION_SOURCE_REF, &refs[0][kBatchEdges[e][0]]);
+        add.AddRef(SEN_RELATION_TARGET_REF, &refs[0][kBatchEdges[e][1]]);
+        add.AddString(SEN_RELATION_TYPE, relationType);
+        add.AddMessage(SEN_RELATION_PROPERTIES, &properties);
+        relationHandler->AddRelation(&add, &addReply);
+
+        batch.AddRef(SEN_RELATION_SOURCE_REF, &refs[1][kBatchEdges[e][0]]);
+        batch.AddRef(SEN_RELATION_TARGET_REF, &refs[1][kBatchEdges[e][1]]);
+        batch.AddString(SEN_RELATION_TYPE, relationType);
+        batch.AddMessage(SEN_RELATION_PROPERTIES, &properties);
+    }
+
+    BMessage batchReply;
+    status_t result = relationHandler->AddRelations(&batch, &batchReply);
+    int32 failed = batchReply.GetInt32("failed", 0);
+
+    // compare node by node, with target IDs mapped to node indices
+    BStringList ids[2];
+    for (int32 set = 0; set < 2; set++) {
+        for (int32 i = 0; i < kBatchNodes; i++) {
+            char id[SEN_ID_LEN];
+            if (relationHandler->GetOrCreateId(&refs[set][i], id, false) != B_OK)
+                id[0] = '\0';
+            ids[set].Add(id);
+        }
+    }
+
+    int32 mismatches = 0;
+
+    for (int32 i = 0; i < kBatchNodes; i++) {
+        std::vector<std::string> keys[2];
+        for (int32 set = 0; set < 2; set++) {
+            batch_relation_keys(relationHandler, &refs[set][i], relationType, &ids[set], &keys[set]);
+        }
+
+        if (keys[0] != keys[1]) {
+            ERROR("batch test: node %d has %zu relation(s) after single adds but %zu after the batch.\n",
+                i, keys[0].size(), keys[1].size());
+            mismatches++;
+        }
+    }
+
+    for (int32 set = 0; set < 2; set++) {
+        for (int32 i = 0; i < kBatchNodes; i++) {
+            BEntry(&refs[set][i]).Remove();
+        }
+    }
+
+    BMessage batchResult;
+    batchResult.AddInt32("items", edgeCount);
+    batchResult.AddInt32("failed", failed);
+    batchResult.AddInt32("mismatches", mismatches);
+    reply->AddMessage("benchmark", &batchResult);
+
+    LOG("relation batch test: %d item(s), %d failed, %d node(s) differ from single adds.\n",
+        edgeCount, failed, mismatches);
+
+    return (result == B_OK && failed == 0 && mismatches == 0) ? B_OK : B_ERROR;
+}
+
+static void send_query_update(RelationHandler* handler, int32 opcode, const entry_ref* ref, const node_ref* nodeRef)
+{
+    BMessage update(B_QUERY_UPDATE);
+    update.AddInt32("opcode", opcode);
+    update.AddInt32("device", ref->device);
+    update.AddInt64("directory", ref->directory);
+    update.AddInt64("node", nodeRef->node);
+    update.AddString("name", ref->name);
+
+    handler->UpdateIndices(&update);
+}
+
+/**
+ * copy a file with relations and strip the copy's SEN attributes like the server does,
+ * replaying the live query updates this causes, then check the original's inverse relation
+ * is still found in the target index. Needs "relationType".
+ */
+status_t SenServer::VerifyTargetIndexCopy(const BPath* basePath, const BMessage* message, BMessage* reply)
+{
+    const char* relationType;
+    if (message->FindString("relationType", &relationType) != B_OK) {
+        ERROR("missing relationType parameter for target index copy test.\n");
+        return B_BAD_VALUE;
+    }
+
+    // the index is built in the background, without it inverse lookups fall back to a query
+    bigtime_t deadline = system_time() + 10000000;
+    BMessage stats;
+    relationHandler->GetCacheStats(&stats);
+    while (! stats.GetBool("targetIndexReady", false) && system_time() < deadline) {
+        snooze(100000);
+        stats.MakeEmpty();
+        relationHandler->GetCacheStats(&stats);
+    }
+    if (! stats.GetBool("targetIndexReady", false)) {
+        ERROR("target index copy test: relation target index not ready.\n");
+        return B_NOT_INITIALIZED;
+    }
+
+    const char* names[] = { "copy-source", "copy-target", "copy-copy" };
+    entry_ref refs[3];
+    node_ref  nodeRefs[3];
+    BDirectory dir(basePath->Path());
+
+    for (int32 i = 0; i < 3; i++) {
+        BEntry entry(&dir, names[i]);
+        entry.Remove();
+
+        BFile file;
+        status_t result = dir.CreateFile(names[i], &file, true);
+        if (result == B_OK)
+            result = entry.SetTo(&dir, names[i]);
+        if (result == B_OK)
+            result = entry.GetRef(&refs[i]);
+        if (result == B_OK)
+            result = file.GetNodeRef(&nodeRefs[i]);
+
+        if (result != B_OK) {
+            ERROR("failed to set up copy test file %s: %s\n", names[i], strerror(result));
+            return result;
+        }
+    }
+
+    BMessage add(SEN_RELATION_ADD), addReply;
+    add.AddRef(SEN_RELATION_SOURCE_REF, &refs[0]);
+    add.AddRef(SEN_RELATION_TARGET_REF, &refs[1]);
+    add.AddString(SEN_RELATION_TYPE, relationType);
+    status_t result = relationHandler->AddRelation(&add, &addReply);
+
+    char sourceId[SEN_ID_LEN], targetId[SEN_ID_LEN];
+    if (result == B_OK)
+        result = relationHandler->GetOrCreateId(&refs[0], sourceId, false);
+    if (result == B_OK)
+        result = relationHandler->GetOrCreateId(&refs[1], targetId, false);
+
+    // copy all attributes of the source including its SEN:ID, like Tracker does
+    BNode source(&refs[0]), copy(&refs[2]);
+    char attrName[B_ATTR_NAME_LENGTH];
+
+    while (result == B_OK && source.GetNextAttrName(attrName) == B_OK) {
+        attr_info info;
+        if ((result = source.GetAttrInfo(attrName, &info)) != B_OK)
+            break;
+
+        std::vector<char> buffer(info.size);
+        ssize_t size = source.ReadAttr(attrName, info.type, 0, buffer.data(), info.size);
+        if (size < 0 || copy.WriteAttr(attrName, info.type, 0, buffer.data(), size) != size)
+            result = B_IO_ERROR;
+    }
+
+    bool found = false;
+
+    if (result == B_OK) {
+        send_query_update(relationHandler, B_ENTRY_CREATED, &refs[2], &nodeRefs[2]);
+
+        if (RemoveSenAttrs(&copy) < 0)
+            result = B_IO_ERROR;
+        send_query_update(relationHandler, B_ENTRY_REMOVED, &refs[2], &nodeRefs[2]);
+
+        BMessage idToRef;
+        entry_ref ref;
+        if (result == B_OK && relationHandler->QueryForTargetsById(targetId, &idToRef) == B_OK)
+            found = idToRef.FindRef(sourceId, &ref) == B_OK && ref == refs[0];
+    }
+
+    for (int32 i = 0; i < 3; i++) {
+        BEntry(&refs[i]).Remove();
+    }
+
+    BMessage copyResult;
+    copyResult.AddBool("inverseFound", found);
+    reply->AddMessage("benchmark", &copyResult);
+
+    LOG("target index copy test: inverse relation of the original %s after stripping the copy.\n",
+        found ? "kept" : "lost");
+
+    if (result != B_OK) {
+        ERROR("target index copy test failed: %s\n", strerror(result));
+        return result;
+    }
+
+    return found ? B_OK : B_ERROR;
+}
+
+/**
+ * generate "count" IDs (default 1M) in memory, one by one and in batches, and report
+ * throughput, duplicates and generator counters. Runs in the current ID generator mode,
+ * or in the mode given by "monotonic", which is only switched for the run and restored after.
+ */
+status_t SenServer::BenchmarkIdGeneration(const BMessage* message, BMessage* reply)
+{
+    int32 count = message->GetInt32("count", 1000000);
+    if (count <= 0)
+        return B_BAD_VALUE;
+
+    bool previousMonotonic = relationHandler->IsMonotonicIds();
+    bool monotonic = message->GetBool("monotonic", previousMonotonic);
+    if (monotonic != previousMonotonic)
+        relationHandler->SetMonotonicIds(monotonic);
+
+    std::vector<uint64> ids(count);
+
+    bigtime_t start = system_time();
+    for (int32 i = 0; i < count; i++) {
+        ids[i] = relationHandler->GenerateRawId();
+    }
+    bigtime_t singleTime = system_time() - start;
+
+    std::vector<uint64> batchIds(count);
+
+    start = system_time();
+    relationHandler->GenerateRawIds(batchIds.data(), count);
+    bigtime_t batchTime = system_time() - start;
+
+    ids.insert(ids.end(), batchIds.begin(), batchIds.end());
+    std::sort(ids.begin(), ids.end());
+    int64 duplicates = ids.size() - (std::unique(ids.begin(), ids.end()) - ids.begin());
+
+    BMessage benchmarkResult;
+    benchmarkResult.AddInt32("count", count);
+    benchmarkResult.AddInt64("singleTime", singleTime);
+    benchmarkResult.AddDouble("singleThroughput", singleTime > 0 ? count * 1000000.0 / singleTime : 0.0);
+    benchmarkResult.AddInt64("batchTime", batchTime);
+    benchmarkResult.AddDouble("batchThroughput", batchTime > 0 ? count * 1000000.0 / batchTime : 0.0);
+    benchmarkResult.AddInt64("duplicates", duplicates);
+
+    BMessage idStats;
+    relationHandler->GetIdStats(&idStats);
+    benchmarkResult.AddMessage("ids", &idStats);
+    reply->AddMessage("benchmark", &benchmarkResult);
+
+    if (monotonic != previousMonotonic)
+        relationHandler->SetMonotonicIds(previousMonotonic);
+
+    LOG("generated 2x %d IDs: single %" B_PRId64 "us, batch %" B_PRId64 "us, %" B_PRId64 " duplicate(s).\n",
+        count, singleTime, batchTime, duplicates);
+
+    return duplicates == 0 ? B_OK : B_ERROR;
+}
+
 int32 SenServer::RemoveSenAttrs(BNode* node) {
     char attrName[B_ATTR_NAME_LENGTH];
     int attrCount = 0;
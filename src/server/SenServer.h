@@ -13,6 +13,9 @@
 
 #include <Application.h>
 #include <File.h>
+#include <Path.h>
+
+class RequestDispatcher;
 
 class SenServer : public BApplication {
 
@@ -21,12 +24,23 @@ virtual		~SenServer();
 
 virtual	void ReadyToRun();
 virtual	void MessageReceived(BMessage* message);
+        /**
+         * process a request and send the reply, called from the application thread or a worker.
+         */
+        void HandleRequest(BMessage* message);
 
 private:
     int32               RemoveSenAttrs(BNode* node);
+    status_t            BenchmarkIdResolution(const BPath* basePath, const BMessage* message, BMessage* reply);
+    status_t            BenchmarkIdGeneration(const BMessage* message, BMessage* reply);
+    status_t            StressRelationWrites(const BPath* basePath, const BMessage* message, BMessage* reply);
+    status_t            VerifyRelationBatch(const BPath* basePath, const BMessage* message, BMessage* reply);
+    status_t            VerifyTargetIndexCopy(const BPath* basePath, const BMessage* message, BMessage* reply);
 
     RelationHandler*    relationHandler;
     SenConfigHandler*   senConfigHandler;
+    RequestDispatcher*  dispatcher;
+    status_t            relationStatus;     // result of setting up the relation indices
 };
 
 #endif // _SEMANTIC_SERVER_H
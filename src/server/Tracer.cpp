@@ -0,0 +1,165 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "Tracer.h"
+
+enum trace_record_kind {
+    SEN_TRACE_KIND_TEXT = 0,
+    SEN_TRACE_KIND_MESSAGE,
+    SEN_TRACE_KIND_TRUNCATED    // message too large for a slot
+};
+
+struct trace_record {
+    int64       sequence;   // 0 if empty, negative while being written
+    bigtime_t   when;
+    thread_id   thread;
+    int32       level;
+    int32       kind;
+    const char* label;      // string literal
+    uint32      what;
+    ssize_t     size;
+    char        data[SEN_TRACE_RECORD_SIZE];
+};
+
+static trace_record sRecords[SEN_TRACE_RECORDS];
+static int64        sNextSequence = 0;
+
+/**
+ * claim the next slot. Should a writer lap a slower one on the same slot, the reader may see
+ * a mixed record, which is then rejected by Unflatten() or shows up as garbled text.
+ */
+static trace_record* begin_record(int32 level, const char* label, int32 kind)
+{
+    int64 sequence = atomic_add64(&sNextSequence, 1) + 1;
+    trace_record* record = &sRecords[sequence % SEN_TRACE_RECORDS];
+
+    atomic_set64(&record->sequence, -sequence);
+
+    record->when   = system_time();
+    record->thread = find_thread(NULL);
+    record->level  = level;
+    record->kind   = kind;
+    record->label  = label;
+    record->what   = 0;
+    record->size   = 0;
+
+    return record;
+}
+
+static void end_record(trace_record* record)
+{
+    atomic_set64(&record->sequence, -atomic_get64(&record->sequence));
+}
+
+void Tracer::RecordMessage(int32 level, const char* label, const BMessage* message)
+{
+    if (message == NULL)
+        return;
+
+    ssize_t size = message->FlattenedSize();
+    trace_record* record = begin_record(level, label,
+        size <= SEN_TRACE_RECORD_SIZE ? SEN_TRACE_KIND_MESSAGE : SEN_TRACE_KIND_TRUNCATED);
+
+    record->what = message->what;
+    record->size = size;
+
+    if (record->kind == SEN_TRACE_KIND_MESSAGE && message->Flatten(record->data, size) != B_OK)
+        record->kind = SEN_TRACE_KIND_TRUNCATED;
+
+    end_record(record);
+}
+
+void Tracer::RecordText(int32 level, const char* label, const char* format, ...)
+{
+    trace_record* record = begin_record(level, label, SEN_TRACE_KIND_TEXT);
+
+    va_list args;
+    va_start(args, format);
+    record->size = vsnprintf(record->data, SEN_TRACE_RECORD_SIZE, format, args);
+    va_end(args);
+
+    end_record(record);
+}
+
+void Tracer::Dump(BMessage* reply, int64 since, bool toStdout)
+{
+    int64 last  = atomic_get64(&sNextSequence);
+    int64 first = last - SEN_TRACE_RECORDS + 1;
+    if (first <= since)
+        first = since + 1;
+    if (first < 1)
+        first = 1;
+
+    // copied out of the buffer before use, the slot may be overwritten anytime
+    trace_record* copy = new trace_record;
+
+    for (int64 sequence = first; sequence <= last; sequence++) {
+        trace_record* record = &sRecords[sequence % SEN_TRACE_RECORDS];
+
+        if (atomic_get64(&record->sequence) != sequence)
+            continue;
+        memcpy(copy, record, sizeof(trace_record));
+        if (atomic_get64(&record->sequence) != sequence)
+            continue;
+
+        BMessage entry;
+        entry.AddInt64("sequence", sequence);
+        entry.AddInt64("when", copy->when);
+        entry.AddInt32("thread", copy->thread);
+        entry.AddInt32("level", copy->level);
+        entry.AddString("label", copy->label);
+
+        if (toStdout) {
+            printf("[%" B_PRId64 "] %" B_PRId64 " thread %" B_PRId32 " %s: ",
+                sequence, copy->when, copy->thread, copy->label);
+        }
+
+        switch (copy->kind) {
+            case SEN_TRACE_KIND_TEXT:
+            {
+                copy->data[SEN_TRACE_RECORD_SIZE - 1] = '\0';
+                entry.AddString("text", copy->data);
+                if (toStdout)
+                    printf("%s\n", copy->data);
+                break;
+            }
+            case SEN_TRACE_KIND_MESSAGE:
+            {
+                BMessage message;
+                if (message.Unflatten(copy->data) != B_OK) {
+                    entry.AddBool("corrupt", true);
+                    if (toStdout)
+                        printf("<corrupt record>\n");
+                    break;
+                }
+                entry.AddMessage("message", &message);
+                if (toStdout)
+                    message.PrintToStream();
+                break;
+            }
+            default:
+            {
+                entry.AddInt32("what", copy->what);
+                entry.AddInt64("size", copy->size);
+                entry.AddBool("truncated", true);
+                if (toStdout) {
+                    printf("<message 0x%08" B_PRIx32 " of %zd bytes not recorded>\n", copy->what, copy->size);
+                }
+            }
+        }
+
+        reply->AddMessage("record", &entry);
+    }
+
+    delete copy;
+
+    // pass as "since" to get only newer records next time
+    reply->AddInt64("last", last);
+}
@@ -0,0 +1,77 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#pragma once
+
+#include <Message.h>
+#include <OS.h>
+
+// dump the trace buffer, optionally only records after sequence "since" and/or to stdout
+#ifndef SEN_CORE_TRACE_DUMP
+#define SEN_CORE_TRACE_DUMP         'SCtd'
+#endif
+
+#define SEN_TRACE_LEVEL_NONE        0
+#define SEN_TRACE_LEVEL_ERROR       1
+#define SEN_TRACE_LEVEL_INFO        2   // requests and replies
+#define SEN_TRACE_LEVEL_DEBUG       3   // internal messages like configs and properties
+
+// records at higher levels are compiled out entirely
+#ifndef SEN_TRACE_LEVEL
+#ifdef TRACING
+#define SEN_TRACE_LEVEL             SEN_TRACE_LEVEL_DEBUG
+#else
+#define SEN_TRACE_LEVEL             SEN_TRACE_LEVEL_INFO
+#endif
+#endif
+
+#define SEN_TRACE_RECORDS           512
+#define SEN_TRACE_RECORD_SIZE       2048
+
+/**
+ * record a copy of `message` in the trace buffer, e.g. TRACE_MSG(SEN_TRACE_LEVEL_INFO, "request", message).
+ * `label` must be a string literal.
+ */
+#define TRACE_MSG(level, label, message) \
+    do { \
+        if ((level) <= SEN_TRACE_LEVEL) \
+            Tracer::RecordMessage((level), (label), (message)); \
+    } while (0)
+
+/**
+ * record a printf style text in the trace buffer.
+ */
+#define TRACE_TEXT(level, label, ...) \
+    do { \
+        if ((level) <= SEN_TRACE_LEVEL) \
+            Tracer::RecordText((level), (label), __VA_ARGS__); \
+    } while (0)
+
+/**
+ * in-memory trace of requests, replies and internal messages, cheap enough to stay enabled
+ * in production.
+ *
+ * Records go to a fixed ring buffer of SEN_TRACE_RECORDS slots without locking: writers claim
+ * a slot with an atomic counter and publish it with a sequence number, readers skip slots
+ * that are being written. Messages are stored flattened and only formatted when the buffer
+ * is dumped, messages larger than a slot are recorded with their size and what code only.
+ */
+class Tracer {
+
+public:
+    static void     RecordMessage(int32 level, const char* label, const BMessage* message);
+    static void     RecordText(int32 level, const char* label, const char* format, ...)
+                        __attribute__((format(printf, 3, 4)));
+
+    /**
+     * add all records with a sequence number greater than `since` to `reply`, oldest first.
+     * Each record holds sequence, time, thread, level, label and either the unflattened
+     * "message" or the "text".
+     *
+     * @param toStdout  additionally print all records to stdout.
+     */
+    static void     Dump(BMessage* reply, int64 since = 0, bool toStdout = false);
+};
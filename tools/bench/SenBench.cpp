@@ -0,0 +1,342 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+/**
+ * end-to-end benchmark of the relation API of a running SEN server.
+ *
+ * Generates a synthetic corpus, adds all planned relations through the server and then measures
+ * every relation message type. Results are written as one JSON object per line, so runs can be
+ * collected and compared across versions.
+ */
+
+#include <Directory.h>
+#include <Entry.h>
+#include <FindDirectory.h>
+#include <Messenger.h>
+#include <OS.h>
+#include <Path.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "../common/Corpus.h"
+#include "../common/Json.h"
+#include "../common/LatencyRecorder.h"
+#include <sen/Sen.h>
+
+struct bench_options {
+    corpus_options  corpus;
+    int32           requests    = 1000;
+    BString         directory;
+    BString         output;
+    bool            keep        = false;
+};
+
+static void PrintUsage()
+{
+    fprintf(stderr,
+        "usage: sen_bench [options]\n"
+        "  --files <n>            number of files, default 1000\n"
+        "  --hubs <n>             number of hub files most relations point to, default 10\n"
+        "  --file-type <mime>     MIME type of regular files, default text/plain\n"
+        "  --hub-type <mime>      MIME type of hub files, default text/plain\n"
+        "  --types <t1,t2,...>    relation types, default all installed relation types\n"
+        "  --distribution <d>     out-degree distribution, uniform or powerlaw (default)\n"
+        "  --degree <n>           average out-degree for uniform distribution, default 4\n"
+        "  --alpha <a>            power law exponent, default 2\n"
+        "  --hub-share <f>        share of relations pointing to hubs, default 0.5\n"
+        "  --property-size <n>    size of relation properties in bytes, default 64\n"
+        "  --seed <n>             random seed, default 1\n"
+        "  --requests <n>         requests per measured message type, default 1000\n"
+        "  --dir <path>           corpus directory, default <temp>/sen/bench-corpus\n"
+        "  --output <file>        append results to file instead of stdout\n"
+        "  --keep                 keep the corpus after the run\n");
+}
+
+static status_t ParseOptions(int argc, char** argv, bench_options* options)
+{
+    for (int i = 1; i < argc; i++) {
+        BString option(argv[i]);
+
+        if (option == "--keep") {
+            options->keep = true;
+            continue;
+        }
+        if (option == "--help" || i + 1 >= argc)
+            return B_BAD_VALUE;
+
+        const char* value = argv[++i];
+
+        if (option == "--files")
+            options->corpus.files = atoi(value);
+        else if (option == "--hubs")
+            options->corpus.hubs = atoi(value);
+        else if (option == "--file-type")
+            options->corpus.fileType = value;
+        else if (option == "--hub-type")
+            options->corpus.hubType = value;
+        else if (option == "--types")
+            BString(value).Split(",", true, options->corpus.relationTypes);
+        else if (option == "--distribution") {
+            if (strcmp(value, "uniform") == 0)
+                options->corpus.distribution = SEN_DEGREE_UNIFORM;
+            else if (strcmp(value, "powerlaw") == 0)
+                options->corpus.distribution = SEN_DEGREE_POWERLAW;
+            else
+                return B_BAD_VALUE;
+        }
+        else if (option == "--degree")
+            options->corpus.averageDegree = atof(value);
+        else if (option == "--alpha")
+            options->corpus.alpha = atof(value);
+        else if (option == "--hub-share")
+            options->corpus.hubShare = atof(value);
+        else if (option == "--property-size")
+            options->corpus.propertySize = atoi(value);
+        else if (option == "--seed")
+            options->corpus.seed = strtoul(value, NULL, 10);
+        else if (option == "--requests")
+            options->requests = atoi(value);
+        else if (option == "--dir")
+            options->directory = value;
+        else if (option == "--output")
+            options->output = value;
+        else
+            return B_BAD_VALUE;
+    }
+
+    if (options->corpus.files < 2 || options->requests < 1)
+        return B_BAD_VALUE;
+
+    return B_OK;
+}
+
+static bool IsSuccess(const BMessage& reply)
+{
+    // relation replies carry the result code, errors in the request itself only a message
+    return reply.GetInt32("status", B_OK) == B_OK && ! reply.HasString("error");
+}
+
+/**
+ * send `request` and record its round trip time.
+ */
+static void Measure(BMessenger& server, BMessage* request, LatencyRecorder* recorder)
+{
+    BMessage reply;
+
+    bigtime_t start = system_time();
+    status_t result = server.SendMessage(request, &reply);
+    bigtime_t latency = system_time() - start;
+
+    recorder->Add(latency, result == B_OK && IsSuccess(reply));
+}
+
+static void WriteResult(FILE* out, const char* op, LatencyRecorder* recorder, bigtime_t elapsed)
+{
+    BString json("{\"op\":");
+    AppendJsonString(&json, op);
+    json << ",";
+    recorder->AppendJson(&json, elapsed);
+    json << "}";
+
+    fprintf(out, "%s\n", json.String());
+    fflush(out);
+}
+
+typedef void (*build_request)(Corpus& corpus, BMessage* request);
+
+static void BuildGet(Corpus& corpus, BMessage* request)
+{
+    request->what = SEN_RELATIONS_GET;
+    request->AddRef(SEN_RELATION_SOURCE_REF, corpus.FileAt(corpus.RandomFile(true)));
+    request->AddString(SEN_RELATION_TYPE, corpus.RelationTypeAt(corpus.RandomRelationType()));
+}
+
+static void BuildGetAll(Corpus& corpus, BMessage* request)
+{
+    request->what = SEN_RELATIONS_GET_ALL;
+    request->AddRef(SEN_RELATION_SOURCE_REF, corpus.FileAt(corpus.RandomFile(true)));
+}
+
+// planned relations of non-bidirectional types, the server only resolves inverses for those
+static std::vector<int32> sInverseRelations;
+
+static void BuildInverse(Corpus& corpus, BMessage* request)
+{
+    // ask a target for the type of a relation pointing to it, so inverse relations are resolved
+    const std::vector<corpus_relation>& relations = corpus.Relations();
+    const corpus_relation& relation = relations[sInverseRelations[corpus.RandomIndex(sInverseRelations.size())]];
+
+    request->what = SEN_RELATIONS_GET;
+    request->AddRef(SEN_RELATION_SOURCE_REF, corpus.FileAt(relation.target));
+    request->AddString(SEN_RELATION_TYPE, corpus.RelationTypeAt(relation.type));
+}
+
+static void BuildCompatible(Corpus& corpus, BMessage* request)
+{
+    request->what = SEN_RELATIONS_GET_COMPATIBLE;
+    request->AddRef(SEN_RELATION_SOURCE_REF, corpus.FileAt(corpus.RandomFile()));
+}
+
+static void BuildSelf(Corpus& corpus, BMessage* request)
+{
+    request->what = SEN_RELATIONS_GET_ALL_SELF;
+    request->AddRef(SEN_RELATION_SOURCE_REF, corpus.FileAt(corpus.RandomFile()));
+}
+
+/**
+ * collect the planned relations whose type is not bidirectional, asking the server for the
+ * resolved config of each type used, as types are bidirectional unless configured otherwise.
+ */
+static void FindInverseRelations(BMessenger& server, Corpus& corpus)
+{
+    const std::vector<corpus_relation>& relations = corpus.Relations();
+    std::vector<int32> inverseTypes(corpus.CountRelationTypes(), -1);   // -1 unknown, else 0/1
+
+    for (size_t i = 0; i < relations.size(); i++) {
+        const corpus_relation& relation = relations[i];
+        const char* relationType = corpus.RelationTypeAt(relation.type);
+
+        if (inverseTypes[relation.type] < 0) {
+            BMessage request(SEN_RELATIONS_GET), reply, configMap, config;
+            request.AddRef(SEN_RELATION_SOURCE_REF, corpus.FileAt(relation.source));
+            request.AddString(SEN_RELATION_TYPE, relationType);
+
+            bool inverse = server.SendMessage(&request, &reply) == B_OK
+                && reply.FindMessage(SEN_RELATION_CONFIG_MAP, &configMap) == B_OK
+                && configMap.FindMessage(relationType, &config) == B_OK
+                && ! config.GetBool(SEN_RELATION_IS_BIDIR, true);
+
+            inverseTypes[relation.type] = inverse ? 1 : 0;
+        }
+
+        if (inverseTypes[relation.type] == 1)
+            sInverseRelations.push_back(i);
+    }
+}
+
+static void RunPhase(FILE* out, BMessenger& server, Corpus& corpus, const char* op,
+    build_request build, int32 requests)
+{
+    LatencyRecorder recorder;
+    bigtime_t start = system_time();
+
+    for (int32 i = 0; i < requests; i++) {
+        BMessage request;
+        build(corpus, &request);
+        Measure(server, &request, &recorder);
+    }
+
+    WriteResult(out, op, &recorder, system_time() - start);
+}
+
+static void RunAddPhase(FILE* out, BMessenger& server, Corpus& corpus)
+{
+    LatencyRecorder recorder;
+    bigtime_t start = system_time();
+
+    for (const corpus_relation& relation : corpus.Relations()) {
+        BMessage properties;
+        corpus.GetProperties(relation, &properties);
+
+        BMessage request(SEN_RELATION_ADD);
+        request.AddRef(SEN_RELATION_SOURCE_REF, corpus.FileAt(relation.source));
+        request.AddString(SEN_RELATION_TYPE, corpus.RelationTypeAt(relation.type));
+        request.AddRef(SEN_RELATION_TARGET_REF, corpus.FileAt(relation.target));
+        request.AddMessage(SEN_RELATION_PROPERTIES, &properties);
+
+        Measure(server, &request, &recorder);
+    }
+
+    WriteResult(out, "add", &recorder, system_time() - start);
+}
+
+int main(int argc, char** argv)
+{
+    bench_options options;
+    if (ParseOptions(argc, argv, &options) != B_OK) {
+        PrintUsage();
+        return 1;
+    }
+
+    BMessenger server(SEN_SERVER_SIGNATURE);
+    if (! server.IsValid()) {
+        fprintf(stderr, "SEN server is not running.\n");
+        return 1;
+    }
+
+    BMessage info(SEN_CORE_INFO), infoReply;
+    server.SendMessage(&info, &infoReply);
+
+    if (options.directory.IsEmpty()) {
+        BPath path;
+        if (find_directory(B_SYSTEM_TEMP_DIRECTORY, &path) != B_OK)
+            path.SetTo("/tmp");
+        path.Append("sen/bench-corpus");
+        options.directory = path.Path();
+    }
+
+    FILE* out = stdout;
+    if (! options.output.IsEmpty() && (out = fopen(options.output.String(), "a")) == NULL) {
+        fprintf(stderr, "could not open %s: %s\n", options.output.String(), strerror(errno));
+        return 1;
+    }
+
+    Corpus corpus(options.corpus);
+
+    fprintf(stderr, "generating corpus in %s...\n", options.directory.String());
+    status_t result = corpus.Generate(options.directory.String());
+    if (result != B_OK) {
+        fprintf(stderr, "failed to generate corpus: %s\n", strerror(result));
+        corpus.Remove();
+        return 1;
+    }
+
+    BMessage corpusOptions;
+    corpus.GetOptions(&corpusOptions);
+
+    BString meta("{\"benchmark\":\"sen_bench\",\"version\":");
+    AppendJsonString(&meta, infoReply.GetString("result", "unknown"));
+    meta << ",\"timestamp\":" << (int64)time(NULL)
+         << ",\"requests\":" << options.requests
+         << ",\"corpus\":";
+    AppendJsonObject(&meta, &corpusOptions);
+    meta << "}";
+
+    fprintf(out, "%s\n", meta.String());
+
+    fprintf(stderr, "adding %zu relations...\n", corpus.Relations().size());
+    RunAddPhase(out, server, corpus);
+
+    fprintf(stderr, "measuring %" B_PRId32 " requests per message type...\n", options.requests);
+    if (! corpus.Relations().empty()) {
+        RunPhase(out, server, corpus, "get",     BuildGet,     options.requests);
+        RunPhase(out, server, corpus, "getAll",  BuildGetAll,  options.requests);
+
+        FindInverseRelations(server, corpus);
+        if (! sInverseRelations.empty())
+            RunPhase(out, server, corpus, "inverse", BuildInverse, options.requests);
+        else
+            fprintf(stderr, "no non-bidirectional relation types in corpus, skipping inverse phase.\n");
+    }
+    RunPhase(out, server, corpus, "compatible", BuildCompatible, options.requests);
+    RunPhase(out, server, corpus, "self",       BuildSelf,       options.requests);
+
+    if (out != stdout)
+        fclose(out);
+
+    if (options.keep) {
+        fprintf(stderr, "kept corpus in %s\n", options.directory.String());
+    } else if (corpus.Remove() != B_OK) {
+        fprintf(stderr, "some corpus files could not be removed from %s\n", options.directory.String());
+    }
+
+    return 0;
+}
@@ -0,0 +1,240 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#include <Directory.h>
+#include <File.h>
+#include <Mime.h>
+#include <MimeType.h>
+#include <Path.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "Corpus.h"
+#include <sen/Sen.h>
+
+Corpus::Corpus(const corpus_options& options)
+    : fOptions(options),
+      fRandom(options.seed)
+{
+    if (fOptions.hubs > fOptions.files)
+        fOptions.hubs = fOptions.files;
+    if (fOptions.maxDegree >= fOptions.files)
+        fOptions.maxDegree = fOptions.files - 1;
+}
+
+status_t Corpus::Generate(const char* directory)
+{
+    if (fOptions.files < 2)
+        return B_BAD_VALUE;
+
+    if (fOptions.relationTypes.IsEmpty()) {
+        status_t result = GetInstalledRelationTypes(&fOptions.relationTypes);
+        if (result != B_OK)
+            return result;
+        if (fOptions.relationTypes.IsEmpty()) {
+            fprintf(stderr, "no relation types installed.\n");
+            return B_ENTRY_NOT_FOUND;
+        }
+    }
+
+    status_t result = create_directory(directory, 0755);
+    if (result != B_OK)
+        return result;
+
+    fDirectory = directory;
+    BDirectory dir(directory);
+
+    for (int32 i = 0; i < fOptions.files; i++) {
+        BString name;
+        name.SetToFormat("%s-%06" B_PRId32, i < fOptions.hubs ? "hub" : "file", i);
+
+        BFile file;
+        if ((result = dir.CreateFile(name.String(), &file, false)) != B_OK) {
+            fprintf(stderr, "failed to create %s: %s\n", name.String(), strerror(result));
+            return result;
+        }
+
+        const BString& type = i < fOptions.hubs ? fOptions.hubType : fOptions.fileType;
+        file.WriteAttr("BEOS:TYPE", B_MIME_STRING_TYPE, 0, type.String(), type.Length() + 1);
+
+        BPath path(&dir, name.String());
+
+        entry_ref ref;
+        get_ref_for_path(path.Path(), &ref);
+        fFiles.push_back(ref);
+    }
+
+    // plan relations, the same relation may come up twice just like in real use
+    for (int32 source = 0; source < fOptions.files; source++) {
+        int32 degree = _OutDegree();
+
+        for (int32 d = 0; d < degree; d++) {
+            corpus_relation relation;
+            relation.source = source;
+            relation.target = _Target(source);
+            relation.type   = RandomRelationType();
+
+            fRelations.push_back(relation);
+        }
+    }
+
+    return B_OK;
+}
+
+status_t Corpus::Remove()
+{
+    status_t result = B_OK;
+
+    for (const entry_ref& ref : fFiles) {
+        BEntry entry(&ref);
+        if (entry.Remove() != B_OK)
+            result = B_ERROR;
+    }
+    fFiles.clear();
+
+    if (! fDirectory.IsEmpty()) {
+        BEntry dir(fDirectory.String());
+        dir.Remove();   // only succeeds if nothing else was put there
+    }
+
+    return result;
+}
+
+int32 Corpus::CountFiles() const
+{
+    return fFiles.size();
+}
+
+const entry_ref* Corpus::FileAt(int32 index) const
+{
+    return &fFiles[index];
+}
+
+bool Corpus::IsHub(int32 index) const
+{
+    return index < fOptions.hubs;
+}
+
+int32 Corpus::CountRelationTypes() const
+{
+    return fOptions.relationTypes.CountStrings();
+}
+
+const char* Corpus::RelationTypeAt(int32 index) const
+{
+    return fOptions.relationTypes.StringAt(index).String();
+}
+
+const std::vector<corpus_relation>& Corpus::Relations() const
+{
+    return fRelations;
+}
+
+void Corpus::GetProperties(const corpus_relation& relation, BMessage* properties) const
+{
+    BString label;
+    label.SetToFormat("%" B_PRId32 "->%" B_PRId32 " ", relation.source, relation.target);
+
+    // pad to the configured size, keeping the unique prefix
+    while (label.Length() < fOptions.propertySize) {
+        label << "x";
+    }
+
+    properties->AddString("label", label);
+}
+
+int32 Corpus::RandomFile(bool preferLinked)
+{
+    if (preferLinked && ! fRelations.empty()) {
+        std::uniform_int_distribution<size_t> pick(0, fRelations.size() - 1);
+        return fRelations[pick(fRandom)].source;
+    }
+
+    std::uniform_int_distribution<int32> pick(0, fFiles.size() - 1);
+    return pick(fRandom);
+}
+
+int32 Corpus::RandomRelationType()
+{
+    std::uniform_int_distribution<int32> pick(0, fOptions.relationTypes.CountStrings() - 1);
+    return pick(fRandom);
+}
+
+int32 Corpus::RandomIndex(int32 count)
+{
+    std::uniform_int_distribution<int32> pick(0, count - 1);
+    return pick(fRandom);
+}
+
+void Corpus::GetOptions(BMessage* options) const
+{
+    options->AddInt32("files", fOptions.files);
+    options->AddInt32("hubs", fOptions.hubs);
+    options->AddInt32("relations", fRelations.size());
+    options->AddString("distribution", fOptions.distribution == SEN_DEGREE_POWERLAW ? "powerlaw" : "uniform");
+    options->AddDouble("averageDegree", fOptions.averageDegree);
+    options->AddDouble("alpha", fOptions.alpha);
+    options->AddDouble("hubShare", fOptions.hubShare);
+    options->AddInt32("propertySize", fOptions.propertySize);
+    options->AddInt32("seed", fOptions.seed);
+    options->AddStrings("relationTypes", fOptions.relationTypes);
+}
+
+status_t Corpus::GetInstalledRelationTypes(BStringList* types)
+{
+    BMessage installedTypes;
+    status_t result = BMimeType::GetInstalledTypes(SEN_RELATION_SUPERTYPE, &installedTypes);
+    if (result != B_OK)
+        return result;
+
+    installedTypes.FindStrings("types", types);     // missing if none installed
+    return B_OK;
+}
+
+/*
+ * private methods
+ */
+
+int32 Corpus::_OutDegree()
+{
+    double degree;
+
+    if (fOptions.distribution == SEN_DEGREE_POWERLAW) {
+        // Pareto with minimum 1 by inverse transform, most files get few relations, some get many
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        degree = floor(pow(1.0 - uniform(fRandom), -1.0 / (fOptions.alpha > 1.0 ? fOptions.alpha - 1.0 : 1.0)));
+    } else {
+        std::uniform_int_distribution<int32> uniform(0, (int32)(2 * fOptions.averageDegree));
+        degree = uniform(fRandom);
+    }
+
+    return degree > fOptions.maxDegree ? fOptions.maxDegree : (int32)degree;
+}
+
+int32 Corpus::_Target(int32 source)
+{
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+    if (fOptions.hubs > 0 && uniform(fRandom) < fOptions.hubShare) {
+        // Zipf over hub ranks, so the first hub is by far the most linked
+        double rank = pow(1.0 - uniform(fRandom), -1.0 / fOptions.alpha);
+        int32 target = (int32)fmod(floor(rank) - 1.0, fOptions.hubs);
+
+        if (target != source)
+            return target;
+    }
+
+    std::uniform_int_distribution<int32> pick(0, fOptions.files - 1);
+    int32 target;
+
+    do {
+        target = pick(fRandom);
+    } while (target == source);
+
+    return target;
+}
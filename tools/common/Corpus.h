@@ -0,0 +1,108 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#pragma once
+
+#include <Entry.h>
+#include <Message.h>
+#include <String.h>
+#include <StringList.h>
+
+#include <random>
+#include <vector>
+
+enum degree_distribution {
+    SEN_DEGREE_UNIFORM = 0,     // out-degree uniformly distributed between 0 and twice the average
+    SEN_DEGREE_POWERLAW         // Pareto distributed out-degree with exponent alpha, at least 1
+};
+
+struct corpus_options {
+    int32               files           = 1000;
+    BString             fileType        = "text/plain";
+    // hubs are the most linked files, e.g. classification entities
+    int32               hubs            = 10;
+    BString             hubType         = "text/plain";
+    // share of relations pointing to a hub with power law distribution
+    double              hubShare        = 0.5;
+    // relation types to use, all installed relation types if empty
+    BStringList         relationTypes;
+    degree_distribution distribution    = SEN_DEGREE_POWERLAW;
+    double              averageDegree   = 4.0;
+    double              alpha           = 2.0;
+    int32               maxDegree       = 1000;
+    // size of the label property of each relation in bytes
+    int32               propertySize    = 64;
+    uint32              seed            = 1;
+};
+
+struct corpus_relation {
+    int32   source;
+    int32   target;
+    int32   type;
+};
+
+/**
+ * synthetic files and a relation graph between them for benchmarks and load tests.
+ *
+ * Generate() only creates the files and plans the relations, which are then added through
+ * the server, so creating them can be measured as well. The same seed always yields the
+ * same corpus.
+ */
+class Corpus {
+
+public:
+                    Corpus(const corpus_options& options);
+
+    /**
+     * create all files in `directory`, which is created if needed, and plan the relations.
+     */
+    status_t        Generate(const char* directory);
+    /**
+     * delete all generated files.
+     */
+    status_t        Remove();
+
+    int32           CountFiles() const;
+    const entry_ref* FileAt(int32 index) const;
+    bool            IsHub(int32 index) const;
+
+    int32           CountRelationTypes() const;
+    const char*     RelationTypeAt(int32 index) const;
+
+    const std::vector<corpus_relation>& Relations() const;
+    /**
+     * build the properties of a planned relation with a label of the configured size.
+     */
+    void            GetProperties(const corpus_relation& relation, BMessage* properties) const;
+
+    /**
+     * pick a random file, uniformly or, with `preferLinked`, one of the sources of planned relations.
+     */
+    int32           RandomFile(bool preferLinked = false);
+    int32           RandomRelationType();
+    /**
+     * pick a random index below `count` from the corpus RNG, for picks the helpers above
+     * don't cover, so runs stay reproducible from the seed.
+     */
+    int32           RandomIndex(int32 count);
+
+    void            GetOptions(BMessage* options) const;
+
+    /**
+     * get all relation types installed in the MIME DB.
+     */
+    static status_t GetInstalledRelationTypes(BStringList* types);
+
+private:
+    int32           _OutDegree();
+    int32           _Target(int32 source);
+
+    corpus_options                  fOptions;
+    std::mt19937                    fRandom;
+    BString                         fDirectory;
+    std::vector<entry_ref>          fFiles;
+    std::vector<corpus_relation>    fRelations;
+};
@@ -0,0 +1,71 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#include "Json.h"
+
+void AppendJsonString(BString* json, const char* value)
+{
+    *json << "\"";
+    for (const char* c = value; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\')
+            *json << "\\";
+        *json << *c;
+    }
+    *json << "\"";
+}
+
+void AppendJsonObject(BString* json, const BMessage* message)
+{
+    *json << "{";
+
+    char* name;
+    type_code type;
+    int32 count;
+
+    for (int32 i = 0; message->GetInfo(B_ANY_TYPE, i, &name, &type, &count) == B_OK; i++) {
+        if (i > 0)
+            *json << ",";
+        AppendJsonString(json, name);
+        *json << ":";
+
+        if (count > 1)
+            *json << "[";
+
+        for (int32 index = 0; index < count; index++) {
+            if (index > 0)
+                *json << ",";
+
+            switch (type) {
+                case B_INT32_TYPE:
+                    *json << message->GetInt32(name, index, 0);
+                    break;
+                case B_INT64_TYPE:
+                    *json << message->GetInt64(name, index, 0);
+                    break;
+                case B_DOUBLE_TYPE:
+                {
+                    BString number;
+                    number.SetToFormat("%g", message->GetDouble(name, index, 0.0));
+                    *json << number;
+                    break;
+                }
+                case B_BOOL_TYPE:
+                    *json << (message->GetBool(name, index, false) ? "true" : "false");
+                    break;
+                case B_STRING_TYPE:
+                    AppendJsonString(json, message->GetString(name, index, ""));
+                    break;
+                default:
+                    *json << "null";
+            }
+        }
+
+        if (count > 1)
+            *json << "]";
+    }
+
+    *json << "}";
+}
@@ -0,0 +1,21 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#pragma once
+
+#include <Message.h>
+#include <String.h>
+
+/**
+ * append `value` as quoted JSON string.
+ */
+void AppendJsonString(BString* json, const char* value);
+
+/**
+ * append the flat int32, int64, double, bool and string fields of a message as JSON object,
+ * fields with more than one value as array.
+ */
+void AppendJsonObject(BString* json, const BMessage* message);
@@ -0,0 +1,106 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#include <algorithm>
+#include <math.h>
+
+#include "LatencyRecorder.h"
+
+LatencyRecorder::LatencyRecorder()
+    : fErrors(0),
+      fTotal(0),
+      fSorted(true)
+{
+}
+
+void LatencyRecorder::Add(bigtime_t latency, bool success)
+{
+    fSamples.push_back(latency);
+    fTotal += latency;
+    fSorted = false;
+
+    if (! success)
+        fErrors++;
+}
+
+void LatencyRecorder::Merge(const LatencyRecorder& other)
+{
+    fSamples.insert(fSamples.end(), other.fSamples.begin(), other.fSamples.end());
+    fErrors += other.fErrors;
+    fTotal  += other.fTotal;
+    fSorted = false;
+}
+
+int64 LatencyRecorder::Count() const
+{
+    return fSamples.size();
+}
+
+int64 LatencyRecorder::Errors() const
+{
+    return fErrors;
+}
+
+bigtime_t LatencyRecorder::Total() const
+{
+    return fTotal;
+}
+
+bigtime_t LatencyRecorder::Max()
+{
+    if (fSamples.empty())
+        return 0;
+
+    _Sort();
+    return fSamples.back();
+}
+
+bigtime_t LatencyRecorder::Percentile(double fraction)
+{
+    if (fSamples.empty())
+        return 0;
+
+    _Sort();
+
+    size_t rank = (size_t)ceil(fraction * fSamples.size());
+    if (rank < 1)
+        rank = 1;
+    if (rank > fSamples.size())
+        rank = fSamples.size();
+
+    return fSamples[rank - 1];
+}
+
+void LatencyRecorder::AppendJson(BString* json, bigtime_t elapsed)
+{
+    int64 count = Count();
+
+    BString throughput;
+    throughput.SetToFormat("%.1f", elapsed > 0 ? count * 1000000.0 / elapsed : 0.0);
+
+    *json << "\"count\":" << count
+          << ",\"errors\":" << Errors()
+          << ",\"throughput\":" << throughput
+          << ",\"avg\":" << (count > 0 ? Total() / count : 0)
+          << ",\"p50\":" << Percentile(0.50)
+          << ",\"p95\":" << Percentile(0.95)
+          << ",\"p99\":" << Percentile(0.99)
+          << ",\"p999\":" << Percentile(0.999)
+          << ",\"max\":" << Max();
+}
+
+/*
+ * private methods
+ */
+
+void LatencyRecorder::_Sort()
+{
+    if (fSorted)
+        return;
+
+    std::sort(fSamples.begin(), fSamples.end());
+    fSorted = true;
+}
@@ -0,0 +1,48 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+#pragma once
+
+#include <String.h>
+#include <SupportDefs.h>
+
+#include <vector>
+
+/**
+ * keeps every latency sample of a benchmark run for exact percentiles.
+ * Not thread safe, use one recorder per thread and Merge() them afterwards.
+ */
+class LatencyRecorder {
+
+public:
+                LatencyRecorder();
+
+    void        Add(bigtime_t latency, bool success = true);
+    void        Merge(const LatencyRecorder& other);
+
+    int64       Count() const;
+    int64       Errors() const;
+    bigtime_t   Total() const;
+    bigtime_t   Max();
+    /**
+     * nearest rank percentile in µs, e.g. Percentile(0.99).
+     */
+    bigtime_t   Percentile(double fraction);
+
+    /**
+     * append count, errors, throughput per second over `elapsed` and percentiles in µs
+     * as JSON members, without enclosing braces.
+     */
+    void        AppendJson(BString* json, bigtime_t elapsed);
+
+private:
+    void        _Sort();
+
+    std::vector<bigtime_t>  fSamples;
+    int64                   fErrors;
+    bigtime_t               fTotal;
+    bool                    fSorted;
+};
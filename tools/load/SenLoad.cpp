@@ -0,0 +1,465 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+/**
+ * concurrent load generator for a running SEN server.
+ *
+ * Generates a corpus, populates its relations and then drives a weighted mix of relation reads,
+ * relation adds and ID lookups from N client threads, each with its own messenger, for a fixed
+ * duration. Throughput, latency percentiles and error rates are reported per request type as
+ * JSON lines, like sen_bench.
+ */
+
+#include <Autolock.h>
+#include <FindDirectory.h>
+#include <Locker.h>
+#include <Messenger.h>
+#include <OS.h>
+#include <Path.h>
+#include <StringList.h>
+
+#include <errno.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "../common/Corpus.h"
+#include "../common/Json.h"
+#include "../common/LatencyRecorder.h"
+#include <sen/Sen.h>
+
+enum load_op {
+    SEN_LOAD_GET = 0,
+    SEN_LOAD_GET_ALL,
+    SEN_LOAD_GET_SELF,
+    SEN_LOAD_GET_ALL_SELF,
+    SEN_LOAD_ADD,
+    SEN_LOAD_ID_FOR_REF,
+    SEN_LOAD_OPS
+};
+
+static const char* kOpNames[SEN_LOAD_OPS] = {
+    "get", "getAll", "getSelf", "getAllSelf", "add", "idForRef"
+};
+
+// mostly reads, as seen from Tracker and other clients
+static const int32 kDefaultWeights[SEN_LOAD_OPS] = { 40, 20, 5, 5, 10, 20 };
+
+struct load_options {
+    corpus_options  corpus;
+    int32           clients     = 8;
+    int32           duration    = 10;       // seconds
+    int32           weights[SEN_LOAD_OPS];
+    bool            populate    = true;
+    BString         directory;
+    BString         output;
+    bool            keep        = false;
+};
+
+struct load_state {
+    const load_options*     options;
+    Corpus*                 corpus;
+    bigtime_t               deadline;
+
+    BLocker                 lock;           // guards results
+    LatencyRecorder         results[SEN_LOAD_OPS];
+};
+
+struct load_client {
+    load_state*     state;
+    int32           index;
+};
+
+static void PrintUsage()
+{
+    fprintf(stderr,
+        "usage: sen_load [options]\n"
+        "  --clients <n>          concurrent clients, default 8\n"
+        "  --duration <s>         seconds to run, default 10\n"
+        "  --mix <op=w,...>       weights of get, getAll, getSelf, getAllSelf, add and idForRef,\n"
+        "                         default get=40,getAll=20,getSelf=5,getAllSelf=5,add=10,idForRef=20\n"
+        "  --files <n>            number of files, default 1000\n"
+        "  --hubs <n>             number of hub files, default 10\n"
+        "  --types <t1,t2,...>    relation types, default all installed relation types\n"
+        "  --distribution <d>     out-degree distribution, uniform or powerlaw (default)\n"
+        "  --degree <n>           average out-degree for uniform distribution, default 4\n"
+        "  --property-size <n>    size of relation properties in bytes, default 64\n"
+        "  --seed <n>             random seed, default 1\n"
+        "  --no-populate          do not add the planned relations before the run\n"
+        "  --dir <path>           corpus directory, default <temp>/sen/load-corpus\n"
+        "  --output <file>        append results to file instead of stdout\n"
+        "  --keep                 keep the corpus after the run\n");
+}
+
+static status_t ParseMix(const char* mix, int32* weights)
+{
+    BStringList entries;
+    BString(mix).Split(",", true, entries);
+
+    for (int32 op = 0; op < SEN_LOAD_OPS; op++) {
+        weights[op] = 0;
+    }
+
+    for (int32 i = 0; i < entries.CountStrings(); i++) {
+        BString entry = entries.StringAt(i);
+        int32 separator = entry.FindFirst('=');
+        if (separator < 0)
+            return B_BAD_VALUE;
+
+        BString name;
+        entry.CopyInto(name, 0, separator);
+
+        int32 op = 0;
+        while (op < SEN_LOAD_OPS && name != kOpNames[op]) {
+            op++;
+        }
+        if (op == SEN_LOAD_OPS)
+            return B_BAD_VALUE;
+
+        weights[op] = atoi(entry.String() + separator + 1);
+        if (weights[op] < 0)
+            return B_BAD_VALUE;
+    }
+
+    return B_OK;
+}
+
+static status_t ParseOptions(int argc, char** argv, load_options* options)
+{
+    memcpy(options->weights, kDefaultWeights, sizeof(kDefaultWeights));
+
+    for (int i = 1; i < argc; i++) {
+        BString option(argv[i]);
+
+        if (option == "--keep") {
+            options->keep = true;
+            continue;
+        }
+        if (option == "--no-populate") {
+            options->populate = false;
+            continue;
+        }
+        if (option == "--help" || i + 1 >= argc)
+            return B_BAD_VALUE;
+
+        const char* value = argv[++i];
+
+        if (option == "--clients")
+            options->clients = atoi(value);
+        else if (option == "--duration")
+            options->duration = atoi(value);
+        else if (option == "--mix") {
+            if (ParseMix(value, options->weights) != B_OK)
+                return B_BAD_VALUE;
+        }
+        else if (option == "--files")
+            options->corpus.files = atoi(value);
+        else if (option == "--hubs")
+            options->corpus.hubs = atoi(value);
+        else if (option == "--types")
+            BString(value).Split(",", true, options->corpus.relationTypes);
+        else if (option == "--distribution") {
+            if (strcmp(value, "uniform") == 0)
+                options->corpus.distribution = SEN_DEGREE_UNIFORM;
+            else if (strcmp(value, "powerlaw") == 0)
+                options->corpus.distribution = SEN_DEGREE_POWERLAW;
+            else
+                return B_BAD_VALUE;
+        }
+        else if (option == "--degree")
+            options->corpus.averageDegree = atof(value);
+        else if (option == "--property-size")
+            options->corpus.propertySize = atoi(value);
+        else if (option == "--seed")
+            options->corpus.seed = strtoul(value, NULL, 10);
+        else if (option == "--dir")
+            options->directory = value;
+        else if (option == "--output")
+            options->output = value;
+        else
+            return B_BAD_VALUE;
+    }
+
+    int32 totalWeight = 0;
+    for (int32 op = 0; op < SEN_LOAD_OPS; op++) {
+        totalWeight += options->weights[op];
+    }
+
+    if (options->corpus.files < 2 || options->clients < 1 || options->duration < 1 || totalWeight == 0)
+        return B_BAD_VALUE;
+
+    return B_OK;
+}
+
+static bool IsSuccess(const BMessage& reply)
+{
+    // relation replies carry "status", core replies "resultCode", bad requests only an error text
+    return reply.GetInt32("status", B_OK) == B_OK
+        && reply.GetInt32("resultCode", B_OK) == B_OK
+        && ! reply.HasString("error");
+}
+
+/**
+ * build a request of type `op` for random files of the corpus.
+ * The corpus is shared read-only, random picks use the client's own generator.
+ */
+static void BuildRequest(load_op op, const Corpus& corpus, std::mt19937& random, BMessage* request)
+{
+    const std::vector<corpus_relation>& relations = corpus.Relations();
+
+    std::uniform_int_distribution<int32> pickFile(0, corpus.CountFiles() - 1);
+    std::uniform_int_distribution<int32> pickType(0, corpus.CountRelationTypes() - 1);
+
+    // reads mostly hit files that actually have relations
+    int32 linked = pickFile(random);
+    corpus_relation relation = { linked, pickFile(random), pickType(random) };
+
+    if (! relations.empty()) {
+        std::uniform_int_distribution<size_t> pickRelation(0, relations.size() - 1);
+        relation = relations[pickRelation(random)];
+        linked   = relation.source;
+    }
+
+    switch (op) {
+        case SEN_LOAD_GET:
+            request->what = SEN_RELATIONS_GET;
+            request->AddRef(SEN_RELATION_SOURCE_REF, corpus.FileAt(linked));
+            request->AddString(SEN_RELATION_TYPE, corpus.RelationTypeAt(relation.type));
+            break;
+        case SEN_LOAD_GET_ALL:
+            request->what = SEN_RELATIONS_GET_ALL;
+            request->AddRef(SEN_RELATION_SOURCE_REF, corpus.FileAt(linked));
+            break;
+        case SEN_LOAD_GET_SELF:
+            request->what = SEN_RELATIONS_GET_SELF;
+            request->AddRef(SEN_RELATION_SOURCE_REF, corpus.FileAt(pickFile(random)));
+            request->AddString(SEN_RELATION_TYPE, corpus.RelationTypeAt(relation.type));
+            break;
+        case SEN_LOAD_GET_ALL_SELF:
+            request->what = SEN_RELATIONS_GET_ALL_SELF;
+            request->AddRef(SEN_RELATION_SOURCE_REF, corpus.FileAt(pickFile(random)));
+            break;
+        case SEN_LOAD_ADD:
+        {
+            corpus_relation added = { pickFile(random), pickFile(random), pickType(random) };
+            if (added.target == added.source)
+                added.target = (added.target + 1) % corpus.CountFiles();
+
+            BMessage properties;
+            corpus.GetProperties(added, &properties);
+
+            request->what = SEN_RELATION_ADD;
+            request->AddRef(SEN_RELATION_SOURCE_REF, corpus.FileAt(added.source));
+            request->AddString(SEN_RELATION_TYPE, corpus.RelationTypeAt(added.type));
+            request->AddRef(SEN_RELATION_TARGET_REF, corpus.FileAt(added.target));
+            request->AddMessage(SEN_RELATION_PROPERTIES, &properties);
+            break;
+        }
+        case SEN_LOAD_ID_FOR_REF:
+            // linked files got their ID when their relations were added
+            request->what = SEN_QUERY_ID_FOR_REF;
+            request->AddRef("refs", corpus.FileAt(linked));
+            break;
+        default:
+            break;
+    }
+}
+
+static status_t ClientThread(void* data)
+{
+    load_client* client = (load_client*)data;
+    load_state* state = client->state;
+    const load_options* options = state->options;
+
+    // every client has its own messenger and thus its own reply port, like separate applications
+    BMessenger server(SEN_SERVER_SIGNATURE);
+    std::mt19937 random(options->corpus.seed * 7919 + client->index);
+
+    int32 totalWeight = 0;
+    for (int32 op = 0; op < SEN_LOAD_OPS; op++) {
+        totalWeight += options->weights[op];
+    }
+    std::uniform_int_distribution<int32> pickWeight(0, totalWeight - 1);
+
+    LatencyRecorder results[SEN_LOAD_OPS];
+
+    while (system_time() < state->deadline) {
+        int32 weight = pickWeight(random);
+        int32 op = 0;
+        while (weight >= options->weights[op]) {
+            weight -= options->weights[op];
+            op++;
+        }
+
+        BMessage request, reply;
+        BuildRequest((load_op)op, *state->corpus, random, &request);
+
+        bigtime_t start = system_time();
+        status_t result = server.SendMessage(&request, &reply);
+        bigtime_t latency = system_time() - start;
+
+        results[op].Add(latency, result == B_OK && IsSuccess(reply));
+    }
+
+    BAutolock _(state->lock);
+
+    for (int32 op = 0; op < SEN_LOAD_OPS; op++) {
+        state->results[op].Merge(results[op]);
+    }
+
+    return B_OK;
+}
+
+static void WriteResult(FILE* out, const char* op, LatencyRecorder* recorder, bigtime_t elapsed)
+{
+    BString errorRate;
+    errorRate.SetToFormat("%.4f", recorder->Count() > 0 ? (double)recorder->Errors() / recorder->Count() : 0.0);
+
+    BString json("{\"op\":");
+    AppendJsonString(&json, op);
+    json << ",";
+    recorder->AppendJson(&json, elapsed);
+    json << ",\"errorRate\":" << errorRate << "}";
+
+    fprintf(out, "%s\n", json.String());
+}
+
+static void Populate(Corpus& corpus)
+{
+    BMessenger server(SEN_SERVER_SIGNATURE);
+    int64 errors = 0;
+
+    for (const corpus_relation& relation : corpus.Relations()) {
+        BMessage properties;
+        corpus.GetProperties(relation, &properties);
+
+        BMessage request(SEN_RELATION_ADD), reply;
+        request.AddRef(SEN_RELATION_SOURCE_REF, corpus.FileAt(relation.source));
+        request.AddString(SEN_RELATION_TYPE, corpus.RelationTypeAt(relation.type));
+        request.AddRef(SEN_RELATION_TARGET_REF, corpus.FileAt(relation.target));
+        request.AddMessage(SEN_RELATION_PROPERTIES, &properties);
+
+        if (server.SendMessage(&request, &reply) != B_OK || ! IsSuccess(reply))
+            errors++;
+    }
+
+    if (errors > 0)
+        fprintf(stderr, "%" B_PRId64 " relations could not be added.\n", errors);
+}
+
+int main(int argc, char** argv)
+{
+    load_options options;
+    if (ParseOptions(argc, argv, &options) != B_OK) {
+        PrintUsage();
+        return 1;
+    }
+
+    if (! BMessenger(SEN_SERVER_SIGNATURE).IsValid()) {
+        fprintf(stderr, "SEN server is not running.\n");
+        return 1;
+    }
+
+    if (options.directory.IsEmpty()) {
+        BPath path;
+        if (find_directory(B_SYSTEM_TEMP_DIRECTORY, &path) != B_OK)
+            path.SetTo("/tmp");
+        path.Append("sen/load-corpus");
+        options.directory = path.Path();
+    }
+
+    FILE* out = stdout;
+    if (! options.output.IsEmpty() && (out = fopen(options.output.String(), "a")) == NULL) {
+        fprintf(stderr, "could not open %s: %s\n", options.output.String(), strerror(errno));
+        return 1;
+    }
+
+    Corpus corpus(options.corpus);
+
+    fprintf(stderr, "generating corpus in %s...\n", options.directory.String());
+    status_t result = corpus.Generate(options.directory.String());
+    if (result != B_OK) {
+        fprintf(stderr, "failed to generate corpus: %s\n", strerror(result));
+        corpus.Remove();
+        return 1;
+    }
+
+    if (options.populate) {
+        fprintf(stderr, "adding %zu relations...\n", corpus.Relations().size());
+        Populate(corpus);
+    }
+
+    load_state state;
+    state.options  = &options;
+    state.corpus   = &corpus;
+
+    std::vector<load_client> clients(options.clients);
+    std::vector<thread_id> threads;
+
+    fprintf(stderr, "running %" B_PRId32 " clients for %" B_PRId32 "s...\n", options.clients, options.duration);
+
+    bigtime_t start = system_time();
+    state.deadline = start + options.duration * 1000000LL;
+
+    for (int32 i = 0; i < options.clients; i++) {
+        clients[i].state = &state;
+        clients[i].index = i;
+
+        thread_id thread = spawn_thread(ClientThread, "sen load client", B_NORMAL_PRIORITY, &clients[i]);
+        if (thread < 0 || resume_thread(thread) != B_OK) {
+            fprintf(stderr, "failed to start client thread: %s\n", strerror(thread));
+            break;
+        }
+        threads.push_back(thread);
+    }
+
+    for (thread_id thread : threads) {
+        status_t exitValue;
+        wait_for_thread(thread, &exitValue);
+    }
+
+    bigtime_t elapsed = system_time() - start;
+
+    BMessage corpusOptions;
+    corpus.GetOptions(&corpusOptions);
+
+    BString meta("{\"load\":\"sen_load\",\"timestamp\":");
+    meta << (int64)time(NULL)
+         << ",\"clients\":" << (int32)threads.size()
+         << ",\"duration\":" << elapsed
+         << ",\"mix\":{";
+    for (int32 op = 0; op < SEN_LOAD_OPS; op++) {
+        meta << (op > 0 ? "," : "") << "\"" << kOpNames[op] << "\":" << options.weights[op];
+    }
+    meta << "},\"corpus\":";
+    AppendJsonObject(&meta, &corpusOptions);
+    meta << "}";
+    fprintf(out, "%s\n", meta.String());
+
+    LatencyRecorder total;
+    for (int32 op = 0; op < SEN_LOAD_OPS; op++) {
+        if (state.results[op].Count() == 0)
+            continue;
+
+        WriteResult(out, kOpNames[op], &state.results[op], elapsed);
+        total.Merge(state.results[op]);
+    }
+    WriteResult(out, "total", &total, elapsed);
+
+    if (out != stdout)
+        fclose(out);
+
+    if (options.keep) {
+        fprintf(stderr, "kept corpus in %s\n", options.directory.String());
+    } else if (corpus.Remove() != B_OK) {
+        fprintf(stderr, "some corpus files could not be removed from %s\n", options.directory.String());
+    }
+
+    return 0;
+}
@@ -0,0 +1,431 @@
+/**
+ * @author Gregor Rosenauer <gregor.rosenauer@gmail.com>
+ * All Rights Reserved.
+ * Distributed under the terms of the MIT License.
+ */
+
+/**
+ * replays a request log captured with SEN_CORE_CAPTURE against a running SEN server.
+ *
+ * Requests are sent at their original pace, scaled by --speed, or as fast as possible, from
+ * --concurrency client threads. Latencies are reported per message type next to the recorded
+ * ones, replies are compared with the recorded replies. Entry refs are replayed as captured,
+ * so the target system needs the same volume and files, e.g. a restored copy of production.
+ */
+
+#include <Autolock.h>
+#include <File.h>
+#include <Locker.h>
+#include <Messenger.h>
+#include <OS.h>
+#include <String.h>
+#include <StringList.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "../common/Json.h"
+#include "../common/LatencyRecorder.h"
+#include "../../src/relations/RelationBatch.h"
+#include "../../src/server/MessageCapture.h"
+#include <sen/Sen.h>
+
+struct replay_options {
+    BString     input;
+    double      speed       = 1.0;      // 0 for as fast as possible
+    int32       concurrency = 1;
+    bool        skipWrites  = false;
+    bool        diff        = true;
+    int32       showDiffs   = 10;
+    BStringList ignore;                 // reply fields not to compare
+    BString     output;
+};
+
+struct op_results {
+    LatencyRecorder replayed;
+    LatencyRecorder recorded;
+    int64           diffs = 0;
+};
+
+struct replay_state {
+    const replay_options*           options;
+    std::vector<capture_record*>    records;
+    bigtime_t                       start;
+    int32                           next;
+
+    BLocker                         lock;       // guards the fields below
+    std::map<uint32, op_results>    results;
+    BStringList                     diffs;
+};
+
+static void PrintUsage()
+{
+    fprintf(stderr,
+        "usage: sen_replay [options] <capture file>\n"
+        "  --speed <n>            replay at n times the captured rate, 0 for as fast as possible, default 1\n"
+        "  --concurrency <n>      number of client threads, default 1\n"
+        "  --skip-writes          do not replay relation writes and ID creation\n"
+        "  --no-diff              do not compare replies with the captured replies\n"
+        "  --show-diffs <n>       print the first n reply differences, default 10\n"
+        "  --ignore <f1,f2,...>   reply fields not to compare, default none besides \"trace\"\n"
+        "  --output <file>        append results to file instead of stdout\n");
+}
+
+static status_t ParseOptions(int argc, char** argv, replay_options* options)
+{
+    for (int i = 1; i < argc; i++) {
+        BString option(argv[i]);
+
+        if (option == "--skip-writes") {
+            options->skipWrites = true;
+            continue;
+        }
+        if (option == "--no-diff") {
+            options->diff = false;
+            continue;
+        }
+        if (! option.StartsWith("--")) {
+            options->input = option;
+            continue;
+        }
+        if (option == "--help" || i + 1 >= argc)
+            return B_BAD_VALUE;
+
+        const char* value = argv[++i];
+
+        if (option == "--speed")
+            options->speed = atof(value);
+        else if (option == "--concurrency")
+            options->concurrency = atoi(value);
+        else if (option == "--show-diffs")
+            options->showDiffs = atoi(value);
+        else if (option == "--ignore")
+            BString(value).Split(",", true, options->ignore);
+        else if (option == "--output")
+            options->output = value;
+        else
+            return B_BAD_VALUE;
+    }
+
+    if (options->input.IsEmpty() || options->concurrency < 1 || options->speed < 0)
+        return B_BAD_VALUE;
+
+    // timings differ on every run
+    options->ignore.Add("trace");
+
+    return B_OK;
+}
+
+/**
+ * message type as 4 char code if printable, e.g. 'SCst', else in hex.
+ */
+static BString WhatToName(uint32 what)
+{
+    char code[5] = {
+        (char)(what >> 24), (char)(what >> 16), (char)(what >> 8), (char)what, '\0'
+    };
+
+    for (int i = 0; i < 4; i++) {
+        if (! isalnum(code[i])) {
+            BString hex;
+            hex.SetToFormat("0x%08" B_PRIx32, what);
+            return hex;
+        }
+    }
+    return BString(code);
+}
+
+static bool IsWrite(const BMessage* request)
+{
+    switch (request->what) {
+        case SEN_RELATION_ADD:
+        case SEN_RELATIONS_ADD_BATCH:
+        case SEN_RELATION_REMOVE:
+        case SEN_RELATIONS_REMOVE_ALL:
+        case SEN_CONFIG_CLASS_ADD:
+            return true;
+        case SEN_QUERY_ID_FOR_REF:
+            return request->GetBool("createIfMissing");
+        default:
+            return false;
+    }
+}
+
+/**
+ * compare `actual` with `expected` field by field, nested messages recursively.
+ * Field order is ignored, as it may change with concurrent handling.
+ *
+ * @return the path of the first differing field in `difference`, empty if equal.
+ */
+static bool DiffMessages(const BMessage* expected, const BMessage* actual, const BStringList& ignore,
+    const BString& path, BString* difference)
+{
+    if (expected->what != actual->what) {
+        difference->SetToFormat("%s: what %s != %s", path.IsEmpty() ? "<reply>" : path.String(),
+            WhatToName(actual->what).String(), WhatToName(expected->what).String());
+        return true;
+    }
+
+    char* name;
+    type_code type;
+    int32 count;
+
+    for (int32 i = 0; expected->GetInfo(B_ANY_TYPE, i, &name, &type, &count) == B_OK; i++) {
+        if (ignore.HasString(name))
+            continue;
+
+        BString fieldPath(path);
+        if (! fieldPath.IsEmpty())
+            fieldPath << ".";
+        fieldPath << name;
+
+        type_code actualType;
+        int32 actualCount;
+        if (actual->GetInfo(name, &actualType, &actualCount) != B_OK) {
+            difference->SetToFormat("%s: missing", fieldPath.String());
+            return true;
+        }
+        if (actualType != type || actualCount != count) {
+            difference->SetToFormat("%s: %" B_PRId32 " values of type %s instead of %" B_PRId32 " of %s",
+                fieldPath.String(), actualCount, WhatToName(actualType).String(),
+                count, WhatToName(type).String());
+            return true;
+        }
+
+        for (int32 index = 0; index < count; index++) {
+            if (type == B_MESSAGE_TYPE) {
+                BMessage expectedNested, actualNested;
+                expected->FindMessage(name, index, &expectedNested);
+                actual->FindMessage(name, index, &actualNested);
+
+                BString nestedPath(fieldPath);
+                if (count > 1)
+                    nestedPath << "[" << index << "]";
+
+                if (DiffMessages(&expectedNested, &actualNested, ignore, nestedPath, difference))
+                    return true;
+                continue;
+            }
+
+            const void* expectedData;
+            const void* actualData;
+            ssize_t expectedSize, actualSize;
+
+            expected->FindData(name, type, index, &expectedData, &expectedSize);
+            actual->FindData(name, type, index, &actualData, &actualSize);
+
+            if (expectedSize != actualSize || memcmp(expectedData, actualData, expectedSize) != 0) {
+                if (type == B_STRING_TYPE) {
+                    difference->SetToFormat("%s: \"%s\" instead of \"%s\"", fieldPath.String(),
+                        (const char*)actualData, (const char*)expectedData);
+                } else {
+                    difference->SetToFormat("%s: value %" B_PRId32 " differs", fieldPath.String(), index);
+                }
+                return true;
+            }
+        }
+    }
+
+    for (int32 i = 0; actual->GetInfo(B_ANY_TYPE, i, &name, &type, &count) == B_OK; i++) {
+        if (! ignore.HasString(name) && ! expected->HasData(name, type)) {
+            difference->SetToFormat("%s%s%s: unexpected", path.String(), path.IsEmpty() ? "" : ".", name);
+            return true;
+        }
+    }
+
+    difference->Truncate(0);
+    return false;
+}
+
+static status_t ReplayThread(void* data)
+{
+    replay_state* state = (replay_state*)data;
+    const replay_options* options = state->options;
+
+    BMessenger server(SEN_SERVER_SIGNATURE);
+    bigtime_t firstReceived = state->records.front()->received;
+
+    std::map<uint32, op_results> results;
+    BStringList diffs;
+    int64 diffCount = 0;
+
+    while (true) {
+        int32 index = atomic_add(&state->next, 1);
+        if (index >= (int32)state->records.size())
+            break;
+
+        capture_record* record = state->records[index];
+        if (options->skipWrites && IsWrite(&record->request))
+            continue;
+
+        if (options->speed > 0) {
+            bigtime_t due = state->start + (bigtime_t)((record->received - firstReceived) / options->speed);
+            snooze_until(due, B_SYSTEM_TIMEBASE);
+        }
+
+        BMessage reply;
+        bigtime_t start = system_time();
+        status_t result = server.SendMessage(&record->request, &reply);
+        bigtime_t latency = system_time() - start;
+
+        bool success = result == B_OK && reply.GetInt32("status", B_OK) == B_OK && ! reply.HasString("error");
+
+        op_results& op = results[record->request.what];
+        op.replayed.Add(latency, success);
+        op.recorded.Add(record->latency,
+            record->reply.GetInt32("status", B_OK) == B_OK && ! record->reply.HasString("error"));
+
+        BString difference;
+        if (options->diff && result == B_OK
+            && DiffMessages(&record->reply, &reply, options->ignore, "", &difference)) {
+            op.diffs++;
+            if (diffCount++ < options->showDiffs) {
+                BString line;
+                line.SetToFormat("#%" B_PRId32 " %s %s", index,
+                    WhatToName(record->request.what).String(), difference.String());
+                diffs.Add(line);
+            }
+        }
+    }
+
+    BAutolock _(state->lock);
+
+    for (auto& entry : results) {
+        op_results& total = state->results[entry.first];
+        total.replayed.Merge(entry.second.replayed);
+        total.recorded.Merge(entry.second.recorded);
+        total.diffs += entry.second.diffs;
+    }
+    state->diffs.Add(diffs);
+
+    return B_OK;
+}
+
+static void WriteResult(FILE* out, const char* op, op_results* results, bigtime_t elapsed)
+{
+    BString json("{\"op\":");
+    AppendJsonString(&json, op);
+    json << ",";
+    results->replayed.AppendJson(&json, elapsed);
+    json << ",\"recordedP50\":" << results->recorded.Percentile(0.50)
+         << ",\"recordedP99\":" << results->recorded.Percentile(0.99)
+         << ",\"recordedErrors\":" << results->recorded.Errors()
+         << ",\"diffs\":" << results->diffs
+         << "}";
+
+    fprintf(out, "%s\n", json.String());
+}
+
+int main(int argc, char** argv)
+{
+    replay_options options;
+    if (ParseOptions(argc, argv, &options) != B_OK) {
+        PrintUsage();
+        return 1;
+    }
+
+    BFile input(options.input.String(), B_READ_ONLY);
+    status_t result = input.InitCheck();
+    if (result == B_OK)
+        result = MessageCapture::ReadHeader(&input);
+    if (result != B_OK) {
+        fprintf(stderr, "could not read capture %s: %s\n", options.input.String(), strerror(result));
+        return 1;
+    }
+
+    replay_state state;
+    state.options = &options;
+    state.next    = 0;
+
+    while (true) {
+        capture_record* record = new capture_record();
+        if ((result = MessageCapture::ReadRecord(&input, record)) != B_OK) {
+            delete record;
+            break;
+        }
+        state.records.push_back(record);
+    }
+
+    if (result != B_LAST_BUFFER_ERROR) {
+        // the server may have been stopped while writing the last record
+        fprintf(stderr, "stopped reading capture after %zu records: %s\n",
+            state.records.size(), strerror(result));
+    }
+    if (state.records.empty()) {
+        fprintf(stderr, "nothing to replay.\n");
+        return 1;
+    }
+
+    if (! BMessenger(SEN_SERVER_SIGNATURE).IsValid()) {
+        fprintf(stderr, "SEN server is not running.\n");
+        return 1;
+    }
+
+    FILE* out = stdout;
+    if (! options.output.IsEmpty() && (out = fopen(options.output.String(), "a")) == NULL) {
+        fprintf(stderr, "could not open %s: %s\n", options.output.String(), strerror(errno));
+        return 1;
+    }
+
+    fprintf(stderr, "replaying %zu requests with %" B_PRId32 " threads...\n",
+        state.records.size(), options.concurrency);
+
+    std::vector<thread_id> threads;
+    state.start = system_time();
+
+    for (int32 i = 0; i < options.concurrency; i++) {
+        thread_id thread = spawn_thread(ReplayThread, "sen replay", B_NORMAL_PRIORITY, &state);
+        if (thread < 0 || resume_thread(thread) != B_OK) {
+            fprintf(stderr, "failed to start replay thread: %s\n", strerror(thread));
+            break;
+        }
+        threads.push_back(thread);
+    }
+
+    for (thread_id thread : threads) {
+        status_t exitValue;
+        wait_for_thread(thread, &exitValue);
+    }
+
+    bigtime_t elapsed = system_time() - state.start;
+
+    BString meta("{\"replay\":");
+    AppendJsonString(&meta, options.input.String());
+    BString speed;
+    speed.SetToFormat("%g", options.speed);
+    meta << ",\"records\":" << (int64)state.records.size()
+         << ",\"speed\":" << speed
+         << ",\"concurrency\":" << options.concurrency
+         << ",\"captured\":" << state.records.back()->received - state.records.front()->received
+         << ",\"elapsed\":" << elapsed
+         << "}";
+    fprintf(out, "%s\n", meta.String());
+
+    op_results total;
+    for (auto& entry : state.results) {
+        WriteResult(out, WhatToName(entry.first).String(), &entry.second, elapsed);
+
+        total.replayed.Merge(entry.second.replayed);
+        total.recorded.Merge(entry.second.recorded);
+        total.diffs += entry.second.diffs;
+    }
+    WriteResult(out, "total", &total, elapsed);
+
+    for (int32 i = 0; i < state.diffs.CountStrings(); i++) {
+        fprintf(stderr, "%s\n", state.diffs.StringAt(i).String());
+    }
+
+    if (out != stdout)
+        fclose(out);
+
+    for (capture_record* record : state.records) {
+        delete record;
+    }
+
+    return 0;
+}